@@ -0,0 +1,198 @@
+#include "attendancereply.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonParseError>
+#include <QElapsedTimer>
+#include <QtEndian>
+#include <QDebug>
+#include <cstring>
+
+/**
+ * @brief JSON应答中的时间格式
+ */
+static const char *TIME_FORMAT = "yyyy-MM-dd hh:mm:ss";
+
+/**
+ * @brief 二进制应答的定长部分：类型、状态、员工ID、人脸ID、相似度、时间、两个字符串长度
+ */
+static const int BINARY_FIXED_SIZE = 1 + 1 + 8 + 8 + 4 + 8 + 2 + 2;
+
+template <typename T>
+static void append_be(QByteArray &buffer, T value)
+{
+    char bytes[sizeof(T)];
+    qToBigEndian(value, bytes);
+    buffer.append(bytes, sizeof(T));
+}
+
+template <typename T>
+static T read_be(const char *&p)
+{
+    T value = qFromBigEndian<T>(p);
+    p += sizeof(T);
+    return value;
+}
+
+bool AttendanceReply::ok() const
+{
+    return employeeid >= 0;
+}
+
+QByteArray AttendanceReply::to_json(const FaceResult &result) const
+{
+    if(employee){
+        // 员工字段已经预先编码，只需拼接时间和识别结果字段
+        QByteArray data;
+        data.reserve(employee->jsonfields.size() + 256);
+        data.append('{');
+        data.append(employee->jsonfields);
+        data.append(",\"time\":\"");
+        data.append(time.toString(TIME_FORMAT).toLatin1());
+        data.append("\",");
+        data.append(result.json_fields().toUtf8());
+        data.append('}');
+        return data;
+    }
+    // 失败时employeeID为一个空格，与旧版本服务器的应答一致
+    QString msg = QString("{\"employeeID\":\"%1\",\"name\":\"%2\",\"department\":\"%3\",\"time\":\"%4\",%5}")
+                      .arg(ok() ? QString::number(employeeid) : QString(" ")).arg(name).arg(department)
+                      .arg(ok() ? time.toString(TIME_FORMAT) : QString())
+                      .arg(result.json_fields());
+    return msg.toUtf8();
+}
+
+void AttendanceReply::append_binary(QByteArray &buffer) const
+{
+    quint32 similaritybits;
+    std::memcpy(&similaritybits, &similarity, sizeof(similaritybits));
+    if(employee){
+        // 姓名和部门已经按二进制格式预先编码
+        buffer.reserve(buffer.size() + BINARY_FIXED_SIZE + employee->binaryfields.size());
+        append_be<quint8>(buffer, BINARY_TYPE);
+        append_be<quint8>(buffer, 1);
+        append_be<qint64>(buffer, employee->employeeid);
+        append_be<qint64>(buffer, faceid);
+        append_be<quint32>(buffer, similaritybits);
+        append_be<qint64>(buffer, time.toMSecsSinceEpoch());
+        buffer.append(employee->binaryfields);
+        return;
+    }
+
+    const QByteArray namebytes = name.toUtf8();
+    const QByteArray departmentbytes = department.toUtf8();
+
+    buffer.reserve(buffer.size() + BINARY_FIXED_SIZE + namebytes.size() + departmentbytes.size());
+    append_be<quint8>(buffer, BINARY_TYPE);
+    append_be<quint8>(buffer, ok() ? 1 : 0);
+    append_be<qint64>(buffer, employeeid);
+    append_be<qint64>(buffer, faceid);
+    append_be<quint32>(buffer, similaritybits);
+    append_be<qint64>(buffer, ok() ? time.toMSecsSinceEpoch() : 0);
+    append_be<quint16>(buffer, (quint16)namebytes.size());
+    buffer.append(namebytes);
+    append_be<quint16>(buffer, (quint16)departmentbytes.size());
+    buffer.append(departmentbytes);
+}
+
+bool AttendanceReply::from_binary(const QByteArray &data, AttendanceReply &reply)
+{
+    if(data.size() < BINARY_FIXED_SIZE) return false;
+    const char *p = data.constData();
+    const char *end = p + data.size();
+    if(read_be<quint8>(p) != BINARY_TYPE) return false;
+    bool ok = read_be<quint8>(p) != 0;
+    reply.employeeid = read_be<qint64>(p);
+    reply.faceid = read_be<qint64>(p);
+    quint32 similaritybits = read_be<quint32>(p);
+    std::memcpy(&reply.similarity, &similaritybits, sizeof(similaritybits));
+    qint64 msecs = read_be<qint64>(p);
+    reply.time = ok ? QDateTime::fromMSecsSinceEpoch(msecs) : QDateTime();
+
+    quint16 length = read_be<quint16>(p);
+    if(end - p < length + 2) return false;
+    reply.name = QString::fromUtf8(p, length);
+    p += length;
+    length = read_be<quint16>(p);
+    if(end - p < length) return false;
+    reply.department = QString::fromUtf8(p, length);
+    return true;
+}
+
+bool AttendanceReply::from_json(const QByteArray &data, AttendanceReply &reply)
+{
+    QJsonParseError err;
+    QJsonDocument doc = QJsonDocument::fromJson(data, &err);
+    if(err.error != QJsonParseError::NoError) return false;
+    QJsonObject obj = doc.object();
+    bool ok = false;
+    reply.employeeid = obj.value("employeeID").toString().toLongLong(&ok);
+    if(!ok) reply.employeeid = -1;
+    reply.name = obj.value("name").toString();
+    reply.department = obj.value("department").toString();
+    reply.time = QDateTime::fromString(obj.value("time").toString(), TIME_FORMAT);
+    reply.faceid = obj.value("faceID").toVariant().toLongLong();
+    QJsonArray matches = obj.value("matches").toArray();
+    reply.similarity = matches.isEmpty() ? 0.0f : (float)matches.first().toObject().value("similarity").toDouble();
+    return true;
+}
+
+/**
+ * @brief 对一个应答分别测量JSON和二进制的编解码耗时
+ * @details JSON一侧包括编码、toUtf8和QJsonDocument解析；
+ *          二进制一侧复用同一个缓冲区，与会话发送应答的方式相同
+ */
+static void measure_reply(const char *label, const AttendanceReply &reply, const FaceResult &result, int iterations)
+{
+    AttendanceReply decoded;
+    QElapsedTimer timer;
+    timer.start();
+    qint64 jsonbytes = 0;
+    for(int i = 0; i < iterations; i++){
+        QByteArray data = reply.to_json(result);
+        jsonbytes = data.size();
+        AttendanceReply::from_json(data, decoded);
+    }
+    qint64 jsontime = timer.nsecsElapsed();
+
+    QByteArray buffer;
+    buffer.reserve(256);
+    timer.restart();
+    for(int i = 0; i < iterations; i++){
+        buffer.resize(0);
+        reply.append_binary(buffer);
+        AttendanceReply::from_binary(buffer, decoded);
+    }
+    qint64 binarytime = timer.nsecsElapsed();
+
+    qDebug()<<"应答编解码评估（"<<label<<"）："<<iterations<<"次"
+            <<"JSON"<<jsonbytes<<"字节"<<jsontime / iterations<<"纳秒/次"
+            <<"二进制"<<buffer.size()<<"字节"<<binarytime / iterations<<"纳秒/次";
+}
+
+/**
+ * @brief 编解码对比
+ * @details 样例应答带有中文姓名和5个候选，与线上识别成功的应答相当，
+ *          分别测量逐次编码员工字段和使用员工目录预编码片段两种情况
+ */
+void AttendanceReply::benchmark(int iterations)
+{
+    if(iterations <= 0) return;
+    AttendanceReply reply;
+    reply.employeeid = 1024;
+    reply.name = QString::fromUtf8("张三丰");
+    reply.department = QString::fromUtf8("软件");
+    reply.time = QDateTime::currentDateTime();
+    reply.faceid = 37;
+    reply.similarity = 0.8731f;
+    FaceResult result;
+    result.faceid = reply.faceid;
+    for(int i = 0; i < 5; i++){
+        result.matches.push_back(FaceMatch{reply.faceid + i, reply.similarity - i * 0.05f});
+    }
+
+    measure_reply("逐次编码", reply, result, iterations);
+    reply.employee = EmployeeDirectory::make_entry(reply.employeeid, reply.name);
+    measure_reply("预编码片段", reply, result, iterations);
+}
@@ -0,0 +1,78 @@
+#ifndef ATTENDANCEREPLY_H
+#define ATTENDANCEREPLY_H
+
+#include "faceresult.h"
+#include "employeedirectory.h"
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+
+/**
+ * @brief 考勤应答
+ * @details 一次识别返回给终端的内容，支持两种编码：
+ *          - JSON：旧终端使用的格式，除员工信息外还附带faceID、matches候选列表和timings各阶段耗时
+ *          - 二进制：终端在帧中带FramePacket::FLAG_BINARY_REPLY时使用，只包含终端显示需要的字段，
+ *            直接追加到会话的发送缓冲区，不经过QString和JSON解析
+ *          二进制格式（大端）：
+ *          - quint8 类型，固定为BINARY_TYPE，JSON总是以'{'开头，两者可以区分
+ *          - quint8 状态，1为识别成功并已记录考勤，0为失败
+ *          - qint64 员工ID，失败时为-1
+ *          - qint64 人脸ID，未识别为-1
+ *          - float 最佳候选的相似度
+ *          - qint64 考勤时间，自1970-01-01 UTC起的毫秒数，失败时为0
+ *          - quint16 姓名字节数 + UTF-8姓名
+ *          - quint16 部门字节数 + UTF-8部门
+ *          识别成功时应答带有员工目录中的条目，员工字段直接拼接条目中预先编码好的片段
+ */
+struct AttendanceReply
+{
+    /**
+     * @brief 二进制应答的类型字节
+     */
+    static const quint8 BINARY_TYPE = 0x01;
+
+    qint64 employeeid = -1;     ///< 员工ID，失败时为-1
+    QString name;               ///< 员工姓名
+    QString department;         ///< 部门
+    QDateTime time;             ///< 考勤时间，失败时无效
+    qint64 faceid = -1;         ///< 识别到的人脸ID，未识别为-1
+    float similarity = 0.0f;    ///< 最佳候选的相似度
+    std::shared_ptr<const EmployeeEntry> employee;  ///< 员工目录中的条目，有值时编码使用其中的预编码片段，不再使用name和department
+
+    /**
+     * @brief 是否识别成功并已记录考勤
+     */
+    bool ok() const;
+
+    /**
+     * @brief 编码为JSON
+     * @param result 识别结果，其候选列表和各阶段耗时附加在员工信息之后
+     */
+    QByteArray to_json(const FaceResult &result) const;
+
+    /**
+     * @brief 编码为二进制并追加到buffer末尾
+     * @details buffer通常是会话复用的发送缓冲区，容量足够时不分配内存
+     */
+    void append_binary(QByteArray &buffer) const;
+
+    /**
+     * @brief 解码二进制应答
+     * @return 数据不完整或类型不符时返回false
+     */
+    static bool from_binary(const QByteArray &data, AttendanceReply &reply);
+
+    /**
+     * @brief 解码JSON应答，与终端的解析方式相同
+     */
+    static bool from_json(const QByteArray &data, AttendanceReply &reply);
+
+    /**
+     * @brief 比较两种编码的编解码耗时和字节数
+     * @param iterations 每种编码重复的次数
+     * @details 各自完成iterations次"编码+解码"，输出平均耗时和每个应答的字节数
+     */
+    static void benchmark(int iterations);
+};
+
+#endif // ATTENDANCEREPLY_H
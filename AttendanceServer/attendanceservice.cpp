@@ -0,0 +1,395 @@
+#include "attendanceservice.h"
+#include "attendancestore.h"
+#include "attendancewriter.h"
+#include "employeedirectory.h"
+#include "qfaceobject.h"
+#include "serverconfig.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+
+/**
+ * @brief 解码统计窗口
+ * @details 每解码这么多帧输出一次平均字节数、分辨率和解码耗时，用于比较终端整帧上传和裁剪图上传
+ */
+static const quint64 DECODE_STAT_WINDOW = 200;
+
+/**
+ * @brief AttendanceService类构造函数
+ * @param parent 父对象指针
+ * @details 设置TCP服务器、数据库模型和多线程环境
+ *          1. 配置并启动TCP服务器，监听8888端口所有网络接口，每个连接对应一个会话
+ *          2. 按server.ini配置创建人脸识别工作池，每个工作对象运行在独立线程
+ *          3. 启动考勤写入线程，使用与主线程相同的数据库文件，读取当天已有的考勤用于去重
+ *          4. 建立信号槽连接处理客户端连接和人脸识别结果
+ */
+AttendanceService::AttendanceService(QObject *parent)
+    : QObject(parent)
+    , fpool(ServerConfig::worker_count())
+    , writer(QSqlDatabase::database().databaseName())
+    , debouncer(ServerConfig::debounce_seconds())
+{
+    //qtcpServer当有客户端连接会发送newconnection
+    connect(&mserver,&QTcpServer::newConnection,this,&AttendanceService::accept_client);
+    mserver.listen(QHostAddress::Any,8888);//监听所有网络接口，启动服务器
+    nextsessionid = 1;
+    decodecount = 0;
+    decodebytes = 0;
+    decodepixels = 0;
+    decodetime = 0;
+    debouncer.load();
+
+    // 人脸识别工作池在构造时已为每个QFaceObject创建独立线程
+    // 作用：将耗时的人脸识别计算从主线程中分离出来，并分摊到多个CPU核心
+    // 当系统接收到客户端发送的人脸图像数据后， AttendanceService 会发射 query 信号
+    // 该信号连接到 FaceWorkerPool::face_query，由工作池放入排队最少的工作对象的队列，按批识别
+    connect(this,&AttendanceService::query,&fpool,&FaceWorkerPool::face_query);
+    // 终端在本地提取好特征时跳过图像解码和特征提取，直接比对
+    connect(this,&AttendanceService::query_feature,&fpool,&FaceWorkerPool::face_search);
+    //关联工作池汇总后的send_result信号
+    connect(&fpool,&FaceWorkerPool::send_result,this,&AttendanceService::recv_result);
+}
+
+/**
+ * @brief 客户端连接处理函数
+ * @details 为每个新连接创建独立的ClientSession，会话各自保存拆包状态和在途请求
+ * @note 触发时机：当QTcpServer检测到有新的客户端连接时，通过newConnection信号调用此函数
+ */
+void AttendanceService::accept_client()
+{
+    //一次newConnection可能对应多个排队的连接，全部取出
+    while(mserver.hasPendingConnections()){
+        //获取与客户端通信的套接字，交给会话对象管理
+        QTcpSocket *socket = mserver.nextPendingConnection();
+        ClientSession *session = new ClientSession(nextsessionid++, socket, this);
+        sessions.insert(session->id(), session);
+        connect(session,&ClientSession::frame_received,this,&AttendanceService::recv_frame);
+        connect(session,&ClientSession::session_closed,this,&AttendanceService::close_session);
+        qDebug()<<"客户端连接："<<session->peer()<<"会话ID"<<session->id()<<"在线终端数"<<sessions.size();
+    }
+}
+
+/**
+ * @brief 会话关闭处理函数
+ * @param sessionid 断开连接的会话ID
+ * @details 从会话表中移除会话，尚在识别中的请求结果到达时会因找不到会话而被丢弃
+ */
+void AttendanceService::close_session(quint64 sessionid)
+{
+    ClientSession *session = sessions.take(sessionid);
+    if(session == nullptr) return;
+    qDebug()<<"客户端断开："<<session->peer()<<"会话ID"<<sessionid<<"在线终端数"<<sessions.size();
+    //在信号处理过程中不能直接delete发送者
+    session->deleteLater();
+}
+
+/**
+ * @brief 图像帧处理函数
+ * @param sessionid 发送该帧的会话ID
+ * @param requestid 会话内的请求ID
+ * @param data 客户端发送的JPEG图像数据，可能带有人脸框包头，指向会话的接收缓冲区
+ * @details 1. 拆出包头中的人脸框和JPEG数据，JPEG数据直接引用接收缓冲区，不复制
+ *          2. 用cv::Mat头包装JPEG数据，只解码一次，解码结果同时用于识别和界面显示
+ *          3. 解码后的图像交给识别线程触发人脸识别，会话ID和请求ID随结果一起返回
+ *          4. 终端给出的人脸框随图像交给识别线程，识别时可以跳过整帧检测
+ *          5. 终端上传的是特征时不解码图像，直接发出query_feature信号进行比对
+ * @note 触发时机：当某个会话拆出一帧完整数据时，通过frame_received信号调用此函数
+ */
+void AttendanceService::recv_frame(quint64 sessionid, quint64 requestid, const QByteArray &data)
+{
+    FramePacket packet;
+    if(!FramePacket::parse(data, packet)){
+        qDebug()<<"无法解析的数据包，会话ID"<<sessionid;
+        send_reply(sessionid, requestid, AttendanceReply(), FaceResult());
+        return;
+    }
+    // 终端分配了请求ID：应答按分帧格式带回该ID
+    if(packet.requestid != 0){
+        ClientSession *session = sessions.value(sessionid, nullptr);
+        if(session != nullptr){
+            session->tag_request(requestid, packet.requestid);
+            // 二进制应答依赖分帧格式，只有带请求ID的终端才能使用
+            if(packet.binaryreply) session->use_binary_replies();
+        }
+    }
+
+    // 终端已经在本地提取了特征：不参与识别，只显示随特征上传的小缩略图（可能为空）
+    if(!packet.feature.empty()){
+        if(!packet.image.isEmpty()){
+            emit thumbnail_received(packet.image);
+        }
+        emit query_feature(sessionid, requestid, packet.feature);
+        return;
+    }
+
+    // 人脸图像处理与识别准备阶段
+    // cv::Mat头直接指向接收缓冲区中的JPEG数据，不再复制到std::vector
+    // imdecode只读取该数据，解码结果是独立的图像，可以安全地交给识别线程
+    const cv::Mat encoded(1, packet.image.size(), CV_8UC1, const_cast<char*>(packet.image.constData()));
+
+    // 使用OpenCV的imdecode函数将二进制数据解码为彩色图像
+    // cv::IMREAD_COLOR参数指定解码为3通道BGR彩色图像
+    QElapsedTimer timer;
+    timer.start();
+    cv::Mat faceImage = cv::imdecode(encoded,cv::IMREAD_COLOR);
+    if(faceImage.empty()){
+        qDebug()<<"图像解码失败，会话ID"<<sessionid;
+        send_reply(sessionid, requestid, AttendanceReply(), FaceResult());
+        return;
+    }
+
+    // 解码耗时统计：终端只上传人脸裁剪图时，字节数、像素数和解码耗时都应明显下降
+    decodetime += timer.nsecsElapsed() / 1000;
+    decodebytes += packet.image.size();
+    decodepixels += (qint64)faceImage.cols * faceImage.rows;
+    if(++decodecount >= DECODE_STAT_WINDOW){
+        qDebug()<<"图像解码：平均"<<decodebytes / (qint64)decodecount<<"字节"
+                <<decodepixels / (qint64)decodecount<<"像素，耗时"<<decodetime / (qint64)decodecount<<"微秒";
+        decodecount = 0;
+        decodebytes = 0;
+        decodepixels = 0;
+        decodetime = 0;
+    }
+
+    //通知界面显示图片：复用识别用的解码结果，不再解码一次JPEG；无界面运行时没有接收方
+    emit frame_decoded(faceImage);
+
+    // 发射query信号，将人脸图像传递给工作线程中的QFaceObject对象处理
+    // 会话ID和请求ID随识别结果一起返回，保证应答发回给发送该帧的终端
+    emit query(sessionid, requestid, faceImage, packet.face);
+}
+
+/**
+ * @brief 向指定会话发送应答
+ * @param sessionid 会话ID
+ * @param requestid 请求ID
+ * @param reply 员工信息和考勤时间，识别失败时为默认值
+ * @param result 识别结果
+ */
+void AttendanceService::send_reply(quint64 sessionid, quint64 requestid, const AttendanceReply &reply, const FaceResult &result)
+{
+    ClientSession *session = sessions.value(sessionid, nullptr);
+    if(session == nullptr){
+        qDebug()<<"会话"<<sessionid<<"已断开，丢弃请求"<<requestid<<"的应答";
+        return;
+    }
+    session->send_reply(requestid, reply, result);
+}
+
+/**
+ * @brief 接收人脸识别结果并处理考勤逻辑的槽函数
+ * @param sessionid 发送该帧的会话ID
+ * @param requestid 会话内的请求ID
+ * @param result 识别结果，result.faceid < 0表示识别失败，>= 0表示成功识别
+ * @details 考勤系统的核心业务处理入口，识别之前被丢弃的帧不应答，其余的处理流程包括：
+ *          1. 验证人脸识别结果
+ *          2. 在员工目录中查找个人信息
+ *          3. 去重窗口内的重复识别只在内存中应答，其余考勤记录交给写入线程，由它批量提交到数据库
+ *          4. 向发送该帧的客户端发送响应数据，JSON应答中附带faceID、matches和timings字段，
+ *             客户端可据此做多帧融合，旧客户端只读取员工信息字段，不受影响；
+ *             要求二进制应答的客户端只收到员工信息、人脸ID和最佳相似度
+ * @note 触发时机：当QFaceObject完成人脸识别后，经工作池的send_result信号调用此函数
+ */
+void AttendanceService::recv_result(quint64 sessionid, quint64 requestid, FaceResult result)
+{
+    // 在识别之前被丢弃的帧：终端已经发送了更新的帧，不再应答，只结束请求记录
+    if(result.dropped){
+        ClientSession *session = sessions.value(sessionid, nullptr);
+        if(session != nullptr) session->finish_request(requestid);
+        return;
+    }
+
+    //查找faceid对应的个人信息
+    const int64_t faceid = result.faceid;
+    qDebug()<<"识别到的人脸ID为："<<faceid<<"候选数"<<result.matches.size()<<"耗时"<<result.times.total<<"微秒";
+    AttendanceReply reply;
+    reply.faceid = faceid;
+    reply.similarity = result.matches.empty() ? 0.0f : result.matches.front().similarity;
+    if(faceid < 0){
+        send_reply(sessionid, requestid, reply, result);//把打包好的数据发送给客户端
+        return;
+    }
+    // 在员工目录中按人脸ID查找员工，只查一次哈希表，不执行SQL查询
+    std::shared_ptr<const EmployeeEntry> employee = EmployeeDirectory::instance().find(faceid);
+    if(employee){
+        // 应答包含员工核心信息，编码格式由会话决定（见AttendanceReply），员工字段使用目录中预先编码的片段
+        // employeeID: 工号, name: 姓名, department: 部门, time: 当前时间
+        reply.employee = employee;
+        reply.employeeid = employee->employeeid;
+        reply.name = employee->name;
+        reply.department = employee->department;
+        // 考勤去重：窗口内的重复识别在内存中应答，应答中的时间为已有记录的时间
+        // 需要记录时交给写入线程批量提交，记录的时间与应答一致，主线程不等待磁盘
+        if(debouncer.accept(reply.employeeid, QDateTime::currentDateTime(), reply.time)){
+            writer.record(reply.employeeid, reply.time);
+        }
+
+        // 考勤成功处理：将完整员工信息和时间戳发送给客户端
+        send_reply(sessionid, requestid, reply, result);// 发送成功响应给客户端
+    }else{
+        // 员工表中没有对应记录：同样给出空应答，结束该请求
+        send_reply(sessionid, requestid, reply, result);
+    }
+}
+
+/**
+ * @brief 扩展性评估使用的图像数上限
+ */
+static const int SCALING_IMAGES = 32;
+
+/**
+ * @brief 读取员工头像作为识别扩展性评估的图像
+ * @details 头像都是注册时检测过人脸的照片，识别耗时与终端上传的人脸图接近
+ */
+static std::vector<cv::Mat> load_benchmark_frames()
+{
+    std::vector<cv::Mat> frames;
+    QSqlQuery query;
+    if(!query.exec(QString("select headfile from employee where faceID >= 0 limit %1").arg(SCALING_IMAGES))){
+        qDebug()<<query.lastError().text();
+        return frames;
+    }
+    while(query.next()){
+        cv::Mat image = cv::imread(query.value(0).toString().toUtf8().data());
+        if(!image.empty()) frames.push_back(image);
+    }
+    return frames;
+}
+
+/**
+ * @brief 重建人脸特征库
+ * @details 旧版本由SeetaFace引擎把人脸特征保存在face.db中，该格式无法读出特征向量
+ *          特征库文件不存在或快照校验失败时，根据employee表中保存的头像重新提取特征，
+ *          沿用员工原有的faceID，已有的考勤数据和员工信息不受影响
+ */
+static void rebuild_gallery()
+{
+    QSqlQuery query;
+    if(!query.exec("select faceID, headfile from employee where faceID >= 0")){
+        qDebug()<<query.lastError().text();
+        return;
+    }
+    QFaceObject faceobj;
+    int count = 0;
+    while(query.next()){
+        cv::Mat image = cv::imread(query.value(1).toString().toUtf8().data());
+        if(faceobj.face_import(query.value(0).toLongLong(), image)){
+            count++;
+        }else{
+            qDebug()<<"无法从头像重建人脸特征："<<query.value(1).toString();
+        }
+    }
+    if(count > 0){
+        faceobj.save_gallery();
+        qDebug()<<"已从员工头像重建人脸特征库："<<count<<"张人脸";
+    }
+}
+
+bool AttendanceService::initialize()
+{
+    // 注册自定义数据类型到Qt元对象系统
+    // 目的：使这些类型可以在Qt的信号槽机制中安全传递
+    // cv::Mat&：OpenCV的矩阵引用类型，用于在不同线程间传递图像数据
+    // cv::Mat：OpenCV的矩阵值类型，用于在不同线程间传递图像数据
+    // int64_t：64位整数类型，用于在信号槽中传递大整数数据（如时间戳、ID等）
+    qRegisterMetaType<cv::Mat>("cv::Mat&");
+    qRegisterMetaType<cv::Mat>("cv::Mat");
+    qRegisterMetaType<int64_t>("int64_t");
+    // FaceResult：识别结果，由工作线程经工作池传回主线程
+    qRegisterMetaType<FaceResult>("FaceResult");
+
+    //连接数据库
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
+    //设置数据库名称
+    db.setDatabaseName("server.db");
+    //打开数据库
+    if(!db.open()){
+        qDebug()<<db.lastError().text();
+        return false;
+    }
+    // 创建员工信息表 - 用于存储员工基本信息和面部识别数据
+    // 这个表是考勤系统的核心数据表，包含员工的个人信息和用于人脸识别的数据
+    QString createsql = "create table if not exists employee("
+                        "employeeID integer primary key autoincrement,"  // 员工ID - 主键，自动递增，唯一标识每个员工
+                        "name varchar(256),"                           // 员工姓名 - 最多256字符，存储中文姓名
+                        "sex varchar(32),"                             // 性别 - 32字符，可以存储"男"、"女"或其他描述
+                        "birthday text,"                               // 生日 - text类型，存储日期格式(YYYY-MM-DD)
+                        "address text,"                                // 地址 - 可以是任意长度的文本地址
+                        "phone text,"                                  // 电话号码 - 存储手机号码或固定电话
+                        "faceID integer unique,"                       // 人脸ID - 唯一标识，用于人脸识别系统，关联到SeetaFace的特征向量
+                        "headfile text"                                // 头像文件路径 - 存储员工头像图片在服务器上的路径
+                        ")";
+    
+    // 执行SQL创建表的语句
+    // 创建SQL查询对象 - 用于执行SQL语句和操作SQLite数据库
+    // QSqlQuery是Qt SQL模块的核心类，提供数据库查询、插入、更新、删除等功能
+    QSqlQuery query;
+    if(!query.exec(createsql)){
+        // 如果创建失败，输出SQL错误信息并退出程序
+        qDebug()<<query.lastError().text();
+        return false;
+    }
+    // 准备按月分区的考勤表和合并视图，旧版本的单表在这里迁移，考勤记录由AttendanceWriter在写入线程中插入
+    if(!AttendanceStore::prepare(db)){
+        return false;
+    }
+    // 超过保留月数的分区移出热数据文件
+    AttendanceStore::archive(db, ServerConfig::archive_months(), ServerConfig::archive_dir());
+    // WAL日志：写入线程提交考勤记录时，主线程和查询窗口仍然可以读取
+    // journal_mode是数据库文件的持久属性，设置一次后所有连接生效
+    query.exec("PRAGMA journal_mode=WAL");
+
+    // 加载员工目录，识别成功后按人脸ID直接查找员工
+    if(!EmployeeDirectory::instance().load()){
+        return false;
+    }
+
+    // 考勤写入吞吐量评估：逐条自动提交与组提交各写入1万条
+    if(ServerConfig::benchmark_writer()){
+        AttendanceWriter::benchmark(QDir::tempPath(), 10000);
+    }
+
+    // 特征库加载耗时评估：fr_2_10模型的特征维度为1024
+    if(ServerConfig::benchmark_startup()){
+        FaceGallery::benchmark_startup(QDir::tempPath(), 1024);
+    }
+
+    // 应答编解码耗时评估：JSON与二进制应答各编解码10万次
+    if(ServerConfig::benchmark_reply()){
+        AttendanceReply::benchmark(100000);
+    }
+
+    // 首次使用新特征库格式时，从员工头像重建特征库；只有日志没有快照时重放日志即可，不需要重建
+    if(!QFile::exists(LiveGallery::gallery_file()) && !QFile::exists(LiveGallery::journal_file())){
+        rebuild_gallery();
+    }
+    // 映射特征库快照并重放日志，所有工作对象共享这一份特征库；快照校验失败时同样从员工头像重建
+    const int featuresize = FaceEngineRegistry::instance().feature_size();
+    if(!LiveGallery::instance().load(featuresize)){
+        rebuild_gallery();
+        LiveGallery::instance().load(featuresize);
+    }
+    // 近似搜索索引在后台加载或建立，就绪之前精确搜索，启动不等待建图
+    LiveGallery::instance().build_index();
+    // 事件循环结束时停止建图和日志压缩，后台线程不能活到静态对象析构之后
+    QObject::connect(qApp, &QCoreApplication::aboutToQuit, [](){
+        LiveGallery::instance().shutdown();
+    });
+
+    // 识别吞吐量扩展性评估：工作线程数从1增加到配置的数量，使用员工头像
+    if(ServerConfig::benchmark_scaling()){
+        std::vector<cv::Mat> frames = load_benchmark_frames();
+        if(frames.empty()){
+            qDebug()<<"没有可用的员工头像，跳过识别扩展性评估";
+        }else{
+            FaceWorkerPool::benchmark_scaling(frames, ServerConfig::worker_count());
+        }
+    }
+    return true;
+}
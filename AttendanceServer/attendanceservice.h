@@ -0,0 +1,149 @@
+#ifndef ATTENDANCESERVICE_H
+#define ATTENDANCESERVICE_H
+
+#include "faceworkerpool.h"
+#include "clientsession.h"
+#include "framepacket.h"
+#include "attendancereply.h"
+#include "attendancewriter.h"
+#include "checkindebouncer.h"
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <opencv.hpp>
+#include <QHash>
+
+/**
+ * @brief 考勤服务
+ * @details 服务器端的核心，不依赖图形界面：
+ *          - 管理TCP服务器，为每个终端连接创建ClientSession
+ *          - 解码终端上传的图像并交给人脸识别工作池
+ *          - 根据识别结果查询员工信息，把应答发回终端，考勤记录去重后交给写入线程批量提交
+ *          图形界面版本（AttendanceWin）和无界面的attendance-serverd都使用本类，
+ *          界面需要显示图像时连接frame_decoded和thumbnail_received信号，无界面版本不连接，也就没有显示开销
+ */
+class AttendanceService : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief 构造函数
+     * @param parent 父对象指针
+     * 功能：
+     * - 配置TCP服务器，监听8888端口
+     * - 按server.ini配置创建人脸识别工作池
+     */
+    explicit AttendanceService(QObject *parent = nullptr);
+
+    /**
+     * @brief 服务器启动前的准备工作
+     * @return 数据库无法打开或建表失败时返回false
+     * 功能：
+     * - 注册信号槽中传递的自定义类型
+     * - 连接SQLite数据库，创建员工表和考勤表，数据库使用WAL日志
+     * - 加载员工目录
+     * - 按配置运行特征库加载、应答编解码和考勤写入评估
+     * - 必要时从员工头像重建人脸特征库，映射快照并重放日志，供所有工作对象共享
+     * - 按配置运行识别吞吐量的扩展性评估
+     * @note 在创建AttendanceService之前调用一次，图形界面和无界面版本使用同一个数据库和特征库
+     */
+    static bool initialize();
+
+signals:
+    /**
+     * @brief 人脸查询信号
+     * @param sessionid 发送该帧的客户端会话ID
+     * @param requestid 会话内的请求ID
+     * @param image 待识别的人脸图像
+     * @param face 终端检测到的人脸框，没有时为空
+     */
+    void query(quint64 sessionid, quint64 requestid, cv::Mat& image, cv::Rect face);
+
+    /**
+     * @brief 终端特征查询信号
+     * @param sessionid 发送该特征的客户端会话ID
+     * @param requestid 会话内的请求ID
+     * @param feature 终端在本地提取的特征
+     */
+    void query_feature(quint64 sessionid, quint64 requestid, std::vector<float> feature);
+
+    /**
+     * @brief 收到并解码了一帧图像
+     * @param image 解码后的BGR图像，与识别线程共享，只读
+     */
+    void frame_decoded(const cv::Mat &image);
+
+    /**
+     * @brief 收到随终端特征上传的缩略图
+     * @param jpeg JPEG数据，只在槽函数执行期间有效
+     */
+    void thumbnail_received(const QByteArray &jpeg);
+
+protected slots:
+    /**
+     * @brief 接受客户端连接槽函数
+     * 功能：
+     * - 为每个连接创建独立的ClientSession会话对象
+     * 触发时机：
+     * - 当有新客户端连接到服务器时自动调用
+     */
+    void accept_client();
+
+    /**
+     * @brief 接收图像帧槽函数
+     * @param sessionid 发送该帧的会话ID
+     * @param requestid 会话内的请求ID
+     * @param data JPEG图像数据，新终端在前面附带人脸框包头（见FramePacket），指向会话的接收缓冲区
+     * 功能：
+     * - 解码图像一次，解码结果交给人脸识别，并通过frame_decoded通知界面
+     * 触发时机：
+     * - 当某个会话收到一帧完整数据时自动调用
+     */
+    void recv_frame(quint64 sessionid, quint64 requestid, const QByteArray &data);
+
+    /**
+     * @brief 关闭会话槽函数
+     * @param sessionid 断开连接的会话ID
+     * 触发时机：
+     * - 当客户端断开连接时自动调用
+     */
+    void close_session(quint64 sessionid);
+
+    /**
+     * @brief 接收识别结果槽函数
+     * @param sessionid 发送该帧的会话ID
+     * @param requestid 会话内的请求ID
+     * @param result 识别结果，包括判定的人脸ID、前k个候选和各阶段耗时
+     * 功能：
+     * - 根据人脸ID在员工目录中查找员工信息
+     * - 记录考勤数据
+     * - 把考勤结果连同候选列表和耗时发送回发起请求的客户端
+     * 触发时机：
+     * - 当人脸识别完成并返回识别结果时调用
+     */
+    void recv_result(quint64 sessionid, quint64 requestid, FaceResult result);
+
+private:
+    /**
+     * @brief 向指定会话发送应答
+     * @param sessionid 会话ID
+     * @param requestid 请求ID
+     * @param reply 员工信息和考勤时间
+     * @param result 识别结果
+     * @details 会话已断开时丢弃应答
+     */
+    void send_reply(quint64 sessionid, quint64 requestid, const AttendanceReply &reply, const FaceResult &result);
+
+    QTcpServer mserver; ///< TCP服务器对象，用于监听和接受客户端连接
+    QHash<quint64, ClientSession*> sessions; ///< 当前在线的客户端会话，按会话ID索引
+    quint64 nextsessionid; ///< 下一个分配的会话ID
+    quint64 decodecount; ///< 当前统计窗口内解码的帧数
+    qint64 decodebytes; ///< 当前统计窗口内解码的JPEG字节数
+    qint64 decodepixels; ///< 当前统计窗口内解码得到的像素数
+    qint64 decodetime; ///< 当前统计窗口内的解码耗时，单位微秒
+    FaceWorkerPool fpool; ///< 人脸识别工作池，多个QFaceObject在各自线程中并行识别
+    AttendanceWriter writer; ///< 考勤记录写入线程，组提交考勤记录
+    CheckinDebouncer debouncer; ///< 考勤去重，窗口内的重复识别不写数据库
+};
+
+#endif // ATTENDANCESERVICE_H
@@ -0,0 +1,191 @@
+#include "attendancestore.h"
+
+#include <QDir>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QDebug>
+
+/**
+ * @brief 分区表名前缀和匹配分区表名的GLOB模式
+ */
+static const char *PARTITION_PREFIX = "attendance_";
+static const char *PARTITION_GLOB = "attendance_[0-9][0-9][0-9][0-9][0-9][0-9]";
+
+/**
+ * @brief 执行一条SQL语句，失败时输出错误
+ */
+static bool exec_sql(QSqlQuery &query, const QString &sql)
+{
+    if(!query.exec(sql)){
+        qDebug()<<"考勤表操作失败："<<sql<<query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 分区表的建表语句
+ * @param schema 所在的数据库，"main"或ATTACH时的别名
+ */
+static QString create_partition_sql(const QString &schema, const QString &name)
+{
+    return QString("create table if not exists %1.%2(attendanceID integer primary key autoincrement, employeeID integer,"
+                   "attendanceTime TimeStamp NOT NULL DEFAULT(datetime('now','localtime')))").arg(schema, name);
+}
+
+QString AttendanceStore::partition_name(const QDate &day)
+{
+    if(!day.isValid()) return QString(PARTITION_PREFIX) + "000000";
+    return QString(PARTITION_PREFIX) + day.toString("yyyyMM");
+}
+
+QStringList AttendanceStore::partitions(QSqlDatabase &db)
+{
+    QStringList names;
+    QSqlQuery query(db);
+    query.prepare("select name from sqlite_master where type = 'table' and name glob ? order by name");
+    query.addBindValue(QString(PARTITION_GLOB));
+    if(!query.exec()){
+        qDebug()<<"无法列出考勤分区表："<<query.lastError().text();
+        return names;
+    }
+    while(query.next()){
+        names << query.value(0).toString();
+    }
+    return names;
+}
+
+bool AttendanceStore::rebuild_view(QSqlDatabase &db)
+{
+    QStringList selects;
+    for(const QString &name : partitions(db)){
+        selects << QString("select attendanceID, employeeID, attendanceTime from %1").arg(name);
+    }
+    QSqlQuery query(db);
+    if(!exec_sql(query, "drop view if exists attendance")) return false;
+    if(selects.isEmpty()) return true;
+    return exec_sql(query, "create view attendance as " + selects.join(" union all "));
+}
+
+bool AttendanceStore::ensure_partition(QSqlDatabase &db, const QString &name)
+{
+    QSqlQuery query(db);
+    query.prepare("select count(*) from sqlite_master where type = 'table' and name = ?");
+    query.addBindValue(name);
+    if(!query.exec() || !query.next()){
+        qDebug()<<"无法检查考勤分区表："<<query.lastError().text();
+        return false;
+    }
+    if(query.value(0).toInt() > 0) return true;
+
+    if(!exec_sql(query, create_partition_sql("main", name))) return false;
+    // 按员工查询某段时间的考勤：索引包含查询所需的全部列，不需要回表
+    if(!exec_sql(query, QString("create index if not exists %1_employee_time on %1(employeeID, attendanceTime)").arg(name))) return false;
+    // 按时间段统计
+    if(!exec_sql(query, QString("create index if not exists %1_time on %1(attendanceTime)").arg(name))) return false;
+
+    // 新分区的ID从已有分区的最大值之后开始，视图中的attendanceID保持唯一
+    query.prepare("insert into sqlite_sequence(name, seq) select ?, coalesce(max(seq), 0) from sqlite_sequence where name glob ?");
+    query.addBindValue(name);
+    query.addBindValue(QString(PARTITION_GLOB));
+    if(!query.exec()){
+        qDebug()<<"无法设置考勤分区表的ID起点："<<query.lastError().text();
+        return false;
+    }
+    qDebug()<<"新建考勤分区表"<<name;
+    return rebuild_view(db);
+}
+
+bool AttendanceStore::migrate(QSqlDatabase &db)
+{
+    QSqlQuery query(db);
+    if(!exec_sql(query, "select type from sqlite_master where name = 'attendance'")) return false;
+    if(!query.next() || query.value(0).toString() != "table") return true;
+
+    qDebug()<<"把考勤表按月迁移到分区表";
+    // 迁移以删除旧表结束，必须在一个事务中完成，否则中途失败会丢失记录
+    if(!db.transaction()){
+        qDebug()<<"无法开始考勤表迁移事务："<<db.lastError().text();
+        return false;
+    }
+    // 时间格式为yyyy-MM-dd hh:mm:ss，前7个字符就是月份
+    QStringList months;
+    if(!exec_sql(query, "select distinct substr(attendanceTime, 1, 7) from attendance")){
+        db.rollback();
+        return false;
+    }
+    while(query.next()){
+        months << query.value(0).toString();
+    }
+    for(const QString &month : months){
+        const QString name = partition_name(QDate::fromString(month + "-01", "yyyy-MM-dd"));
+        if(!exec_sql(query, create_partition_sql("main", name))){
+            db.rollback();
+            return false;
+        }
+        query.prepare(QString("insert into %1(attendanceID, employeeID, attendanceTime) "
+                              "select attendanceID, employeeID, attendanceTime from attendance "
+                              "where substr(attendanceTime, 1, 7) = ?").arg(name));
+        query.addBindValue(month);
+        if(!query.exec()){
+            qDebug()<<"考勤表迁移失败："<<month<<query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    if(!exec_sql(query, "drop table attendance") || !db.commit()){
+        db.rollback();
+        return false;
+    }
+    qDebug()<<"考勤表迁移完成："<<months.size()<<"个月";
+    return true;
+}
+
+bool AttendanceStore::prepare(QSqlDatabase &db)
+{
+    if(!migrate(db)) return false;
+    // 迁移得到的分区表在这里补上索引；当月分区不存在时新建
+    QSqlQuery query(db);
+    for(const QString &name : partitions(db)){
+        exec_sql(query, QString("create index if not exists %1_employee_time on %1(employeeID, attendanceTime)").arg(name));
+        exec_sql(query, QString("create index if not exists %1_time on %1(attendanceTime)").arg(name));
+    }
+    if(!ensure_partition(db, partition_name(QDate::currentDate()))) return false;
+    return rebuild_view(db);
+}
+
+bool AttendanceStore::archive(QSqlDatabase &db, int keepmonths, const QString &dir)
+{
+    if(keepmonths < 1) return true;
+    // 当月算作保留的第一个月，早于cutoff的分区归档
+    const QString cutoff = partition_name(QDate::currentDate().addMonths(-(keepmonths - 1)));
+    QStringList cold;
+    for(const QString &name : partitions(db)){
+        if(name < cutoff) cold << name;
+    }
+    if(cold.isEmpty()) return true;
+    if(!QDir().mkpath(dir)){
+        qDebug()<<"无法创建考勤归档目录："<<dir;
+        return false;
+    }
+
+    QSqlQuery query(db);
+    for(const QString &name : cold){
+        const QString path = QDir(dir).filePath(name + ".db");
+        query.prepare("attach database ? as archive");
+        query.addBindValue(path);
+        if(!query.exec()){
+            qDebug()<<"无法打开考勤归档文件："<<path<<query.lastError().text();
+            return false;
+        }
+        // 第一步：复制到归档文件并提交，attendanceID相同的记录已经归档过，不重复插入
+        bool copied = exec_sql(query, create_partition_sql("archive", name))
+                      && exec_sql(query, QString("insert or ignore into archive.%1 select * from main.%1").arg(name));
+        exec_sql(query, "detach database archive");
+        if(!copied) return false;
+        // 第二步：从热数据文件中删除
+        if(!exec_sql(query, QString("drop table main.%1").arg(name))) return false;
+        qDebug()<<"考勤分区"<<name<<"已归档到"<<path;
+    }
+    return rebuild_view(db);
+}
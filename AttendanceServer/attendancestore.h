@@ -0,0 +1,78 @@
+#ifndef ATTENDANCESTORE_H
+#define ATTENDANCESTORE_H
+
+#include <QDate>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief 考勤记录的存储结构
+ * @details 考勤记录按月分表保存，多年的历史数据不会让报表查询变成全表扫描：
+ *          - 每月一张分区表attendance_yyyyMM，列与原考勤表相同
+ *          - 每张分区表有(employeeID, attendanceTime)和(attendanceTime)两个索引，
+ *            按员工查询某段时间和按时间段统计都走索引，前者同时覆盖了查询所需的全部列
+ *          - 视图attendance按UNION ALL合并所有分区表，查询窗口和报表仍然按原表名读取
+ *          - 新分区的attendanceID从已有分区的最大值继续递增，视图中的ID不重复
+ *          - 旧版本的单表attendance在首次启动时按月迁移到分区表
+ *          - 超过保留月数的分区移动到归档目录下的独立数据库文件attendance_yyyyMM.db，
+ *            热数据文件只保存最近几个月；视图attendance不包括归档的分区，
+ *            程序中不再读取归档数据，需要时用SQLite工具直接打开对应的文件
+ *          无法解析时间的记录放在分区attendance_000000中
+ */
+class AttendanceStore
+{
+public:
+    /**
+     * @brief 准备考勤表
+     * @param db 数据库连接
+     * @return 迁移或建表失败时返回false
+     * @details 迁移旧版本的单表，创建当月分区并重建视图
+     */
+    static bool prepare(QSqlDatabase &db);
+
+    /**
+     * @brief 日期所属的分区表名
+     * @return attendance_yyyyMM，日期无效时为attendance_000000
+     */
+    static QString partition_name(const QDate &day);
+
+    /**
+     * @brief 确保分区表存在
+     * @param db 数据库连接
+     * @param name 分区表名，由partition_name()得到
+     * @details 新建分区时一起创建索引、设置ID起点并重建视图；可以在事务中调用
+     */
+    static bool ensure_partition(QSqlDatabase &db, const QString &name);
+
+    /**
+     * @brief 把超过保留月数的分区移动到归档文件
+     * @param db 数据库连接，不能处于事务中
+     * @param keepmonths 保留的月数，包括当月；小于1时不归档
+     * @param dir 归档目录
+     * @details 先把分区复制到归档文件并提交，再从热数据文件中删除；
+     *          中途退出时下次启动会重新复制，归档表按attendanceID去重，不会重复也不会丢失
+     */
+    static bool archive(QSqlDatabase &db, int keepmonths, const QString &dir);
+
+private:
+    AttendanceStore() = delete;
+
+    /**
+     * @brief 当前数据库中所有分区表的名称，按月份排序
+     */
+    static QStringList partitions(QSqlDatabase &db);
+
+    /**
+     * @brief 按当前的分区表重建视图attendance
+     */
+    static bool rebuild_view(QSqlDatabase &db);
+
+    /**
+     * @brief 把旧版本的单表attendance按月迁移到分区表
+     * @details attendance已经是视图或不存在时不做任何事
+     */
+    static bool migrate(QSqlDatabase &db);
+};
+
+#endif // ATTENDANCESTORE_H
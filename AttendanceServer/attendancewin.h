@@ -1,13 +1,13 @@
 #ifndef ATTENDANCEWIN_H
 #define ATTENDANCEWIN_H
 
-#include "qfaceobject.h"
+#include "attendanceservice.h"
+#include "previewrenderer.h"
 #include <QMainWindow>
-#include <QTcpServer>
-#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
 #include <opencv.hpp>
-#include <QSqlTableModel>
-#include <QSqlRecord>
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -19,10 +19,10 @@ QT_END_NAMESPACE
  * @brief 考勤主窗口类
  * 功能：
  * - 作为考勤系统的服务器端主界面
- * - 管理TCP服务器，处理客户端连接
- * - 接收并处理客户端发送的人脸图像数据
- * - 执行人脸识别并记录考勤信息
- * - 展示考勤数据和系统状态
+ * - 运行考勤服务（AttendanceService），由它处理客户端连接、人脸识别和考勤记录
+ * - 展示考勤图像、员工注册和考勤查询
+ * - 考勤图像预览是可选的限速环节：最多按ui/preview_fps的帧率显示最新的一帧，
+ *   缩放在PreviewRenderer的线程中完成，其余帧直接跳过
  */
 class AttendanceWin : public QMainWindow
 {
@@ -34,72 +34,65 @@ public:
      * @param parent 父窗口指针
      * 功能：
      * - 初始化考勤窗口UI
-     * - 配置TCP服务器
-     * - 设置人脸识别对象和数据库连接
-     * - 建立信号槽连接
+     * - 开启预览时启动渲染线程，把考勤服务解码出的图像显示在界面上
      */
     AttendanceWin(QWidget *parent = nullptr);
     
     /**
      * @brief 析构函数
      * 功能：
-     * - 释放UI资源
-     * - 清理网络连接
-     * - 释放动态分配的内存
+     * - 停止渲染线程，释放UI资源
      */
     ~AttendanceWin();
 
 signals:
     /**
-     * @brief 人脸查询信号
-     * @param image 待识别的人脸图像
-     * 功能：
-     * - 向人脸识别对象发送人脸查询请求
-     * - 触发人脸ID提取过程
+     * @brief 请求渲染一帧预览，排队到渲染线程执行
      */
-    void query(cv::Mat& image);
+    void preview_requested(cv::Mat image, QByteArray jpeg, QSize size);
 
 protected slots:
     /**
-     * @brief 接受客户端连接槽函数
-     * 功能：
-     * - 处理新的客户端连接请求
-     * - 建立与客户端的TCP通信
-     * - 设置数据接收连接
-     * 触发时机：
-     * - 当有新客户端连接到服务器时自动调用
+     * @brief 收到解码后的图像
+     * @param image BGR图像，与识别线程共享，只读
+     * @details 只记录为待显示的最新一帧，按帧率限制安排渲染
      */
-    void accept_client();
-    
+    void show_preview(const cv::Mat &image);
+
     /**
-     * @brief 读取数据槽函数
-     * 功能：
-     * - 接收客户端发送的图像数据
-     * - 处理数据完整性
-     * - 解析图像数据并准备人脸识别
-     * 触发时机：
-     * - 当收到客户端数据时自动调用
+     * @brief 收到随终端特征上传的缩略图
+     * @param jpeg JPEG数据，只在本函数执行期间有效，需要复制后保留
      */
-    void read_data();
-    
+    void show_thumbnail(const QByteArray &jpeg);
+
     /**
-     * @brief 接收人脸ID槽函数
-     * @param faceid 识别到的人脸ID
-     * 功能：
-     * - 根据人脸ID查询员工信息
-     * - 记录考勤数据
-     * - 更新UI显示考勤结果
-     * 触发时机：
-     * - 当人脸识别完成并返回人脸ID时调用
+     * @brief 把待显示的最新一帧交给渲染线程
+     * @note 触发时机：预览定时器到期
+     */
+    void render_preview();
+
+    /**
+     * @brief 显示渲染线程返回的图像
+     * @param image 已缩放为标签大小的图像
      */
-    void recv_faceid(int64_t faceid);
+    void show_rendered(QImage image);
 
 private:
+    /**
+     * @brief 安排下一次渲染
+     * @details 上一帧仍在渲染或定时器已在等待时不重复安排；预览标签不可见时丢弃待显示的帧
+     */
+    void schedule_preview();
+
     Ui::AttendanceWin *ui; ///< UI对象指针，用于访问界面元素
-    QTcpServer mserver; ///< TCP服务器对象，用于监听和接受客户端连接
-    QTcpSocket *msocket; ///< TCP套接字指针，用于与客户端通信
-    quint64 bsize; ///< 缓冲区大小，用于跟踪接收数据的字节数
-    QFaceObject fobj; ///< 人脸识别核心对象，在独立线程中执行人脸识别
-    QSqlTableModel model; ///< 数据库表模型，用于访问和操作员工数据表
+    AttendanceService service; ///< 考勤服务，网络、识别和数据库处理都在其中完成
+    QThread previewthread; ///< 预览渲染线程
+    PreviewRenderer *renderer; ///< 预览渲染器，运行在previewthread中，不显示预览时为空
+    QTimer previewtimer; ///< 单次定时器，控制两次渲染的最小间隔
+    QElapsedTimer lastpreview; ///< 上一次开始渲染的时间
+    int previewinterval; ///< 两次渲染的最小间隔，单位毫秒
+    bool previewbusy; ///< 渲染线程是否正在处理一帧
+    cv::Mat pendingimage; ///< 待显示的最新解码图像
+    QByteArray pendingjpeg; ///< 待显示的最新缩略图
 };
 #endif // ATTENDANCEWIN_H
@@ -0,0 +1,301 @@
+#include "attendancewriter.h"
+#include "attendancestore.h"
+
+#include <QAtomicInteger>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutexLocker>
+#include <QTimer>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QDebug>
+#include <iterator>
+
+/**
+ * @brief 考勤时间的存储格式，与attendanceTime列默认值datetime('now','localtime')一致
+ */
+static const char *TIME_FORMAT = "yyyy-MM-dd hh:mm:ss";
+
+/**
+ * @brief 写入统计窗口
+ * @details 每提交这么多条记录输出一次平均每个事务的记录数
+ */
+static const quint64 WRITE_STAT_WINDOW = 1000;
+
+/**
+ * @brief 一批记录连续写入失败的最多重试次数
+ */
+static const int WRITE_MAX_RETRIES = 5;
+
+/**
+ * @brief 第一次重试前的等待时间，单位毫秒，之后每次加倍
+ * @details 5次重试共等待约6秒，足以等过数据库被其他连接短暂锁住
+ */
+static const int WRITE_RETRY_DELAY = 200;
+
+/**
+ * @brief 写入线程连接名的序号，保证同一进程中的多个写入对象使用不同的连接
+ */
+static QAtomicInteger<int> connectionserial(0);
+
+AttendanceWriter::AttendanceWriter(const QString &path, QObject *parent)
+    : QObject{parent}
+    , context(new QObject())
+    , connection(QString("attendance_writer_%1").arg(connectionserial.fetchAndAddRelaxed(1)))
+    , writtencount(0)
+    , batchcount(0)
+    , failures(0)
+    , retryscheduled(false)
+    , droppedcount(0)
+{
+    // 数据库连接只能在创建它的线程中使用，连接在写入线程中打开
+    context->moveToThread(&thread);
+    connect(&thread,&QThread::finished,context,&QObject::deleteLater);
+    thread.start();
+    QMetaObject::invokeMethod(context,[this,path](){
+        open_database(path);
+    });
+}
+
+AttendanceWriter::~AttendanceWriter()
+{
+    // 在写入线程中提交剩余事件并关闭连接，再停止线程；这次仍然失败的事件无法再重试
+    QMetaObject::invokeMethod(context,[this](){
+        flush();
+        QMutexLocker locker(&mutex);
+        if(!queue.empty()){
+            droppedcount += queue.size();
+            qDebug()<<"考勤写入线程退出，丢弃"<<queue.size()<<"条未能写入的记录，累计丢弃"<<droppedcount<<"条";
+            queue.clear();
+        }
+        {
+            QSqlDatabase db = QSqlDatabase::database(connection, false);
+            db.close();
+        }
+        QSqlDatabase::removeDatabase(connection);
+    }, Qt::BlockingQueuedConnection);
+    thread.quit();
+    thread.wait();
+}
+
+void AttendanceWriter::record(qint64 employeeid, const QDateTime &time)
+{
+    bool wasempty;
+    {
+        QMutexLocker locker(&mutex);
+        wasempty = queue.empty();
+        queue.push_back(AttendanceEvent{employeeid, time});
+    }
+    // 队列不为空时写入任务已经投递过，上一批提交期间到达的事件会合并到下一批
+    // 等待重试期间由重试任务一起写入，不提前打断退避
+    if(wasempty){
+        QMetaObject::invokeMethod(context,[this](){
+            if(!retryscheduled) flush();
+        });
+    }
+}
+
+void AttendanceWriter::sync()
+{
+    QMetaObject::invokeMethod(context,[this](){
+        flush();
+    }, Qt::BlockingQueuedConnection);
+}
+
+/**
+ * @brief 打开写入线程的数据库连接
+ * @details WAL日志下写事务不阻塞其他连接的读取；synchronous=NORMAL时提交不再逐个同步磁盘，
+ *          只在检查点同步，进程崩溃不会丢失已提交的记录，断电时可能丢失最后几批
+ */
+void AttendanceWriter::open_database(const QString &path)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection);
+    db.setDatabaseName(path);
+    if(!db.open()){
+        qDebug()<<"考勤写入线程无法打开数据库："<<db.lastError().text();
+        return;
+    }
+    QSqlQuery query(db);
+    query.exec("PRAGMA journal_mode=WAL");
+    query.exec("PRAGMA synchronous=NORMAL");
+}
+
+void AttendanceWriter::flush()
+{
+    {
+        QMutexLocker locker(&mutex);
+        batch.swap(queue);
+    }
+    if(batch.empty()) return;
+
+    QSqlDatabase db = QSqlDatabase::database(connection, false);
+    if(!db.isOpen() && !db.open()){
+        qDebug()<<"考勤写入线程没有可用的数据库连接："<<db.lastError().text();
+        retry_batch();
+        return;
+    }
+    if(!write_batch(db)){
+        retry_batch();
+        return;
+    }
+    failures = 0;
+
+    writtencount += batch.size();
+    batchcount++;
+    if(writtencount >= WRITE_STAT_WINDOW){
+        qDebug()<<"考勤写入："<<writtencount<<"条记录"<<batchcount<<"个事务，平均每个事务"
+                <<(double)writtencount / batchcount<<"条";
+        writtencount = 0;
+        batchcount = 0;
+    }
+    batch.clear();
+}
+
+/**
+ * @brief 在一个事务中写入batch
+ * @details 一批事件在一个事务中插入，提交时只同步一次
+ *          记录写入考勤时间所属月份的分区表，一批通常都在同一个月，跨月时才重新准备语句
+ *          任何一步失败都回滚整批，事务中新建的分区表也随之回滚，所以同时清空已确认的分区
+ */
+bool AttendanceWriter::write_batch(QSqlDatabase &db)
+{
+    if(!db.transaction()){
+        qDebug()<<"考勤写入无法开始事务："<<db.lastError().text();
+        return false;
+    }
+    QSqlQuery query(db);
+    QString current;
+    bool ok = true;
+    for(const AttendanceEvent &event : batch){
+        const QString name = AttendanceStore::partition_name(event.time.date());
+        if(name != current){
+            if(!partitions.contains(name)){
+                if(!AttendanceStore::ensure_partition(db, name)){
+                    qDebug()<<"考勤分区表创建失败："<<name;
+                    ok = false;
+                    break;
+                }
+                partitions.insert(name);
+            }
+            query.prepare(QString("insert into %1(employeeID, attendanceTime) values(?, ?)").arg(name));
+            current = name;
+        }
+        query.addBindValue(event.employeeid);
+        query.addBindValue(event.time.toString(TIME_FORMAT));
+        if(!query.exec()){
+            qDebug()<<"考勤记录写入失败："<<event.employeeid<<query.lastError().text();
+            ok = false;
+            break;
+        }
+    }
+    if(ok && db.commit()) return true;
+    if(ok) qDebug()<<"考勤记录提交失败："<<db.lastError().text();
+    query.finish();
+    db.rollback();
+    partitions.clear();
+    return false;
+}
+
+/**
+ * @brief 处理一次写入失败
+ * @details 失败的一批放回队列头部，保持考勤的先后顺序，之后到达的事件排在它后面一起重试
+ *          第n次重试前等待WRITE_RETRY_DELAY*2^(n-1)毫秒；超过WRITE_MAX_RETRIES次仍然失败时丢弃
+ */
+void AttendanceWriter::retry_batch()
+{
+    failures++;
+    if(failures > WRITE_MAX_RETRIES){
+        droppedcount += batch.size();
+        qDebug()<<"考勤写入重试"<<WRITE_MAX_RETRIES<<"次仍然失败，丢弃"<<batch.size()<<"条记录，累计丢弃"<<droppedcount<<"条";
+        batch.clear();
+        failures = 0;
+        return;
+    }
+    std::size_t waiting;
+    {
+        QMutexLocker locker(&mutex);
+        batch.insert(batch.end(), std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.end()));
+        queue.swap(batch);
+        waiting = queue.size();
+    }
+    batch.clear();
+    const int delay = WRITE_RETRY_DELAY << (failures - 1);
+    qDebug()<<"考勤写入失败，"<<delay<<"毫秒后第"<<failures<<"次重试，待写入"<<waiting<<"条记录";
+    retryscheduled = true;
+    QTimer::singleShot(delay, context, [this](){
+        retryscheduled = false;
+        flush();
+    });
+}
+
+/**
+ * @brief 删除临时数据库及其WAL文件
+ */
+static void remove_database_files(const QString &path)
+{
+    QFile::remove(path);
+    QFile::remove(path + "-wal");
+    QFile::remove(path + "-shm");
+    QFile::remove(path + "-journal");
+}
+
+void AttendanceWriter::benchmark(const QString &dir, int count)
+{
+    if(count <= 0) return;
+    const QString autocommitpath = QDir(dir).filePath("attendance_bench_autocommit.db");
+    const QString grouppath = QDir(dir).filePath("attendance_bench_group.db");
+    remove_database_files(autocommitpath);
+    remove_database_files(grouppath);
+    const QDateTime now = QDateTime::currentDateTime();
+
+    // 逐条自动提交：与改造前主线程中的写法相同，单表，每条insert一个事务
+    qint64 autocommittime = -1;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "attendance_bench");
+        db.setDatabaseName(autocommitpath);
+        QSqlQuery create(db);
+        if(db.open() && create.exec("create table attendance(attendanceID integer primary key autoincrement, employeeID integer,"
+                                    "attendanceTime TimeStamp NOT NULL DEFAULT(datetime('now','localtime')))")){
+            QSqlQuery query(db);
+            query.prepare("insert into attendance(employeeID, attendanceTime) values(?, ?)");
+            QElapsedTimer timer;
+            timer.start();
+            for(int i = 0; i < count; i++){
+                query.addBindValue(i % 1000);
+                query.addBindValue(now.toString(TIME_FORMAT));
+                query.exec();
+            }
+            autocommittime = timer.elapsed();
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase("attendance_bench");
+
+    // 写入线程组提交，写入带索引的月分区表
+    qint64 grouptime = -1;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "attendance_bench");
+        db.setDatabaseName(grouppath);
+        bool ready = db.open() && AttendanceStore::prepare(db);
+        db.close();
+        if(ready){
+            AttendanceWriter writer(grouppath);
+            writer.sync();
+            QElapsedTimer timer;
+            timer.start();
+            for(int i = 0; i < count; i++){
+                writer.record(i % 1000, now);
+            }
+            writer.sync();
+            grouptime = timer.elapsed();
+        }
+    }
+    QSqlDatabase::removeDatabase("attendance_bench");
+
+    qDebug()<<"考勤写入评估："<<count<<"条记录"
+            <<"逐条自动提交"<<autocommittime<<"毫秒"
+            <<"组提交（WAL）"<<grouptime<<"毫秒";
+    remove_database_files(autocommitpath);
+    remove_database_files(grouppath);
+}
@@ -0,0 +1,110 @@
+#ifndef ATTENDANCEWRITER_H
+#define ATTENDANCEWRITER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QDateTime>
+#include <QString>
+#include <QSet>
+#include <QSqlDatabase>
+#include <vector>
+
+/**
+ * @brief 考勤记录写入线程
+ * @details 识别成功后只把考勤事件放入队列，由独立线程写入SQLite，主线程不再等待磁盘同步
+ *          - 写入线程使用自己的数据库连接，与主线程的连接互不影响
+ *          - 组提交：每次取出队列中积累的全部事件，在一个事务中插入，一批只同步一次磁盘
+ *          - 数据库使用WAL日志，写入时主线程和查询窗口仍然可以读取
+ *          - 记录写入考勤时间所属月份的分区表（见AttendanceStore），跨月时自动新建分区
+ *          - 建分区、插入或提交失败时整批回滚并放回队列头部，按指数退避重试，
+ *            连续失败超过WRITE_MAX_RETRIES次才丢弃这一批，丢弃的记录数累计输出到日志
+ *          析构时先提交队列中剩余的事件再停止线程
+ */
+class AttendanceWriter : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief 构造函数
+     * @param path 数据库文件路径，与主线程连接的是同一个文件
+     * @param parent 父对象指针
+     */
+    explicit AttendanceWriter(const QString &path, QObject *parent = nullptr);
+
+    /**
+     * @brief 析构函数
+     * @details 提交剩余事件，关闭连接并停止写入线程
+     */
+    ~AttendanceWriter();
+
+    /**
+     * @brief 记录一次考勤
+     * @param employeeid 员工ID
+     * @param time 考勤时间，与发给终端的应答一致
+     * @details 只加入队列，可以在任意线程调用；队列原本为空时才投递一次写入任务
+     */
+    void record(qint64 employeeid, const QDateTime &time);
+
+    /**
+     * @brief 等待队列中已有的事件全部提交
+     */
+    void sync();
+
+    /**
+     * @brief 比较逐条自动提交和写入线程组提交的写入吞吐量
+     * @param dir 临时数据库所在目录
+     * @param count 写入的考勤记录数
+     * @details 逐条自动提交使用SQLite默认的回滚日志和不带索引的单表，每条记录一个事务；
+     *          组提交使用WAL日志和带索引的月分区表，与线上的写入方式相同
+     */
+    static void benchmark(const QString &dir, int count);
+
+private:
+    /**
+     * @brief 一条待写入的考勤事件
+     */
+    struct AttendanceEvent
+    {
+        qint64 employeeid;  ///< 员工ID
+        QDateTime time;     ///< 考勤时间
+    };
+
+    /**
+     * @brief 在写入线程中打开数据库连接
+     */
+    void open_database(const QString &path);
+
+    /**
+     * @brief 在写入线程中取出队列中的全部事件，在一个事务中提交
+     * @details 失败时把这一批放回队列头部并安排重试
+     */
+    void flush();
+
+    /**
+     * @brief 在一个事务中写入batch
+     * @return 建分区、插入或提交任一步失败时回滚并返回false
+     */
+    bool write_batch(QSqlDatabase &db);
+
+    /**
+     * @brief 处理一次写入失败
+     * @details 未超过重试次数时把batch放回队列头部，延迟后重试；否则丢弃并计数
+     */
+    void retry_batch();
+
+    QThread thread;         ///< 写入线程
+    QObject *context;       ///< 运行在写入线程中的上下文对象，写入任务投递给它执行
+    QString connection;     ///< 写入线程的数据库连接名
+    QMutex mutex;           ///< 保护queue
+    std::vector<AttendanceEvent> queue;     ///< 待写入的考勤事件
+    std::vector<AttendanceEvent> batch;     ///< 写入线程正在提交的一批事件，复用内存
+    QSet<QString> partitions;   ///< 写入线程已经确认存在的分区表
+    quint64 writtencount;   ///< 统计窗口内提交的记录数
+    quint64 batchcount;     ///< 统计窗口内提交的事务数
+    int failures;           ///< 当前这一批连续写入失败的次数
+    bool retryscheduled;    ///< 是否已经安排了延迟重试，期间新到的事件不触发写入
+    quint64 droppedcount;   ///< 重试仍然失败而丢弃的记录总数
+};
+
+#endif // ATTENDANCEWRITER_H
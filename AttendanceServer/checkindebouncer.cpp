@@ -0,0 +1,77 @@
+#include "checkindebouncer.h"
+#include "attendancestore.h"
+
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QDebug>
+
+/**
+ * @brief 考勤时间的存储格式，与考勤表一致
+ */
+static const char *TIME_FORMAT = "yyyy-MM-dd hh:mm:ss";
+
+/**
+ * @brief 去重统计窗口
+ * @details 每处理这么多次识别输出一次记录数和重复数
+ */
+static const quint64 DEBOUNCE_STAT_WINDOW = 1000;
+
+CheckinDebouncer::CheckinDebouncer(int window)
+    : mwindow(window)
+    , mday(QDate::currentDate())
+    , acceptedcount(0)
+    , repeatedcount(0)
+{
+}
+
+bool CheckinDebouncer::load()
+{
+    records.clear();
+    mday = QDate::currentDate();
+    if(mwindow <= 0) return true;
+    // 当天的记录都在当月分区中，按(employeeID, attendanceTime)索引分组取最大值
+    QSqlQuery query;
+    query.prepare(QString("select employeeID, max(attendanceTime) from %1 where attendanceTime >= ? group by employeeID")
+                  .arg(AttendanceStore::partition_name(mday)));
+    query.addBindValue(mday.startOfDay().toString(TIME_FORMAT));
+    if(!query.exec()){
+        qDebug()<<"无法读取当天的考勤记录："<<query.lastError().text();
+        return false;
+    }
+    while(query.next()){
+        records.insert(query.value(0).toLongLong(), QDateTime::fromString(query.value(1).toString(), TIME_FORMAT));
+    }
+    qDebug()<<"考勤去重窗口"<<mwindow<<"秒，当天已考勤员工数"<<records.size();
+    return true;
+}
+
+bool CheckinDebouncer::accept(qint64 employeeid, const QDateTime &now, QDateTime &checkin)
+{
+    checkin = now;
+    if(mwindow <= 0) return true;
+
+    // 跨天后前一天的记录不再参与去重
+    if(now.date() != mday){
+        records.clear();
+        mday = now.date();
+    }
+
+    bool accepted = true;
+    auto it = records.find(employeeid);
+    if(it != records.end() && it.value().isValid() && it.value().secsTo(now) < mwindow){
+        // 窗口内的重复识别：应答中沿用已有记录的时间，不写数据库
+        checkin = it.value();
+        accepted = false;
+        repeatedcount++;
+    }else{
+        records.insert(employeeid, now);
+        acceptedcount++;
+    }
+
+    if(acceptedcount + repeatedcount >= DEBOUNCE_STAT_WINDOW){
+        qDebug()<<"考勤去重："<<acceptedcount<<"次记录"<<repeatedcount<<"次重复识别未写入";
+        acceptedcount = 0;
+        repeatedcount = 0;
+    }
+    return accepted;
+}
@@ -0,0 +1,50 @@
+#ifndef CHECKINDEBOUNCER_H
+#define CHECKINDEBOUNCER_H
+
+#include <QDate>
+#include <QDateTime>
+#include <QHash>
+
+/**
+ * @brief 考勤去重
+ * @details 员工站在终端前时终端会连续上传多帧，每帧识别成功都会得到一次考勤
+ *          同一员工在同一天内距上一条考勤记录不足去重窗口时，只在内存中应答，不再写入数据库，
+ *          考勤表的增长与员工人数成正比，而不是与帧数成正比
+ *          - 按员工ID索引当天最后一条考勤记录的时间，日期变化时清空前一天的记录
+ *          - 启动时从考勤表读取当天每名员工最后一次考勤，重启后不会重复记录
+ *          - 去重窗口由attendance/debounce_seconds配置，0表示不去重
+ * @note 只在考勤服务所在的线程中使用，不加锁
+ */
+class CheckinDebouncer
+{
+public:
+    /**
+     * @brief 构造函数
+     * @param window 去重窗口，单位秒，0表示不去重
+     */
+    explicit CheckinDebouncer(int window = 0);
+
+    /**
+     * @brief 从考勤表读取当天每名员工最后一次考勤
+     * @return 查询失败时返回false，此时从空记录开始
+     */
+    bool load();
+
+    /**
+     * @brief 判断一次识别是否需要记录考勤
+     * @param employeeid 员工ID
+     * @param now 识别时间
+     * @param checkin 输出应答中的考勤时间：需要记录时为now，重复识别时为已有记录的时间
+     * @return 需要写入新的考勤记录时返回true
+     */
+    bool accept(qint64 employeeid, const QDateTime &now, QDateTime &checkin);
+
+private:
+    int mwindow;                            ///< 去重窗口，单位秒
+    QDate mday;                             ///< records所属的日期
+    QHash<qint64, QDateTime> records;       ///< 员工ID到当天最后一条考勤记录的时间
+    quint64 acceptedcount;                  ///< 统计窗口内记录的考勤数
+    quint64 repeatedcount;                  ///< 统计窗口内在内存中应答的重复识别数
+};
+
+#endif // CHECKINDEBOUNCER_H
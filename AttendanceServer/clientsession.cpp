@@ -0,0 +1,201 @@
+#include "clientsession.h"
+
+#include <QDataStream>
+#include <QtEndian>
+#include <QHostAddress>
+#include <QDebug>
+
+/**
+ * @brief 发送缓冲区预留的容量
+ */
+static const int SEND_BUFFER_RESERVE = 1024;
+
+/**
+ * @brief 接收缓冲区预留的容量，帧更大时自动扩充并保留
+ */
+static const int RECV_BUFFER_RESERVE = 64 * 1024;
+
+/**
+ * @brief 分帧应答的头部：quint32长度 + quint64终端请求ID
+ */
+static const int FRAME_HEAD_SIZE = sizeof(quint32) + sizeof(quint64);
+
+/**
+ * @brief ClientSession构造函数
+ * @param sessionid 会话ID
+ * @param socket 与客户端通信的套接字
+ * @param parent 父对象指针
+ * @details 接管套接字的生命周期，并关联数据到达和断开连接信号
+ */
+ClientSession::ClientSession(quint64 sessionid, QTcpSocket *socket, QObject *parent)
+    : QObject{parent}
+    , msocket(socket)
+    , msessionid(sessionid)
+    , bsize(0)
+    , nextrequestid(1)
+    , framed(false)
+    , binary(false)
+{
+    // 预留容量后resize(0)不会释放内存，一条应答通常只有几十到几百字节
+    sendbuffer.reserve(SEND_BUFFER_RESERVE);
+    recvbuffer.reserve(RECV_BUFFER_RESERVE);
+    //套接字随会话一起释放
+    msocket->setParent(this);
+    //当客户端有数据到达时会发送readyRead信号
+    connect(msocket,&QTcpSocket::readyRead,this,&ClientSession::read_data);
+    //客户端断开时通知服务器回收会话
+    connect(msocket,&QTcpSocket::disconnected,this,[this](){
+        emit session_closed(msessionid);
+    });
+}
+
+ClientSession::~ClientSession()
+{
+    if(!inflight.isEmpty()){
+        qDebug()<<"会话"<<msessionid<<"关闭时仍有"<<inflight.size()<<"个请求未应答";
+    }
+}
+
+quint64 ClientSession::id() const
+{
+    return msessionid;
+}
+
+QString ClientSession::peer() const
+{
+    return QString("%1:%2").arg(msocket->peerAddress().toString()).arg(msocket->peerPort());
+}
+
+int ClientSession::inflight_count() const
+{
+    return inflight.size();
+}
+
+bool ClientSession::finish_request(quint64 requestid)
+{
+    return inflight.remove(requestid) > 0;
+}
+
+void ClientSession::tag_request(quint64 requestid, quint64 clientid)
+{
+    auto it = inflight.find(requestid);
+    if(it == inflight.end()) return;
+    it.value() = clientid;
+    if(!framed){
+        framed = true;
+        qDebug()<<"会话"<<msessionid<<"使用分帧应答";
+    }
+}
+
+void ClientSession::use_binary_replies()
+{
+    if(binary) return;
+    binary = true;
+    qDebug()<<"会话"<<msessionid<<"使用二进制应答";
+}
+
+void ClientSession::begin_frame()
+{
+    sendbuffer.resize(0);
+    if(framed) sendbuffer.resize(FRAME_HEAD_SIZE);
+}
+
+void ClientSession::end_frame(quint64 clientid)
+{
+    if(framed){
+        char *head = sendbuffer.data();
+        qToBigEndian<quint32>((quint32)(sendbuffer.size() - sizeof(quint32)), head);
+        qToBigEndian<quint64>(clientid, head + sizeof(quint32));
+    }
+    msocket->write(sendbuffer);//把打包好的数据发送给客户端
+}
+
+/**
+ * @brief 发送应答
+ * @param requestid 请求ID
+ * @param data 应答数据
+ * @details 已断开的连接不再写入，请求记录仍然会被清除
+ *          分帧格式下一次readyRead中即使合并了多个应答，终端也能按长度逐个拆出
+ */
+void ClientSession::send_response(quint64 requestid, const QByteArray &data)
+{
+    quint64 clientid = inflight.take(requestid);
+    if(msocket->state() != QAbstractSocket::ConnectedState) return;
+    begin_frame();
+    sendbuffer.append(data);
+    end_frame(clientid);
+}
+
+/**
+ * @brief 发送考勤应答
+ * @details 二进制应答直接编码进发送缓冲区；JSON应答仍由QString拼接，作为旧终端的兼容格式
+ */
+void ClientSession::send_reply(quint64 requestid, const AttendanceReply &reply, const FaceResult &result)
+{
+    quint64 clientid = inflight.take(requestid);
+    if(msocket->state() != QAbstractSocket::ConnectedState) return;
+    begin_frame();
+    if(framed && binary){
+        reply.append_binary(sendbuffer);
+    }else{
+        sendbuffer.append(reply.to_json(result));
+    }
+    end_frame(clientid);
+}
+
+/**
+ * @brief 数据接收处理函数
+ * @details 从本会话的套接字中读取并解析客户端发送的人脸图像数据
+ *          1. 使用QDataStream读取数据包长度（协议头）和QByteArray的长度前缀
+ *          2. 确保数据完整接收，处理分块传输的情况
+ *          3. 帧数据直接从套接字读入会话复用的接收缓冲区，不经过QDataStream构造临时的QByteArray
+ *          4. 每收到一帧完整数据就分配请求ID并发出frame_received信号
+ * @note 触发时机：当客户端通过TCP套接字发送数据时，通过readyRead信号调用此函数
+ */
+void ClientSession::read_data()
+{
+    // 通过QDataStream可以直接读写复杂数据类型，自动处理大小端字节序
+    QDataStream stream(msocket);//把套接字绑定到数据流
+    stream.setVersion(QDataStream::Qt_5_15);//设置Qt版本
+
+    // 一次readyRead中可能包含多帧数据，循环拆包直到数据不足
+    while(true){
+        // 第一阶段：读取数据包长度信息（协议头）
+        if(bsize == 0){
+            if(msocket->bytesAvailable() < (qint64)sizeof(bsize)) return;
+            stream>>bsize;
+        }
+
+        // 第二阶段：QByteArray序列化时自带4字节长度前缀，数据不足时返回继续等待
+        if(msocket->bytesAvailable() < (qint64)(bsize + sizeof(quint32))) return;
+
+        quint32 length = 0;
+        stream>>length;
+        const quint64 expected = bsize;
+        bsize = 0;
+        // 数据完整性检查：空QByteArray的长度前缀为0或0xFFFFFFFF
+        if(length == 0 || length == 0xFFFFFFFF){
+            qDebug()<<"客户端接收的数据为空！"<<peer();
+            msocket->read(expected);
+            continue;
+        }
+        // 长度前缀与协议头不一致时无法继续拆包，断开连接
+        if(length != expected){
+            qDebug()<<"数据包长度不一致"<<expected<<length<<"，断开连接"<<peer();
+            msocket->abort();
+            return;
+        }
+
+        // 第三阶段：直接读入接收缓冲区
+        // 接收方在本函数返回前处理完该帧，缓冲区不再被共享，下一帧resize时不会重新分配
+        recvbuffer.resize((int)length);
+        if(msocket->read(recvbuffer.data(), length) != (qint64)length){
+            qDebug()<<"读取数据失败"<<msocket->errorString()<<peer();
+            return;
+        }
+
+        quint64 requestid = nextrequestid++;
+        inflight.insert(requestid, 0);
+        emit frame_received(msessionid, requestid, recvbuffer);
+    }
+}
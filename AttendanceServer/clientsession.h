@@ -0,0 +1,135 @@
+#ifndef CLIENTSESSION_H
+#define CLIENTSESSION_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QByteArray>
+#include <QHash>
+#include "attendancereply.h"
+
+/**
+ * @brief 客户端会话类
+ * @details 每个考勤终端（FaceAttendance）的TCP连接对应一个会话对象
+ *          - 独立保存该连接的拆包状态（bsize），多个终端的数据互不干扰
+ *          - 帧数据直接读入会话复用的接收缓冲区，接收路径上不再为每帧分配和复制
+ *          - 为收到的每一帧分配请求ID，并记录尚未应答的请求
+ *          - 识别结果通过会话ID路由回发送该帧的套接字
+ *          - 终端在帧中带上自己的请求ID后，应答改为带长度和请求ID的分帧格式，
+ *            终端可以同时发送多帧，并按请求ID匹配乱序到达的应答
+ *          - 分帧会话中终端还可以要求二进制应答，应答编码在会话复用的发送缓冲区中完成
+ */
+class ClientSession : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief 构造函数
+     * @param sessionid 服务器分配的会话ID，在进程内唯一
+     * @param socket 与客户端通信的套接字，会话接管其生命周期
+     * @param parent 父对象指针
+     */
+    explicit ClientSession(quint64 sessionid, QTcpSocket *socket, QObject *parent = nullptr);
+    ~ClientSession();
+
+    /**
+     * @brief 获取会话ID
+     */
+    quint64 id() const;
+
+    /**
+     * @brief 获取客户端地址，用于日志输出
+     */
+    QString peer() const;
+
+    /**
+     * @brief 获取尚未应答的请求数量
+     */
+    int inflight_count() const;
+
+    /**
+     * @brief 结束一个请求
+     * @param requestid 请求ID
+     * @return 请求属于本会话且尚未应答时返回true
+     */
+    bool finish_request(quint64 requestid);
+
+    /**
+     * @brief 记录终端为一个请求分配的ID
+     * @param requestid 服务器分配的请求ID
+     * @param clientid 终端分配的请求ID
+     * @details 本会话之后的应答全部使用分帧格式
+     */
+    void tag_request(quint64 requestid, quint64 clientid);
+
+    /**
+     * @brief 之后的考勤应答使用二进制编码
+     * @details 只对分帧应答的会话生效，否则仍然发送JSON
+     */
+    void use_binary_replies();
+
+    /**
+     * @brief 向客户端发送应答
+     * @param requestid 应答对应的请求ID
+     * @param data 应答数据
+     * @details 只会写入本会话自己的套接字，并结束该请求的在途记录
+     *          旧终端直接写入应答数据；使用分帧格式的会话写入
+     *          quint32长度（不含自身）+ quint64终端请求ID + 应答数据，没有终端请求ID的应答ID为0
+     */
+    void send_response(quint64 requestid, const QByteArray &data);
+
+    /**
+     * @brief 向客户端发送考勤应答
+     * @param requestid 应答对应的请求ID
+     * @param reply 员工信息和考勤时间
+     * @param result 识别结果，JSON应答中附带候选列表和各阶段耗时
+     * @details 按本会话协商的格式编码为二进制或JSON，其余与send_response相同
+     */
+    void send_reply(quint64 requestid, const AttendanceReply &reply, const FaceResult &result);
+
+signals:
+    /**
+     * @brief 收到一帧完整图像数据
+     * @param sessionid 会话ID
+     * @param requestid 为该帧分配的请求ID
+     * @param data 帧数据，可能带有FramePacket包头
+     * @note data指向会话的接收缓冲区，只在槽函数执行期间有效：
+     *       会话和接收方同在UI线程，信号直接调用槽函数；需要保留数据的接收方自行复制
+     */
+    void frame_received(quint64 sessionid, quint64 requestid, const QByteArray &data);
+
+    /**
+     * @brief 客户端断开连接
+     * @param sessionid 会话ID
+     */
+    void session_closed(quint64 sessionid);
+
+private slots:
+    /**
+     * @brief 读取数据槽函数
+     * @details 按"quint64长度 + QByteArray"的协议拆包，一次readyRead中可能包含多帧，循环读取直到数据不足
+     */
+    void read_data();
+
+private:
+    /**
+     * @brief 开始一个应答：清空发送缓冲区，分帧会话预留长度和请求ID
+     */
+    void begin_frame();
+
+    /**
+     * @brief 结束一个应答：分帧会话填写长度和请求ID，然后写入套接字
+     */
+    void end_frame(quint64 clientid);
+
+    QTcpSocket *msocket;    ///< 与客户端通信的套接字
+    quint64 msessionid;     ///< 会话ID
+    quint64 bsize;          ///< 当前正在接收的数据包大小，0表示等待包头
+    quint64 nextrequestid;  ///< 下一个请求ID
+    QHash<quint64, quint64> inflight; ///< 已提交识别但尚未应答的请求，值为终端分配的请求ID，没有时为0
+    bool framed;            ///< 应答是否使用分帧格式
+    bool binary;            ///< 考勤应答是否使用二进制编码
+    QByteArray sendbuffer;  ///< 复用的发送缓冲区，预留了容量，每次应答不再重新分配
+    QByteArray recvbuffer;  ///< 复用的接收缓冲区，保存正在处理的一帧
+};
+
+#endif // CLIENTSESSION_H
@@ -0,0 +1,106 @@
+#include "employeedirectory.h"
+
+#include <QMutexLocker>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QtEndian>
+#include <QDebug>
+
+/**
+ * @brief 员工所属部门
+ * @details employee表中没有部门列，所有员工都属于同一个部门
+ */
+static const char *DEPARTMENT = "软件";
+
+/**
+ * @brief 转义JSON字符串中的引号和反斜杠
+ */
+static QByteArray json_escape(const QString &text)
+{
+    QByteArray bytes = text.toUtf8();
+    bytes.replace('\\', "\\\\");
+    bytes.replace('"', "\\\"");
+    return bytes;
+}
+
+/**
+ * @brief 追加一个"quint16字节数 + UTF-8"字符串
+ */
+static void append_string(QByteArray &buffer, const QString &text)
+{
+    QByteArray bytes = text.toUtf8();
+    char length[sizeof(quint16)];
+    qToBigEndian<quint16>((quint16)bytes.size(), length);
+    buffer.append(length, sizeof(length));
+    buffer.append(bytes);
+}
+
+EmployeeDirectory &EmployeeDirectory::instance()
+{
+    static EmployeeDirectory directory;
+    return directory;
+}
+
+std::shared_ptr<const EmployeeEntry> EmployeeDirectory::make_entry(qint64 employeeid, const QString &name)
+{
+    std::shared_ptr<EmployeeEntry> entry = std::make_shared<EmployeeEntry>();
+    entry->employeeid = employeeid;
+    entry->name = name;
+    entry->department = QString::fromUtf8(DEPARTMENT);
+    entry->jsonfields = "\"employeeID\":\"" + QByteArray::number(employeeid) + "\",\"name\":\"" + json_escape(name)
+                        + "\",\"department\":\"" + json_escape(entry->department) + "\"";
+    append_string(entry->binaryfields, entry->name);
+    append_string(entry->binaryfields, entry->department);
+    return entry;
+}
+
+bool EmployeeDirectory::load()
+{
+    QSqlQuery query;
+    if(!query.exec("select faceID, employeeID, name from employee where faceID >= 0")){
+        qDebug()<<"无法加载员工目录："<<query.lastError().text();
+        return false;
+    }
+    QHash<int64_t, std::shared_ptr<const EmployeeEntry>> loaded;
+    while(query.next()){
+        loaded.insert(query.value(0).toLongLong(), make_entry(query.value(1).toLongLong(), query.value(2).toString()));
+    }
+    QMutexLocker locker(&mutex);
+    entries.swap(loaded);
+    qDebug()<<"员工目录已加载："<<entries.size()<<"名员工";
+    return true;
+}
+
+bool EmployeeDirectory::reload(int64_t faceid)
+{
+    QSqlQuery query;
+    query.prepare("select employeeID, name from employee where faceID = ?");
+    query.addBindValue((qlonglong)faceid);
+    if(!query.exec()){
+        qDebug()<<"无法读取人脸"<<faceid<<"对应的员工："<<query.lastError().text();
+        return false;
+    }
+    std::shared_ptr<const EmployeeEntry> entry;
+    if(query.next()){
+        entry = make_entry(query.value(0).toLongLong(), query.value(1).toString());
+    }
+    QMutexLocker locker(&mutex);
+    if(entry){
+        entries.insert(faceid, entry);
+    }else{
+        entries.remove(faceid);
+    }
+    return true;
+}
+
+std::shared_ptr<const EmployeeEntry> EmployeeDirectory::find(int64_t faceid) const
+{
+    QMutexLocker locker(&mutex);
+    return entries.value(faceid);
+}
+
+int EmployeeDirectory::size() const
+{
+    QMutexLocker locker(&mutex);
+    return entries.size();
+}
@@ -0,0 +1,77 @@
+#ifndef EMPLOYEEDIRECTORY_H
+#define EMPLOYEEDIRECTORY_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief 员工目录中的一名员工
+ * @details 除员工信息外还保存预先编码好的应答片段，每次应答只需拼接，不再格式化和转换编码
+ *          发布之后不再修改，持有shared_ptr期间可以安全读取
+ */
+struct EmployeeEntry
+{
+    qint64 employeeid = -1;     ///< 员工ID
+    QString name;               ///< 员工姓名
+    QString department;         ///< 部门
+    QByteArray jsonfields;      ///< JSON应答中的员工字段："employeeID":"..","name":"..","department":".."，UTF-8
+    QByteArray binaryfields;    ///< 二进制应答末尾的姓名和部门：各为quint16字节数 + UTF-8
+};
+
+/**
+ * @brief 进程内共享的员工目录
+ * @details 按faceID索引员工信息，识别成功后查一次哈希表即可构建应答，不再为每次识别执行SQL查询
+ *          - 启动时从employee表加载全部有人脸的员工
+ *          - 注册新员工后按faceID重新读取该员工
+ *          - 查询窗口修改员工表后整体重新加载
+ *          条目以shared_ptr发布，更新时替换条目而不修改旧条目，已取得旧条目的调用方不受影响
+ */
+class EmployeeDirectory
+{
+public:
+    /**
+     * @brief 获取进程内唯一的员工目录
+     */
+    static EmployeeDirectory &instance();
+
+    /**
+     * @brief 从employee表加载全部员工，替换当前内容
+     * @return 查询失败时返回false，当前内容保持不变
+     */
+    bool load();
+
+    /**
+     * @brief 从employee表重新读取一张人脸对应的员工
+     * @param faceid 人脸ID
+     * @details 表中没有该人脸时从目录中删除
+     */
+    bool reload(int64_t faceid);
+
+    /**
+     * @brief 查找人脸对应的员工
+     * @return 没有对应员工时返回nullptr
+     */
+    std::shared_ptr<const EmployeeEntry> find(int64_t faceid) const;
+
+    /**
+     * @brief 目录中的员工数
+     */
+    int size() const;
+
+    /**
+     * @brief 根据员工信息构建条目，预先编码应答片段
+     */
+    static std::shared_ptr<const EmployeeEntry> make_entry(qint64 employeeid, const QString &name);
+
+private:
+    EmployeeDirectory() = default;
+
+    mutable QMutex mutex;   ///< 保护entries
+    QHash<int64_t, std::shared_ptr<const EmployeeEntry>> entries;   ///< faceID到员工的索引
+};
+
+#endif // EMPLOYEEDIRECTORY_H
@@ -0,0 +1,86 @@
+#include "faceengineregistry.h"
+
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QDebug>
+
+/**
+ * @brief 模型文件路径
+ * @details fd: 人脸检测；pd: 5点关键点定位（左眼、右眼、鼻子、左嘴角、右嘴角）；fr: 人脸识别
+ */
+static const char *FD_MODEL = "C:/SeetaFace/bin/model/fd_2_00.dat";
+static const char *PD_MODEL = "C:/SeetaFace/bin/model/pd_2_00_pts5.dat";
+static const char *FR_MODEL = "C:/SeetaFace/bin/model/fr_2_10.dat";
+
+FaceEngineRegistry &FaceEngineRegistry::instance()
+{
+    static FaceEngineRegistry registry;
+    return registry;
+}
+
+FaceEngineRegistry::~FaceEngineRegistry()
+{
+    for(seeta::FaceDetector *p : detectors.idle) delete p;
+    for(seeta::FaceLandmarker *p : landmarkers.idle) delete p;
+    for(seeta::FaceRecognizer *p : recognizers.idle) delete p;
+}
+
+std::shared_ptr<seeta::FaceDetector> FaceEngineRegistry::detector()
+{
+    return acquire(detectors, FD_MODEL, "人脸检测");
+}
+
+std::shared_ptr<seeta::FaceLandmarker> FaceEngineRegistry::landmarker()
+{
+    return acquire(landmarkers, PD_MODEL, "关键点定位");
+}
+
+std::shared_ptr<seeta::FaceRecognizer> FaceEngineRegistry::recognizer()
+{
+    return acquire(recognizers, FR_MODEL, "人脸识别");
+}
+
+int FaceEngineRegistry::feature_size()
+{
+    {
+        QMutexLocker locker(&mutex);
+        if(mfeaturesize > 0) return mfeaturesize;
+    }
+    int size = recognizer()->GetExtractFeatureSize();
+    QMutexLocker locker(&mutex);
+    mfeaturesize = size;
+    return size;
+}
+
+/**
+ * @brief 取用引擎
+ * @details 1. 在锁内从空闲池取出一个引擎
+ *          2. 没有空闲引擎时在锁外加载模型，加载期间不阻塞其他线程归还或取用引擎
+ *          3. 返回的shared_ptr的删除器把引擎放回空闲池
+ *          模型统一在CPU上运行，确保系统兼容性
+ */
+template <typename T>
+std::shared_ptr<T> FaceEngineRegistry::acquire(Pool<T> &pool, const char *model, const char *name)
+{
+    T *engine = nullptr;
+    {
+        QMutexLocker locker(&mutex);
+        if(!pool.idle.empty()){
+            engine = pool.idle.back();
+            pool.idle.pop_back();
+        }
+    }
+    if(engine == nullptr){
+        QElapsedTimer timer;
+        timer.start();
+        seeta::ModelSetting setting(model, seeta::ModelSetting::CPU, 0);
+        engine = new T(setting);
+        QMutexLocker locker(&mutex);
+        pool.loaded++;
+        qDebug()<<"加载"<<name<<"模型，耗时"<<timer.elapsed()<<"毫秒，已加载"<<pool.loaded<<"份";
+    }
+    return std::shared_ptr<T>(engine, [this, &pool](T *p){
+        QMutexLocker locker(&mutex);
+        pool.idle.push_back(p);
+    });
+}
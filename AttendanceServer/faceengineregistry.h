@@ -0,0 +1,80 @@
+#ifndef FACEENGINEREGISTRY_H
+#define FACEENGINEREGISTRY_H
+
+#include <QMutex>
+#include <seeta/FaceDetector.h>
+#include <seeta/FaceLandmarker.h>
+#include <seeta/FaceRecognizer.h>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief 进程内共享的SeetaFace引擎注册表
+ * @details SeetaFace的检测器、关键点定位器和识别器构造时都要从磁盘读取并解析模型文件，耗时以秒计，
+ *          而且同一个引擎对象不能被多个线程同时使用
+ *          注册表为每种引擎维护一个空闲池：
+ *          - 取用时优先复用空闲的引擎，没有空闲引擎时才加载一份新的模型
+ *          - 返回的shared_ptr引用计数归零时引擎回到空闲池，而不是被释放
+ *          - 进程内加载的引擎份数等于同时使用的最大数量，注册窗口反复点击、重建特征库等场景不再重复加载
+ * @note 所有引擎必须在main()返回之前归还，注册表在静态析构时释放空闲引擎
+ */
+class FaceEngineRegistry
+{
+public:
+    /**
+     * @brief 获取进程内唯一的注册表
+     */
+    static FaceEngineRegistry &instance();
+
+    /**
+     * @brief 取用一个人脸检测器
+     */
+    std::shared_ptr<seeta::FaceDetector> detector();
+
+    /**
+     * @brief 取用一个5点关键点定位器
+     */
+    std::shared_ptr<seeta::FaceLandmarker> landmarker();
+
+    /**
+     * @brief 取用一个人脸识别器
+     */
+    std::shared_ptr<seeta::FaceRecognizer> recognizer();
+
+    /**
+     * @brief 识别模型的特征维度
+     * @details 第一次调用时借用一个识别器读取，之后使用缓存的值；借用的识别器留在空闲池中供后续复用
+     */
+    int feature_size();
+
+    ~FaceEngineRegistry();
+
+private:
+    FaceEngineRegistry() = default;
+    FaceEngineRegistry(const FaceEngineRegistry &) = delete;
+    FaceEngineRegistry &operator=(const FaceEngineRegistry &) = delete;
+
+    /**
+     * @brief 一种引擎的空闲池
+     */
+    template <typename T>
+    struct Pool
+    {
+        std::vector<T*> idle;   ///< 已加载但当前无人使用的引擎
+        int loaded = 0;         ///< 已加载的引擎总数
+    };
+
+    /**
+     * @brief 从空闲池取用引擎，没有空闲引擎时按model加载一份
+     */
+    template <typename T>
+    std::shared_ptr<T> acquire(Pool<T> &pool, const char *model, const char *name);
+
+    QMutex mutex;                               ///< 保护三个空闲池和mfeaturesize
+    Pool<seeta::FaceDetector> detectors;        ///< 人脸检测器
+    Pool<seeta::FaceLandmarker> landmarkers;    ///< 关键点定位器
+    Pool<seeta::FaceRecognizer> recognizers;    ///< 人脸识别器
+    int mfeaturesize = 0;                       ///< 缓存的特征维度，0表示尚未读取
+};
+
+#endif // FACEENGINEREGISTRY_H
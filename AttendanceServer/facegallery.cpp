@@ -0,0 +1,856 @@
+#include "facegallery.h"
+
+#include <QSaveFile>
+#include <QFile>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <random>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define FACEGALLERY_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief 特征库文件标识和版本号
+ */
+static const quint32 GALLERY_MAGIC = 0x4C414746; // "FGAL"
+static const quint32 GALLERY_VERSION = 1;
+static const quint32 SNAPSHOT_VERSION = 2;
+
+/**
+ * @brief 快照文件中各段的对齐单位
+ * @details 特征矩阵从页边界开始，映射之后的行地址与堆内存中一样按缓存行对齐
+ */
+static const qint64 SNAPSHOT_PAGE = 4096;
+
+/**
+ * @brief 第2版快照的文件头
+ * @details 按本机字节序原样写入文件开头，其余部分补零到SNAPSHOT_PAGE
+ */
+struct SnapshotHeader
+{
+    quint32 magic;
+    quint32 version;
+    qint32 dim;
+    qint32 stride;          ///< 每行的float个数，与FaceGallery::mstride相同
+    qint64 count;
+    qint64 maxid;
+    qint64 idsoffset;       ///< 人脸ID数组的偏移
+    qint64 dataoffset;      ///< 特征矩阵的偏移，按SNAPSHOT_PAGE对齐
+    qint64 filesize;
+    quint64 idschecksum;
+    quint64 datachecksum;
+    quint64 headerchecksum; ///< 之前所有字段的校验和
+};
+
+/**
+ * @brief 每次比对的行数
+ * @details 分块计算点积，分数缓冲区放在栈上并常驻L1缓存
+ */
+static const int SEARCH_BLOCK = 256;
+
+/**
+ * @brief 批量比对时每块的行数
+ * @details 64行1024维特征共256KB，可以常驻L2缓存，块内的行依次与所有查询相乘，
+ *          整个特征库每批查询只从内存读取一次
+ */
+static const int BATCH_BLOCK = 64;
+
+/**
+ * @brief 批量比对的微内核一次处理的查询数
+ */
+static const int BATCH_QUERIES = 4;
+
+/**
+ * @brief 标量点积实现
+ * @details 使用4个累加器打断加法依赖链，作为不支持AVX2的CPU上的后备实现
+ */
+static float dot_scalar(const float *a, const float *b, int dim)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for(; i + 4 <= dim; i += 4){
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for(; i < dim; i++){
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static void dot_rows_scalar(const float *query, const float *rows, std::size_t stride, int count, int dim, float *scores)
+{
+    for(int r = 0; r < count; r++){
+        scores[r] = dot_scalar(query, rows + r * stride, dim);
+    }
+}
+
+/**
+ * @brief 4个查询与连续多行的点积，scores按查询分段，每段count个
+ */
+static void dot_rows4_scalar(const float *const *queries, const float *rows, std::size_t stride, int count, int dim, float *scores)
+{
+    for(int q = 0; q < BATCH_QUERIES; q++){
+        dot_rows_scalar(queries[q], rows, stride, count, dim, scores + q * count);
+    }
+}
+
+#ifdef FACEGALLERY_X86_SIMD
+/**
+ * @brief AVX2/FMA点积实现
+ * @details 每次处理32个float，4个累加器交替使用以隐藏FMA指令延迟
+ *          通过target属性单独为该函数启用AVX2，程序整体仍可在老CPU上运行
+ */
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *a, const float *b, int dim)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    int i = 0;
+    for(; i + 32 <= dim; i += 32){
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for(; i + 8 <= dim; i += 8){
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    float result = _mm_cvtss_f32(sum);
+    for(; i < dim; i++){
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+__attribute__((target("avx2,fma")))
+static void dot_rows_avx2(const float *query, const float *rows, std::size_t stride, int count, int dim, float *scores)
+{
+    for(int r = 0; r < count; r++){
+        scores[r] = dot_avx2(query, rows + r * stride, dim);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx2(__m256 v)
+{
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    return _mm_cvtss_f32(sum);
+}
+
+/**
+ * @brief AVX2/FMA批量点积微内核
+ * @details 每次取2行特征与4个查询相乘，8个累加器占满寄存器，
+ *          每读取一次特征数据完成4次乘加，特征库的内存带宽由多个查询分摊
+ */
+__attribute__((target("avx2,fma")))
+static void dot_rows4_avx2(const float *const *queries, const float *rows, std::size_t stride, int count, int dim, float *scores)
+{
+    const float *q0 = queries[0], *q1 = queries[1], *q2 = queries[2], *q3 = queries[3];
+    int r = 0;
+    for(; r + 2 <= count; r += 2){
+        const float *ra = rows + r * stride;
+        const float *rb = ra + stride;
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        __m256 b0 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps(), b2 = _mm256_setzero_ps(), b3 = _mm256_setzero_ps();
+        int i = 0;
+        for(; i + 8 <= dim; i += 8){
+            __m256 x = _mm256_loadu_ps(ra + i);
+            __m256 y = _mm256_loadu_ps(rb + i);
+            __m256 v0 = _mm256_loadu_ps(q0 + i);
+            __m256 v1 = _mm256_loadu_ps(q1 + i);
+            __m256 v2 = _mm256_loadu_ps(q2 + i);
+            __m256 v3 = _mm256_loadu_ps(q3 + i);
+            a0 = _mm256_fmadd_ps(v0, x, a0);
+            a1 = _mm256_fmadd_ps(v1, x, a1);
+            a2 = _mm256_fmadd_ps(v2, x, a2);
+            a3 = _mm256_fmadd_ps(v3, x, a3);
+            b0 = _mm256_fmadd_ps(v0, y, b0);
+            b1 = _mm256_fmadd_ps(v1, y, b1);
+            b2 = _mm256_fmadd_ps(v2, y, b2);
+            b3 = _mm256_fmadd_ps(v3, y, b3);
+        }
+        float sa[BATCH_QUERIES] = {hsum_avx2(a0), hsum_avx2(a1), hsum_avx2(a2), hsum_avx2(a3)};
+        float sb[BATCH_QUERIES] = {hsum_avx2(b0), hsum_avx2(b1), hsum_avx2(b2), hsum_avx2(b3)};
+        for(; i < dim; i++){
+            for(int q = 0; q < BATCH_QUERIES; q++){
+                sa[q] += queries[q][i] * ra[i];
+                sb[q] += queries[q][i] * rb[i];
+            }
+        }
+        for(int q = 0; q < BATCH_QUERIES; q++){
+            scores[q * count + r] = sa[q];
+            scores[q * count + r + 1] = sb[q];
+        }
+    }
+    for(; r < count; r++){
+        for(int q = 0; q < BATCH_QUERIES; q++){
+            scores[q * count + r] = dot_avx2(queries[q], rows + r * stride, dim);
+        }
+    }
+}
+
+static bool cpu_has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+typedef float (*DotFunc)(const float *, const float *, int);
+typedef void (*DotRowsFunc)(const float *, const float *, std::size_t, int, int, float *);
+typedef void (*DotRows4Func)(const float *const *, const float *, std::size_t, int, int, float *);
+
+/**
+ * @brief 点积内核选择
+ * @details 程序启动时根据CPU能力确定一次，之后直接通过函数指针调用
+ */
+struct DotKernel
+{
+    DotFunc dot;
+    DotRowsFunc rows;
+    DotRows4Func rows4;
+    const char *name;
+
+    DotKernel() : dot(dot_scalar), rows(dot_rows_scalar), rows4(dot_rows4_scalar), name("scalar")
+    {
+#ifdef FACEGALLERY_X86_SIMD
+        if(cpu_has_avx2()){
+            dot = dot_avx2;
+            rows = dot_rows_avx2;
+            rows4 = dot_rows4_avx2;
+            name = "avx2+fma";
+        }
+#endif
+    }
+};
+
+static const DotKernel &kernel()
+{
+    static const DotKernel k;
+    return k;
+}
+
+/**
+ * @brief 64位FNV-1a校验和
+ * @param seed 上一段的结果，用于分段累加
+ */
+static quint64 fnv1a(const void *data, std::size_t size, quint64 seed = 14695981039346656037ULL)
+{
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    quint64 hash = seed;
+    for(std::size_t i = 0; i < size; i++){
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static qint64 align_page(qint64 offset)
+{
+    return (offset + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE * SNAPSHOT_PAGE;
+}
+
+FaceGallery::FaceGallery(int dim)
+    : mdim(dim)
+    , maxid(-1)
+    , mmapped(nullptr)
+    , mchecksum(0)
+    , mhaschecksum(false)
+{
+    // 每行补齐到缓存行整数倍，保证每一行的起始地址也是对齐的
+    const int floatsPerLine = ALIGNMENT / sizeof(float);
+    mstride = (dim + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+}
+
+int FaceGallery::dimension() const
+{
+    return mdim;
+}
+
+int FaceGallery::size() const
+{
+    return (int)mids.size();
+}
+
+int64_t FaceGallery::next_id() const
+{
+    return maxid + 1;
+}
+
+void FaceGallery::reserve(int count)
+{
+    detach();
+    mids.reserve(count);
+    mindex.reserve(count);
+    mdata.reserve((std::size_t)count * mstride);
+}
+
+bool FaceGallery::add(int64_t faceid, const float *feature)
+{
+    if(faceid < 0) return false;
+    std::vector<float> vec(feature, feature + mdim);
+    if(!normalize(vec.data(), mdim)) return false;
+    detach();
+
+    // 同一个人脸ID重复添加时覆盖原有特征
+    auto it = mindex.find(faceid);
+    std::size_t index;
+    if(it != mindex.end()){
+        index = it->second;
+    }else{
+        index = mids.size();
+        mids.push_back(faceid);
+        mindex[faceid] = index;
+        mdata.resize(mids.size() * mstride, 0.0f);
+    }
+    std::memcpy(mdata.data() + index * mstride, vec.data(), mdim * sizeof(float));
+    maxid = std::max(maxid, faceid);
+    return true;
+}
+
+bool FaceGallery::contains(int64_t faceid) const
+{
+    if(mmapped == nullptr) return mindex.count(faceid) > 0;
+    return std::find(mids.begin(), mids.end(), faceid) != mids.end();
+}
+
+bool FaceGallery::remove(int64_t faceid)
+{
+    detach();
+    auto it = mindex.find(faceid);
+    if(it == mindex.end()) return false;
+    // 用最后一行填补被删除的行，保持矩阵连续
+    std::size_t index = it->second;
+    std::size_t last = mids.size() - 1;
+    mindex.erase(it);
+    if(index != last){
+        mids[index] = mids[last];
+        mindex[mids[index]] = index;
+        std::memcpy(mdata.data() + index * mstride, mdata.data() + last * mstride, mstride * sizeof(float));
+    }
+    mids.pop_back();
+    mdata.resize(mids.size() * mstride);
+    return true;
+}
+
+int64_t FaceGallery::search(const float *feature, float *similarity) const
+{
+    if(similarity) *similarity = 0;
+    if(mids.empty()) return -1;
+
+    std::vector<float> query(feature, feature + mdim);
+    if(!normalize(query.data(), mdim)) return -1;
+
+    // 分块计算相似度并记录最大值
+    float scores[SEARCH_BLOCK];
+    float best = -2.0f;
+    std::size_t bestindex = 0;
+    const std::size_t count = mids.size();
+    for(std::size_t begin = 0; begin < count; begin += SEARCH_BLOCK){
+        int n = (int)std::min<std::size_t>(SEARCH_BLOCK, count - begin);
+        kernel().rows(query.data(), matrix() + begin * mstride, mstride, n, mdim, scores);
+        for(int i = 0; i < n; i++){
+            if(scores[i] > best){
+                best = scores[i];
+                bestindex = begin + i;
+            }
+        }
+    }
+    if(similarity) *similarity = best;
+    return mids[bestindex];
+}
+
+std::vector<FaceMatch> FaceGallery::search_topk(const float *feature, int k) const
+{
+    return search_batch(feature, 1, k).front();
+}
+
+/**
+ * @brief 批量查找
+ * @details 分块矩阵乘法：外层按BATCH_BLOCK行遍历特征库，块内每4个查询调用一次微内核，
+ *          每个查询用大小为k的小顶堆保留当前最好的结果
+ */
+std::vector<std::vector<FaceMatch>> FaceGallery::search_batch(const float *features, int count, int k) const
+{
+    std::vector<std::vector<FaceMatch>> results(std::max(count, 0));
+    if(count <= 0 || k <= 0 || mids.empty()) return results;
+
+    // 查询向量归一化后按行存放，每行同样补齐到缓存行整数倍
+    std::vector<float, AlignedAllocator<float, ALIGNMENT>> queries((std::size_t)count * mstride, 0.0f);
+    std::vector<bool> valid(count);
+    for(int q = 0; q < count; q++){
+        float *query = queries.data() + (std::size_t)q * mstride;
+        std::memcpy(query, features + (std::size_t)q * mdim, mdim * sizeof(float));
+        valid[q] = normalize(query, mdim);
+    }
+
+    typedef std::pair<float, std::size_t> Scored;
+    typedef std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>> TopK;
+    std::vector<TopK> heaps(count);
+    auto collect = [&](int q, std::size_t begin, const float *scores, int n){
+        TopK &heap = heaps[q];
+        for(int i = 0; i < n; i++){
+            if((int)heap.size() < k){
+                heap.push(Scored(scores[i], begin + i));
+            }else if(scores[i] > heap.top().first){
+                heap.pop();
+                heap.push(Scored(scores[i], begin + i));
+            }
+        }
+    };
+
+    float scores[BATCH_QUERIES * BATCH_BLOCK];
+    const std::size_t rows = mids.size();
+    for(std::size_t begin = 0; begin < rows; begin += BATCH_BLOCK){
+        int n = (int)std::min<std::size_t>(BATCH_BLOCK, rows - begin);
+        const float *block = matrix() + begin * mstride;
+        int q = 0;
+        for(; q + BATCH_QUERIES <= count; q += BATCH_QUERIES){
+            const float *group[BATCH_QUERIES];
+            for(int j = 0; j < BATCH_QUERIES; j++){
+                group[j] = queries.data() + (std::size_t)(q + j) * mstride;
+            }
+            kernel().rows4(group, block, mstride, n, mdim, scores);
+            for(int j = 0; j < BATCH_QUERIES; j++){
+                collect(q + j, begin, scores + j * n, n);
+            }
+        }
+        for(; q < count; q++){
+            kernel().rows(queries.data() + (std::size_t)q * mstride, block, mstride, n, mdim, scores);
+            collect(q, begin, scores, n);
+        }
+    }
+
+    for(int q = 0; q < count; q++){
+        if(!valid[q]) continue;
+        TopK &heap = heaps[q];
+        results[q].resize(heap.size());
+        for(int i = (int)heap.size() - 1; i >= 0; i--){
+            results[q][i] = FaceMatch{mids[heap.top().second], heap.top().first};
+            heap.pop();
+        }
+    }
+    return results;
+}
+
+int64_t FaceGallery::id_at(int index) const
+{
+    return mids[index];
+}
+
+const float *FaceGallery::row(int index) const
+{
+    return matrix() + (std::size_t)index * mstride;
+}
+
+const float *FaceGallery::matrix() const
+{
+    return mmapped != nullptr ? mmapped : mdata.data();
+}
+
+bool FaceGallery::is_mapped() const
+{
+    return mmapped != nullptr;
+}
+
+/**
+ * @brief 解除与快照文件的映射
+ * @details 映射加载时人脸ID到行号的映射也推迟到这里建立，只做查询的工作对象不需要它
+ */
+void FaceGallery::detach()
+{
+    // 所有修改都经过这里，之后快照中的校验和不再对应当前内容
+    mhaschecksum = false;
+    if(mmapped == nullptr) return;
+    const std::size_t values = mids.size() * mstride;
+    mdata.assign(mmapped, mmapped + values);
+    mmapped = nullptr;
+    mfile.reset();
+    build_index();
+}
+
+void FaceGallery::build_index()
+{
+    mindex.clear();
+    mindex.reserve(mids.size());
+    for(std::size_t i = 0; i < mids.size(); i++){
+        mindex[mids[i]] = i;
+    }
+}
+
+bool FaceGallery::verify() const
+{
+    if(!mhaschecksum) return true;
+    return fnv1a(matrix(), mids.size() * mstride * sizeof(float)) == mchecksum;
+}
+
+/**
+ * @brief 保存特征库
+ * @details 第2版快照格式：SNAPSHOT_PAGE大小的文件头、人脸ID数组、按页对齐的特征矩阵
+ *          特征矩阵连同每行的补齐部分原样写入，映射之后可以直接按mstride访问
+ *          1. 先确定要写出的行：本特征库中保留的行号和added的全部行
+ *          2. 本特征库中连续保留的行合并成一段写入，没有增量时整个矩阵就是一段
+ *          3. 特征矩阵的校验和随写入分段累加，与一次算完整个矩阵的结果相同
+ */
+bool FaceGallery::save(const QString &path, const FaceGallery *added, const std::unordered_set<int64_t> *removed) const
+{
+    // 保留的行，按区间[first, second)记录
+    std::vector<std::pair<std::size_t, std::size_t>> runs;
+    std::vector<qint64> ids;
+    ids.reserve(mids.size() + (added != nullptr ? added->size() : 0));
+    for(std::size_t i = 0; i < mids.size(); i++){
+        const int64_t faceid = mids[i];
+        if((removed != nullptr && removed->count(faceid) > 0) || (added != nullptr && added->contains(faceid))) continue;
+        if(!runs.empty() && runs.back().second == i){
+            runs.back().second = i + 1;
+        }else{
+            runs.emplace_back(i, i + 1);
+        }
+        ids.push_back(faceid);
+    }
+    int64_t filemaxid = maxid;
+    if(added != nullptr){
+        for(int i = 0; i < added->size(); i++) ids.push_back(added->id_at(i));
+        filemaxid = std::max(filemaxid, added->maxid);
+    }
+
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)){
+        qDebug()<<"特征库保存失败："<<file.errorString();
+        return false;
+    }
+    const std::size_t rowbytes = mstride * sizeof(float);
+    const std::size_t idbytes = ids.size() * sizeof(qint64);
+    const std::size_t databytes = ids.size() * rowbytes;
+
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = GALLERY_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.dim = mdim;
+    header.stride = mstride;
+    header.count = (qint64)ids.size();
+    header.maxid = filemaxid;
+    header.idsoffset = SNAPSHOT_PAGE;
+    header.dataoffset = align_page(header.idsoffset + (qint64)idbytes);
+    header.filesize = header.dataoffset + (qint64)databytes;
+    header.idschecksum = fnv1a(ids.data(), idbytes);
+    // 校验和在写入文件头之前就要算出来，先把要写的各段扫描一遍
+    quint64 checksum = fnv1a(nullptr, 0);
+    for(const std::pair<std::size_t, std::size_t> &run : runs){
+        checksum = fnv1a(matrix() + run.first * mstride, (run.second - run.first) * rowbytes, checksum);
+    }
+    if(added != nullptr && added->size() > 0){
+        checksum = fnv1a(added->matrix(), (std::size_t)added->size() * rowbytes, checksum);
+    }
+    header.datachecksum = checksum;
+    header.headerchecksum = fnv1a(&header, offsetof(SnapshotHeader, headerchecksum));
+
+    std::vector<char> page(SNAPSHOT_PAGE, 0);
+    std::memcpy(page.data(), &header, sizeof(header));
+    bool ok = file.write(page.data(), SNAPSHOT_PAGE) == SNAPSHOT_PAGE;
+    ok = ok && file.write(reinterpret_cast<const char*>(ids.data()), idbytes) == (qint64)idbytes;
+    qint64 padding = header.dataoffset - header.idsoffset - (qint64)idbytes;
+    ok = ok && file.write(page.data(), padding) == padding;
+    // 特征矩阵可能有几GB，分段写入
+    auto write_rows = [&](const float *rows, std::size_t bytes){
+        const char *data = reinterpret_cast<const char*>(rows);
+        for(std::size_t done = 0; ok && done < bytes; ){
+            qint64 chunk = (qint64)std::min<std::size_t>(bytes - done, 64 << 20);
+            ok = file.write(data + done, chunk) == chunk;
+            done += chunk;
+        }
+    };
+    for(const std::pair<std::size_t, std::size_t> &run : runs){
+        write_rows(matrix() + run.first * mstride, (run.second - run.first) * rowbytes);
+    }
+    if(added != nullptr && added->size() > 0){
+        write_rows(added->matrix(), (std::size_t)added->size() * rowbytes);
+    }
+    if(!ok){
+        qDebug()<<"特征库保存失败："<<file.errorString();
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+/**
+ * @brief 读取并检查第1版特征库文件头
+ * @param count 输出人脸数量
+ * @param fileMaxId 输出文件中记录的最大人脸ID
+ */
+static bool read_header(QFile &file, QDataStream &stream, int expectedDim, qint64 *count, qint64 *fileMaxId)
+{
+    quint32 magic = 0, version = 0;
+    qint32 dim = 0;
+    stream>>magic>>version>>dim>>*count>>*fileMaxId;
+    if(stream.status() != QDataStream::Ok || magic != GALLERY_MAGIC || version != GALLERY_VERSION){
+        qDebug()<<"特征库文件格式不正确："<<file.fileName();
+        return false;
+    }
+    if(dim != expectedDim){
+        qDebug()<<"特征库维度不匹配："<<dim<<"期望"<<expectedDim;
+        return false;
+    }
+    // 数量字段损坏时避免按错误的数量申请内存
+    if(*count < 0 || *count > file.size() / (qint64)(sizeof(qint64) + expectedDim * sizeof(float))){
+        qDebug()<<"特征库文件不完整："<<file.fileName();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 读取并检查第2版快照文件头
+ * @return 不是第2版快照时返回false且不输出日志，由调用方按第1版格式读取
+ */
+static bool read_snapshot_header(QFile &file, SnapshotHeader *header, bool *isSnapshot)
+{
+    *isSnapshot = false;
+    std::memset(header, 0, sizeof(*header));
+    if(file.read(reinterpret_cast<char*>(header), sizeof(*header)) != (qint64)sizeof(*header)) return false;
+    file.seek(0);
+    if(header->magic != GALLERY_MAGIC || header->version != SNAPSHOT_VERSION) return false;
+    *isSnapshot = true;
+    if(header->headerchecksum != fnv1a(header, offsetof(SnapshotHeader, headerchecksum))){
+        qDebug()<<"特征库快照文件头校验失败："<<file.fileName();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 检查第2版快照文件头与当前特征库是否匹配
+ */
+static bool check_snapshot(const QFile &file, const SnapshotHeader &header, int dim, int stride)
+{
+    if(header.dim != dim || header.stride != stride){
+        qDebug()<<"特征库维度不匹配："<<header.dim<<"期望"<<dim;
+        return false;
+    }
+    if(header.count < 0 || header.idsoffset < SNAPSHOT_PAGE || header.dataoffset % SNAPSHOT_PAGE != 0
+            || header.dataoffset < header.idsoffset + header.count * (qint64)sizeof(qint64)
+            || header.filesize != header.dataoffset + header.count * stride * (qint64)sizeof(float)
+            || file.size() < header.filesize){
+        qDebug()<<"特征库文件不完整："<<file.fileName();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 读取第2版快照中的人脸ID并校验
+ */
+static bool read_snapshot_ids(QFile &file, const SnapshotHeader &header, std::vector<int64_t> &ids)
+{
+    std::vector<qint64> fileids((std::size_t)header.count);
+    const qint64 bytes = header.count * (qint64)sizeof(qint64);
+    if(!file.seek(header.idsoffset) || file.read(reinterpret_cast<char*>(fileids.data()), bytes) != bytes
+            || fnv1a(fileids.data(), (std::size_t)bytes) != header.idschecksum){
+        qDebug()<<"特征库快照人脸ID校验失败："<<file.fileName();
+        return false;
+    }
+    ids.assign(fileids.begin(), fileids.end());
+    return true;
+}
+
+/**
+ * @brief 加载特征库
+ * @details 第2版快照：
+ *          1. 检查文件头和人脸ID的校验和
+ *          2. map为true时只读映射整个文件，特征矩阵原地使用，页面在第一次比对时才从磁盘读入
+ *          3. map为false或映射失败时读入堆内存，并检查特征矩阵的校验和
+ *          第1版文件按原来的方式读入堆内存，下一次保存时转换为第2版
+ */
+bool FaceGallery::load(const QString &path, bool map)
+{
+    std::shared_ptr<QFile> file = std::make_shared<QFile>(path);
+    if(!file->open(QIODevice::ReadOnly)) return false;
+
+    SnapshotHeader header;
+    bool isSnapshot = false;
+    if(read_snapshot_header(*file, &header, &isSnapshot)){
+        if(!check_snapshot(*file, header, mdim, mstride)) return false;
+        std::vector<int64_t> ids;
+        if(!read_snapshot_ids(*file, header, ids)) return false;
+
+        const std::size_t databytes = (std::size_t)header.count * mstride * sizeof(float);
+        const float *mapped = nullptr;
+        if(map && databytes > 0){
+            uchar *base = file->map(0, header.filesize);
+            if(base != nullptr){
+                mapped = reinterpret_cast<const float*>(base + header.dataoffset);
+            }else{
+                qDebug()<<"特征库快照映射失败，读入内存："<<file->errorString();
+            }
+        }
+        std::vector<float, AlignedAllocator<float, ALIGNMENT>> data;
+        if(mapped == nullptr){
+            data.resize((std::size_t)header.count * mstride);
+            if(!file->seek(header.dataoffset)
+                    || file->read(reinterpret_cast<char*>(data.data()), (qint64)databytes) != (qint64)databytes
+                    || fnv1a(data.data(), databytes) != header.datachecksum){
+                qDebug()<<"特征库快照特征校验失败："<<path;
+                return false;
+            }
+            file.reset();
+        }
+
+        mids.swap(ids);
+        mdata.swap(data);
+        mfile = file;
+        mmapped = mapped;
+        mchecksum = header.datachecksum;
+        mhaschecksum = true;
+        maxid = header.maxid;
+        mindex.clear();
+        for(int64_t id : mids){
+            maxid = std::max(maxid, id);
+        }
+        // 映射加载时推迟到第一次修改再建立ID索引
+        if(mmapped == nullptr) build_index();
+        return true;
+    }
+    if(isSnapshot) return false;
+
+    QDataStream stream(file.get());
+    stream.setVersion(QDataStream::Qt_5_15);
+
+    qint64 count = 0, fileMaxId = -1;
+    if(!read_header(*file, stream, mdim, &count, &fileMaxId)) return false;
+
+    std::vector<int64_t> ids(count);
+    for(qint64 i = 0; i < count; i++){
+        qint64 id = -1;
+        stream>>id;
+        ids[i] = id;
+    }
+    std::vector<float, AlignedAllocator<float, ALIGNMENT>> data((std::size_t)count * mstride, 0.0f);
+    for(qint64 i = 0; i < count; i++){
+        stream.readRawData(reinterpret_cast<char*>(data.data() + i * mstride), mdim * sizeof(float));
+    }
+    if(stream.status() != QDataStream::Ok){
+        qDebug()<<"特征库文件不完整："<<path;
+        return false;
+    }
+
+    mids.swap(ids);
+    mdata.swap(data);
+    mfile.reset();
+    mmapped = nullptr;
+    mchecksum = 0;
+    mhaschecksum = false;
+    maxid = fileMaxId;
+    for(int64_t id : mids){
+        maxid = std::max(maxid, id);
+    }
+    build_index();
+    return true;
+}
+
+bool FaceGallery::normalize(float *vec, int dim)
+{
+    float norm = std::sqrt(kernel().dot(vec, vec, dim));
+    if(norm <= 0) return false;
+    float inv = 1.0f / norm;
+    for(int i = 0; i < dim; i++){
+        vec[i] *= inv;
+    }
+    return true;
+}
+
+float FaceGallery::dot(const float *a, const float *b, int dim)
+{
+    return kernel().dot(a, b, dim);
+}
+
+void FaceGallery::dot_rows(const float *query, const float *rows, std::size_t stride, int count, int dim, float *scores)
+{
+    kernel().rows(query, rows, stride, count, dim, scores);
+}
+
+const char *FaceGallery::kernel_name()
+{
+    return kernel().name;
+}
+
+/**
+ * @brief 特征库启动耗时评估
+ * @details 对每种规模：
+ *          1. 生成随机特征并保存为快照
+ *          2. 映射加载，记录加载耗时和首次查询耗时（首次查询会把整个特征矩阵调入内存）
+ *          3. 读入堆内存加载（含特征校验），记录加载耗时和首次查询耗时
+ *          快照刚写完时仍在页缓存中，结果反映的是热启动；冷启动时映射加载的耗时基本不变，
+ *          首次查询和读入堆内存的耗时都受磁盘带宽限制
+ */
+void FaceGallery::benchmark_startup(const QString &dir, int dim)
+{
+    static const int COUNTS[] = {10000, 100000, 1000000};
+    std::mt19937 rng(20240601);
+    std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+    std::vector<float> query(dim);
+    for(float &v : query) v = value(rng);
+
+    for(int count : COUNTS){
+        const QString path = QDir(dir).filePath(QString("benchmark_%1.gallery").arg(count));
+        QElapsedTimer timer;
+        {
+            FaceGallery gallery(dim);
+            gallery.reserve(count);
+            std::vector<float> feature(dim);
+            for(int i = 0; i < count; i++){
+                for(float &v : feature) v = value(rng);
+                gallery.add(i, feature.data());
+            }
+            timer.start();
+            if(!gallery.save(path)){
+                qDebug()<<"特征库启动评估：保存快照失败，人脸数"<<count;
+                return;
+            }
+            qDebug()<<"特征库启动评估：人脸数"<<count<<"快照"<<QFile(path).size() / (1024 * 1024)<<"MB"
+                    <<"保存耗时"<<timer.elapsed()<<"毫秒";
+        }
+        {
+            FaceGallery gallery(dim);
+            timer.restart();
+            bool ok = gallery.load(path, true);
+            qint64 loadus = timer.nsecsElapsed() / 1000;
+            timer.restart();
+            gallery.search(query.data());
+            qint64 queryus = timer.nsecsElapsed() / 1000;
+            qDebug()<<"  映射加载"<<(ok && gallery.is_mapped())<<"加载耗时"<<loadus<<"微秒，首次查询"<<queryus<<"微秒";
+        }
+        {
+            FaceGallery gallery(dim);
+            timer.restart();
+            bool ok = gallery.load(path, false);
+            qint64 loadus = timer.nsecsElapsed() / 1000;
+            timer.restart();
+            gallery.search(query.data());
+            qint64 queryus = timer.nsecsElapsed() / 1000;
+            qDebug()<<"  读入内存"<<ok<<"加载耗时"<<loadus<<"微秒，首次查询"<<queryus<<"微秒";
+        }
+        QFile::remove(path);
+    }
+}
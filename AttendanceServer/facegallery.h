@@ -0,0 +1,275 @@
+#ifndef FACEGALLERY_H
+#define FACEGALLERY_H
+
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+class QFile;
+
+/**
+ * @brief 按固定字节对齐分配内存的分配器
+ * @details 用于让特征矩阵的起始地址落在缓存行上，SIMD读取时不会跨越缓存行
+ */
+template <typename T, std::size_t Alignment>
+struct AlignedAllocator
+{
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        // 申请大小必须是对齐值的整数倍
+        std::size_t bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+#ifdef _WIN32
+        void *p = _aligned_malloc(bytes, Alignment);
+#else
+        void *p = std::aligned_alloc(Alignment, bytes);
+#endif
+        if(p == nullptr) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T *p, std::size_t)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        std::free(p);
+#endif
+    }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+/**
+ * @brief 一条比对结果
+ */
+struct FaceMatch
+{
+    int64_t faceid;     ///< 人脸ID
+    float similarity;   ///< 余弦相似度
+};
+
+/**
+ * @brief 人脸特征库
+ * @details 取代SeetaFace引擎内部的人脸数据库，自行保存已注册的人脸特征并完成比对
+ *          - 特征按行连续存放在64字节对齐的float矩阵中，每行补齐到缓存行整数倍
+ *          - 入库时先做L2归一化，比对时余弦相似度退化为一次点积
+ *          - 点积内核在支持AVX2/FMA的CPU上使用SIMD实现，否则使用标量实现
+ *          - 快照文件按页对齐存放特征矩阵，加载时只读映射到内存并原地比对；
+ *            映射的特征库作为LiveGallery的基础版本只读使用，修改记录在增量中，
+ *            只有直接修改映射的特征库时才会复制到堆内存
+ * @note 本类不做加锁，同一对象的并发读写需要由调用方保证
+ */
+class FaceGallery
+{
+public:
+    /**
+     * @brief 缓存行大小（字节），矩阵起始地址和每行长度都按此对齐
+     */
+    static constexpr int ALIGNMENT = 64;
+
+    /**
+     * @brief 构造函数
+     * @param dim 特征维度，fr_2_10模型为1024
+     */
+    explicit FaceGallery(int dim = 0);
+
+    /**
+     * @brief 特征维度
+     */
+    int dimension() const;
+
+    /**
+     * @brief 已注册的人脸数量
+     */
+    int size() const;
+
+    /**
+     * @brief 下一个可用的人脸ID
+     * @details 为已有最大ID加1，删除人脸后ID不会被复用
+     */
+    int64_t next_id() const;
+
+    /**
+     * @brief 预留容量，批量导入前调用可避免多次扩容
+     */
+    void reserve(int count);
+
+    /**
+     * @brief 添加一条人脸特征
+     * @param faceid 人脸ID，已存在时覆盖原特征
+     * @param feature 长度为dimension()的特征向量，内部会复制并归一化
+     * @return 特征全为0时返回false
+     */
+    bool add(int64_t faceid, const float *feature);
+
+    /**
+     * @brief 人脸ID是否存在
+     * @details 映射加载且未修改过的特征库没有ID索引，顺序扫描人脸ID数组
+     */
+    bool contains(int64_t faceid) const;
+
+    /**
+     * @brief 删除一条人脸特征
+     * @param faceid 人脸ID
+     * @return 人脸ID存在时返回true
+     */
+    bool remove(int64_t faceid);
+
+    /**
+     * @brief 精确查找最相似的人脸
+     * @param feature 查询特征，可以未归一化
+     * @param similarity 输出最高的余弦相似度，可为nullptr
+     * @return 最相似的人脸ID，特征库为空时返回-1
+     */
+    int64_t search(const float *feature, float *similarity = nullptr) const;
+
+    /**
+     * @brief 精确查找最相似的k张人脸
+     * @param feature 查询特征，可以未归一化
+     * @param k 返回的结果数
+     * @return 按相似度从高到低排列的结果，特征库为空时为空
+     */
+    std::vector<FaceMatch> search_topk(const float *feature, int k) const;
+
+    /**
+     * @brief 批量精确查找
+     * @param features count个查询特征，按行连续存放，可以未归一化
+     * @param count 查询数
+     * @param k 每个查询返回的结果数
+     * @return 每个查询的前k个结果，按相似度从高到低排列
+     * @details 多个查询与特征库做一次分块矩阵乘法，特征库只需从内存读取一次，
+     *          适合高峰期同时到达的多帧图像
+     */
+    std::vector<std::vector<FaceMatch>> search_batch(const float *features, int count, int k) const;
+
+    /**
+     * @brief 获取第index行的人脸ID
+     */
+    int64_t id_at(int index) const;
+
+    /**
+     * @brief 获取第index行的归一化特征
+     */
+    const float *row(int index) const;
+
+    /**
+     * @brief 保存特征库到文件
+     * @param path 文件路径
+     * @param added 叠加在本特征库之上的新增人脸，可为nullptr
+     * @param removed 要去掉的人脸ID，可为nullptr
+     * @details 先写临时文件再替换，写入中途断电不会损坏原文件
+     *          文件格式为第2版快照：4KB文件头、人脸ID数组、按页对齐且每行补齐到缓存行的特征矩阵，
+     *          文件头、人脸ID和特征矩阵各自带校验和
+     *          给出增量时按行流式写出合并结果：本特征库中未删除、未被added覆盖的行，之后是added的行，
+     *          本特征库可以是映射的，合并过程不复制到堆内存
+     * @note 不要用它覆盖仍被映射的快照，Windows上被映射的文件无法替换，快照按代保存见FaceJournal
+     */
+    bool save(const QString &path, const FaceGallery *added = nullptr,
+              const std::unordered_set<int64_t> *removed = nullptr) const;
+
+    /**
+     * @brief 从文件加载特征库
+     * @param path 文件路径
+     * @param map 为true时只读映射第2版快照并原地比对，为false时读入堆内存
+     * @return 文件不存在、格式、维度或校验和不匹配时返回false，原有数据保持不变
+     * @details 加载时校验文件头和人脸ID，特征矩阵的校验和由verify()按需检查；
+     *          第1版文件总是读入堆内存
+     */
+    bool load(const QString &path, bool map = true);
+
+    /**
+     * @brief 检查特征矩阵是否与快照中记录的校验和一致
+     * @details 需要读取整个特征矩阵，映射和读入堆内存的特征库都会检查；
+     *          第1版文件、内存中建立或加载后修改过的特征库没有可对照的校验和，返回true
+     */
+    bool verify() const;
+
+    /**
+     * @brief 特征矩阵是否直接映射自快照文件
+     */
+    bool is_mapped() const;
+
+    /**
+     * @brief 对向量做L2归一化
+     * @return 向量模长为0时返回false
+     */
+    static bool normalize(float *vec, int dim);
+
+    /**
+     * @brief 计算两个向量的点积
+     * @details 根据CPU能力选择AVX2/FMA或标量实现
+     */
+    static float dot(const float *a, const float *b, int dim);
+
+    /**
+     * @brief 计算一个查询向量与连续多行的点积
+     * @param query 查询向量
+     * @param rows 第一行的起始地址
+     * @param stride 相邻两行之间的float个数
+     * @param count 行数
+     * @param dim 向量维度
+     * @param scores 输出，长度为count
+     */
+    static void dot_rows(const float *query, const float *rows, std::size_t stride, int count, int dim, float *scores);
+
+    /**
+     * @brief 当前使用的点积内核名称，用于启动日志
+     */
+    static const char *kernel_name();
+
+    /**
+     * @brief 特征库启动耗时评估
+     * @param dir 存放临时快照的目录
+     * @param dim 特征维度
+     * @details 分别生成1万、10万、100万张随机人脸的快照，比较读入堆内存和映射加载的耗时以及首次查询延迟
+     *          100万张1024维人脸的快照约4GB，需要足够的磁盘和内存
+     */
+    static void benchmark_startup(const QString &dir, int dim);
+
+private:
+    /**
+     * @brief 特征矩阵的起始地址
+     * @details 映射加载时指向映射区域，否则指向mdata
+     */
+    const float *matrix() const;
+
+    /**
+     * @brief 修改之前把映射的特征矩阵复制到堆内存，并建立人脸ID到行号的映射
+     */
+    void detach();
+
+    /**
+     * @brief 根据mids重建人脸ID到行号的映射
+     */
+    void build_index();
+
+
+    int mdim;       ///< 特征维度
+    int mstride;    ///< 每行占用的float个数，补齐到缓存行整数倍
+    int64_t maxid;  ///< 出现过的最大人脸ID
+    std::vector<int64_t> mids;  ///< 每行对应的人脸ID
+    std::unordered_map<int64_t, std::size_t> mindex; ///< 人脸ID到行号的映射
+    std::vector<float, AlignedAllocator<float, ALIGNMENT>> mdata; ///< 行优先的特征矩阵
+    std::shared_ptr<QFile> mfile;   ///< 映射的快照文件，副本之间共享，最后一个副本释放时解除映射
+    const float *mmapped;           ///< 映射区域中的特征矩阵，未映射时为nullptr
+    quint64 mchecksum;              ///< 快照中记录的特征矩阵校验和
+    bool mhaschecksum;              ///< mchecksum是否对应当前的特征矩阵，修改后失效
+};
+
+#endif // FACEGALLERY_H
@@ -0,0 +1,392 @@
+#include "facejournal.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <cstring>
+
+/**
+ * @brief 日志文件标识和版本号
+ */
+static const quint32 JOURNAL_MAGIC = 0x4C4E4A46; // "FJNL"
+static const quint32 JOURNAL_VERSION = 1;
+
+/**
+ * @brief 文件头大小：magic、版本、维度和保留字段各4字节
+ */
+static const qint64 HEADER_SIZE = 16;
+
+/**
+ * @brief 记录类型
+ */
+static const qint32 OP_ADD = 1;
+static const qint32 OP_REMOVE = 2;
+
+/**
+ * @brief 日志文件读写使用的互斥锁
+ * @details 进程内所有日志对象共享，追加、改名和删除文件都在锁内完成
+ */
+static QMutex journalmutex;
+
+/**
+ * @brief 后台压缩是否正在进行
+ * @details 由journalmutex保护，save_snapshot()等待压缩结束，避免压缩完成时把指针切回由旧快照合并出的一代
+ */
+static bool compacting = false;
+
+/**
+ * @brief 尚未结束的压缩线程数
+ * @details 由journalmutex保护，包括compacting清除之后仍在执行回调的线程，wait_compaction()等待它归零
+ */
+static int compactthreads = 0;
+static QWaitCondition compactdone;
+
+/**
+ * @brief 记录的校验和
+ * @details qChecksum只有16位，两段各算一次拼成32位
+ */
+static quint32 record_checksum(const char *data, qint64 size)
+{
+    qint64 half = size / 2;
+    return ((quint32)qChecksum(data, (uint)half) << 16) | qChecksum(data + half, (uint)(size - half));
+}
+
+/**
+ * @brief 快照指针文件路径
+ * @details 内容是当前一代的编号，只在切换时整体替换，从不映射
+ */
+static QString pointer_file(const QString &snapshot)
+{
+    return snapshot + ".current";
+}
+
+/**
+ * @brief 第generation代快照的文件路径，第0代是快照路径本身
+ */
+static QString generation_file(const QString &snapshot, int generation)
+{
+    return generation == 0 ? snapshot : snapshot + "." + QString::number(generation);
+}
+
+/**
+ * @brief 读取当前一代的编号
+ * @details 指针文件不存在或内容无效时为第0代
+ */
+static int current_generation(const QString &snapshot)
+{
+    QFile file(pointer_file(snapshot));
+    if(!file.open(QIODevice::ReadOnly)) return 0;
+    bool ok = false;
+    int generation = QString::fromLatin1(file.readAll()).trimmed().toInt(&ok);
+    return ok && generation > 0 ? generation : 0;
+}
+
+/**
+ * @brief 删除当前一代之外的快照
+ * @details 尽力而为：Windows上仍被映射的快照删除失败，留到下次启动再删
+ */
+static void remove_stale_generations(const QString &snapshot, int keep)
+{
+    const QFileInfo info(snapshot);
+    const QString prefix = info.fileName() + ".";
+    QDir dir = info.absoluteDir();
+    for(const QString &name : dir.entryList(QStringList() << prefix + "*", QDir::Files)){
+        bool ok = false;
+        int generation = name.mid(prefix.size()).toInt(&ok);
+        if(!ok || generation <= 0 || generation == keep) continue;
+        if(!dir.remove(name)) qDebug()<<"旧的特征库快照暂时无法删除："<<name;
+    }
+    if(keep != 0 && QFile::exists(snapshot) && !QFile::remove(snapshot)){
+        qDebug()<<"旧的特征库快照暂时无法删除："<<snapshot;
+    }
+}
+
+FaceJournal::FaceJournal(const QString &path, int dim)
+    : mpath(path)
+    , mcompacting(path + ".compacting")
+    , mdim(dim)
+{
+}
+
+qint64 FaceJournal::record_size() const
+{
+    // 类型、人脸ID、特征、校验和
+    return sizeof(qint32) + sizeof(qint64) + (qint64)mdim * sizeof(float) + sizeof(quint32);
+}
+
+bool FaceJournal::append_add(int64_t faceid, const float *feature)
+{
+    return append(OP_ADD, faceid, feature);
+}
+
+bool FaceJournal::append_remove(int64_t faceid)
+{
+    return append(OP_REMOVE, faceid, nullptr);
+}
+
+/**
+ * @brief 追加一条记录
+ * @details 1. 新文件先写入文件头
+ *          2. 文件末尾有残缺记录时先截断到最后一条完整记录
+ *          3. 记录整条写入后立即flush，不保留在进程缓冲区中
+ */
+bool FaceJournal::append(qint32 op, int64_t faceid, const float *feature)
+{
+    QByteArray record((int)record_size(), 0);
+    char *p = record.data();
+    std::memcpy(p, &op, sizeof(op));
+    p += sizeof(op);
+    qint64 id = faceid;
+    std::memcpy(p, &id, sizeof(id));
+    p += sizeof(id);
+    if(feature != nullptr) std::memcpy(p, feature, mdim * sizeof(float));
+    p += mdim * sizeof(float);
+    quint32 checksum = record_checksum(record.constData(), p - record.constData());
+    std::memcpy(p, &checksum, sizeof(checksum));
+
+    QMutexLocker locker(&journalmutex);
+    QFile file(mpath);
+    if(!file.open(QIODevice::ReadWrite)){
+        qDebug()<<"特征库日志打开失败："<<file.errorString();
+        return false;
+    }
+    qint64 size = file.size();
+    if(size < HEADER_SIZE){
+        qint32 header[4] = {(qint32)JOURNAL_MAGIC, (qint32)JOURNAL_VERSION, mdim, 0};
+        file.resize(0);
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        size = HEADER_SIZE;
+    }else if((size - HEADER_SIZE) % record_size() != 0){
+        size = HEADER_SIZE + (size - HEADER_SIZE) / record_size() * record_size();
+        file.resize(size);
+    }
+    file.seek(size);
+    if(file.write(record) != record.size() || !file.flush()){
+        qDebug()<<"特征库日志写入失败："<<file.errorString();
+        return false;
+    }
+    return true;
+}
+
+int FaceJournal::record_count() const
+{
+    QMutexLocker locker(&journalmutex);
+    qint64 size = QFile(mpath).size();
+    if(size <= HEADER_SIZE) return 0;
+    return (int)((size - HEADER_SIZE) / record_size());
+}
+
+/**
+ * @brief 重放一个日志文件
+ * @details 遇到文件头不匹配时整个文件作废，遇到校验和错误或残缺的记录时停止，
+ *          之后的内容是断电时没有写完的部分
+ */
+int FaceJournal::replay(const QString &path, FaceGallery *gallery, std::unordered_set<int64_t> *removed) const
+{
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)) return 0;
+    qint32 header[4] = {0, 0, 0, 0};
+    if(file.read(reinterpret_cast<char*>(header), sizeof(header)) != sizeof(header)) return 0;
+    if((quint32)header[0] != JOURNAL_MAGIC || (quint32)header[1] != JOURNAL_VERSION){
+        qDebug()<<"特征库日志格式不正确："<<path;
+        return 0;
+    }
+    if(header[2] != mdim){
+        qDebug()<<"特征库日志维度不匹配："<<header[2]<<"期望"<<mdim;
+        return 0;
+    }
+
+    const qint64 size = record_size();
+    QByteArray record((int)size, 0);
+    int count = 0;
+    while(file.read(record.data(), size) == size){
+        const char *p = record.constData();
+        qint32 op;
+        qint64 faceid;
+        quint32 checksum;
+        std::memcpy(&op, p, sizeof(op));
+        std::memcpy(&faceid, p + sizeof(op), sizeof(faceid));
+        std::memcpy(&checksum, p + size - sizeof(checksum), sizeof(checksum));
+        if(checksum != record_checksum(p, size - sizeof(checksum))){
+            qDebug()<<"特征库日志第"<<count + 1<<"条记录损坏，忽略之后的内容："<<path;
+            break;
+        }
+        const float *feature = reinterpret_cast<const float*>(p + sizeof(op) + sizeof(faceid));
+        if(op == OP_ADD){
+            // 记录在内存中的位置不一定按float对齐，复制后再入库
+            std::vector<float> vec(mdim);
+            std::memcpy(vec.data(), feature, mdim * sizeof(float));
+            gallery->add(faceid, vec.data());
+            if(removed != nullptr) removed->erase(faceid);
+        }else if(op == OP_REMOVE){
+            gallery->remove(faceid);
+            if(removed != nullptr) removed->insert(faceid);
+        }
+        count++;
+    }
+    return count;
+}
+
+QString FaceJournal::snapshot_file(const QString &snapshot)
+{
+    QMutexLocker locker(&journalmutex);
+    return generation_file(snapshot, current_generation(snapshot));
+}
+
+bool FaceJournal::switch_generation(const QString &snapshot, int generation)
+{
+    QSaveFile file(pointer_file(snapshot));
+    if(!file.open(QIODevice::WriteOnly) || file.write(QByteArray::number(generation)) < 0 || !file.commit()){
+        qDebug()<<"特征库快照指针保存失败："<<file.errorString();
+        return false;
+    }
+    remove_stale_generations(snapshot, generation);
+    return true;
+}
+
+/**
+ * @brief 映射快照并重放日志
+ * @details 1. 映射之前删除旧的快照，这时它们一定没有被本进程映射
+ *          2. 校验必须在重放之前：重放只修改增量，快照映射的特征矩阵始终是文件的原样，
+ *             校验读取的正是查询时使用的数据
+ */
+bool FaceJournal::load(FaceGallery &base, FaceGallery &added, std::unordered_set<int64_t> &removed,
+                       const QString &snapshot, bool verify, QString *generation) const
+{
+    QMutexLocker locker(&journalmutex);
+    const int current = current_generation(snapshot);
+    remove_stale_generations(snapshot, current);
+    const QString path = generation_file(snapshot, current);
+    if(generation != nullptr) *generation = path;
+    bool verified = true;
+    if(base.load(path) && verify && !base.verify()){
+        qDebug()<<"特征库快照校验失败，不使用该快照："<<path;
+        base = FaceGallery(base.dimension());
+        verified = false;
+    }
+    // 待合并日志中的记录早于当前日志，必须先重放
+    int count = replay(mcompacting, &added, &removed);
+    count += replay(mpath, &added, &removed);
+    if(count > 0){
+        qDebug()<<"重放特征库日志："<<count<<"条记录";
+    }
+    return verified;
+}
+
+bool FaceJournal::replay_pending(const QString &snapshot, const QString &generation, FaceGallery &added,
+                                 std::unordered_set<int64_t> &removed) const
+{
+    QMutexLocker locker(&journalmutex);
+    if(generation_file(snapshot, current_generation(snapshot)) != generation) return false;
+    replay(mcompacting, &added, &removed);
+    replay(mpath, &added, &removed);
+    return true;
+}
+
+/**
+ * @brief 压缩日志
+ * @details 1. 在锁内把当前日志改名为待合并日志，之后的注册写入新的日志文件
+ *          2. 后台线程映射当前一代快照，把待合并日志重放进增量，按行流式写出下一代快照，
+ *             当前一代保持不变，运行中的服务器可以继续映射它
+ *          3. 新一代保存成功后在锁内切换指针、删除待合并日志；保存失败时保留，下次启动仍会重放
+ *          4. 切换成功后在锁外调用done，调用方据此把内存中的基础特征库切换到新一代
+ *          新快照只由磁盘上的文件生成，与调用方内存中的特征库是否最新无关
+ *          load()在锁内依次读取快照和待合并日志，无论读到的是新快照还是旧快照，结果都完整
+ *          进程内同一时间只有一次压缩，正在压缩时返回false，记录留在日志中等下一次
+ */
+bool FaceJournal::compact(const QString &snapshot, const std::function<void(const QString &)> &done)
+{
+    {
+        QMutexLocker locker(&journalmutex);
+        if(compacting) return false;
+        // 上次压缩中途退出时留下的待合并日志先合并，当前日志留到下一次
+        if(!QFile::exists(mcompacting) && !QFile::rename(mpath, mcompacting)){
+            qDebug()<<"特征库日志改名失败："<<mpath;
+            return false;
+        }
+        compacting = true;
+        compactthreads++;
+    }
+
+    const FaceJournal journal = *this;
+    QThread *thread = QThread::create([journal, snapshot, done](){
+        QElapsedTimer timer;
+        timer.start();
+        // 压缩期间只有本线程切换指针，save_snapshot()会等待，读取当前一代和待合并日志都不需要持锁
+        const int generation = current_generation(snapshot);
+        const QString path = generation_file(snapshot, generation + 1);
+        int count = 0;
+        int total = 0;
+        bool saved = false;
+        {
+            FaceGallery base(journal.mdim);
+            FaceGallery added(journal.mdim);
+            std::unordered_set<int64_t> removed;
+            base.load(generation_file(snapshot, generation));
+            count = journal.replay(journal.mcompacting, &added, &removed);
+            saved = base.save(path, &added, &removed);
+            total = base.size() + added.size();
+            // 离开作用域时解除映射，之后才能删除这一代
+        }
+        bool switched = false;
+        {
+            QMutexLocker locker(&journalmutex);
+            switched = saved && switch_generation(snapshot, generation + 1);
+            if(switched){
+                QFile::remove(journal.mcompacting);
+                qDebug()<<"特征库日志压缩完成：合并"<<count<<"条记录，保存为"<<path<<"，约"<<total<<"张人脸，耗时"<<timer.elapsed()<<"毫秒";
+            }else{
+                QFile::remove(path);
+                qDebug()<<"特征库快照保存失败，保留待合并日志";
+            }
+            compacting = false;
+            compactdone.wakeAll();
+        }
+        // 回调中会获取调用方的锁，必须在journalmutex之外调用
+        if(switched && done) done(path);
+        QMutexLocker locker(&journalmutex);
+        compactthreads--;
+        compactdone.wakeAll();
+    });
+    QObject::connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+    thread->start();
+    return true;
+}
+
+void FaceJournal::wait_compaction()
+{
+    QMutexLocker locker(&journalmutex);
+    while(compactthreads > 0){
+        compactdone.wait(&journalmutex);
+    }
+}
+
+/**
+ * @brief 保存完整快照
+ * @details 写入和切换都在锁内完成，期间不能追加日志；只在启动时重建特征库用到，此时还没有注册请求
+ */
+bool FaceJournal::save_snapshot(const FaceGallery &gallery, const QString &snapshot)
+{
+    QMutexLocker locker(&journalmutex);
+    while(compacting){
+        compactdone.wait(&journalmutex);
+    }
+    const int generation = current_generation(snapshot) + 1;
+    const QString path = generation_file(snapshot, generation);
+    if(!gallery.save(path)) return false;
+    if(!switch_generation(snapshot, generation)){
+        QFile::remove(path);
+        return false;
+    }
+    // 快照已经包含全部人脸，日志中的记录不再需要
+    QFile::remove(mpath);
+    QFile::remove(mcompacting);
+    return true;
+}
@@ -0,0 +1,140 @@
+#ifndef FACEJOURNAL_H
+#define FACEJOURNAL_H
+
+#include "facegallery.h"
+#include <QString>
+#include <cstdint>
+#include <functional>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief 特征库变更日志
+ * @details 注册和删除人脸时只向日志末尾追加一条定长记录，不再重写整个特征库文件，
+ *          每次注册的文件写入量与人脸总数无关
+ *          - 启动时先映射特征库快照，再把日志中的记录重放进快照之外的增量，快照本身保持只读
+ *          - 记录数达到阈值后压缩：当前日志改名为待合并日志，新记录写入新日志，
+ *            后台线程把旧快照与待合并日志合并成新快照，完成后删除待合并日志
+ *          - 重放是幂等的，压缩中途退出时下次启动会再次重放待合并日志，不会丢失记录
+ *          - 每条记录带校验和，写入中途断电造成的残缺记录在重放时被忽略
+ *          - 快照按代保存：第N代写入快照路径加".N"后缀的新文件，再用QSaveFile改写".current"指针文件，
+ *            从不原地替换快照；没有指针文件时快照路径本身是第0代（旧版本留下的face.gallery）
+ * @note Windows上被映射的文件不能被替换或删除，运行中的服务器一直映射着启动时的那一代快照，
+ *       所以压缩和重建都写新的一代，只替换从不映射的指针文件；旧的一代在Linux上立即删除，
+ *       在Windows上删除失败时留到下次启动、映射之前再清理
+ * @note 同一进程内的多个FaceJournal对象共享一把互斥锁，可以在不同线程中使用
+ */
+class FaceJournal
+{
+public:
+    /**
+     * @brief 构造函数
+     * @param path 日志文件路径，待合并日志为path加".compacting"后缀
+     * @param dim 特征维度，与特征库一致
+     */
+    explicit FaceJournal(const QString &path = QString(), int dim = 0);
+
+    /**
+     * @brief 追加一条注册记录
+     * @param faceid 人脸ID
+     * @param feature 长度为dim的特征向量
+     */
+    bool append_add(int64_t faceid, const float *feature);
+
+    /**
+     * @brief 追加一条删除记录
+     * @param faceid 人脸ID
+     */
+    bool append_remove(int64_t faceid);
+
+    /**
+     * @brief 当前日志中的记录数，不含待合并日志
+     */
+    int record_count() const;
+
+    /**
+     * @brief 映射特征库快照并把日志重放进增量
+     * @param base 输出基础特征库，即映射的快照，之后不再修改
+     * @param added 输出快照之后注册的人脸
+     * @param removed 输出快照之后删除的人脸ID
+     * @param snapshot 快照文件路径，实际加载指针文件指向的那一代
+     * @param verify 是否在重放之前校验快照的特征矩阵
+     * @param generation 不为nullptr时输出加载的那一代快照的文件路径
+     * @return 快照校验失败时返回false，此时base为空，日志仍然重放
+     * @details 与后台压缩互斥，保证快照和待合并日志不会同时缺少同一批记录；
+     *          映射之前先清理上次没能删除的旧快照
+     */
+    bool load(FaceGallery &base, FaceGallery &added, std::unordered_set<int64_t> &removed,
+              const QString &snapshot, bool verify, QString *generation = nullptr) const;
+
+    /**
+     * @brief 重放还没有合并进指定一代快照的日志
+     * @param snapshot 快照文件路径
+     * @param generation 已经映射的那一代快照的文件路径
+     * @return 指针已经指向另一代时返回false，不重放
+     * @details 与压缩互斥，确认指针和重放在同一次加锁内完成
+     */
+    bool replay_pending(const QString &snapshot, const QString &generation, FaceGallery &added,
+                        std::unordered_set<int64_t> &removed) const;
+
+    /**
+     * @brief 在后台线程中把日志合并进新一代快照
+     * @param snapshot 快照文件路径
+     * @param done 新一代快照切换成功后在压缩线程中调用，参数为新一代的文件路径，可为空
+     * @return 上一次压缩尚未完成时返回false
+     */
+    bool compact(const QString &snapshot, const std::function<void(const QString &)> &done = nullptr);
+
+    /**
+     * @brief 等待进行中的压缩结束
+     * @details 包括done回调；退出前调用，压缩线程使用的静态锁和回调中的对象在此之后才能析构。
+     *          调用方不能持有done回调会获取的锁
+     */
+    static void wait_compaction();
+
+    /**
+     * @brief 把完整的特征库保存为新一代快照并清空日志
+     * @param gallery 完整的特征库
+     * @param snapshot 快照文件路径
+     * @details 等待正在进行的压缩结束，避免它之后再切换指针
+     */
+    bool save_snapshot(const FaceGallery &gallery, const QString &snapshot);
+
+    /**
+     * @brief 当前一代快照的文件路径
+     * @param snapshot 快照文件路径
+     * @return 指针文件指向的那一代，没有指针文件时为snapshot本身
+     */
+    static QString snapshot_file(const QString &snapshot);
+
+private:
+    /**
+     * @brief 把一个日志文件中的记录应用到特征库
+     * @param gallery 注册记录加入的特征库，删除记录同时从中删除
+     * @param removed 不为nullptr时记录删除的人脸ID，之后重新注册的ID从中去掉
+     * @return 应用的记录数
+     */
+    int replay(const QString &path, FaceGallery *gallery, std::unordered_set<int64_t> *removed) const;
+
+    /**
+     * @brief 追加一条记录
+     */
+    bool append(qint32 op, int64_t faceid, const float *feature);
+
+    /**
+     * @brief 把指针文件切换到第generation代并删除更早的快照
+     * @details 在journalmutex内调用
+     */
+    static bool switch_generation(const QString &snapshot, int generation);
+
+    /**
+     * @brief 每条记录的字节数
+     */
+    qint64 record_size() const;
+
+    QString mpath;          ///< 日志文件路径
+    QString mcompacting;    ///< 待合并日志路径
+    int mdim;               ///< 特征维度
+};
+
+#endif // FACEJOURNAL_H
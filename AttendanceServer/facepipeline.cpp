@@ -0,0 +1,241 @@
+#include "facepipeline.h"
+#include "serverconfig.h"
+#include "faceengineregistry.h"
+
+#include <algorithm>
+
+/**
+ * @brief 比对阶段一次最多合并的帧数
+ */
+static const int SEARCH_BATCH = 32;
+
+/**
+ * @brief FacePipeline构造函数
+ * @details 1. 各阶段之间的队列容量相同，取pipeline/queue_capacity
+ *          2. 按阶段顺序启动线程，检测、关键点和特征提取线程在自己的线程中取用引擎
+ *          3. 每个比对线程拥有一个只做比对的QFaceObject，特征库快照映射后在线程之间共享页缓存
+ */
+FacePipeline::FacePipeline(QObject *parent)
+    : QObject{parent}
+    , detectqueue(ServerConfig::pipeline_queue_capacity())
+    , landmarkqueue(ServerConfig::pipeline_queue_capacity())
+    , extractqueue(ServerConfig::pipeline_queue_capacity())
+    , searchqueue(ServerConfig::pipeline_queue_capacity())
+    , featuresize(FaceEngineRegistry::instance().feature_size())
+    , topk(ServerConfig::result_topk())
+    , maxage(ServerConfig::max_queue_age())
+{
+    const int detects = ServerConfig::pipeline_threads("detect");
+    const int landmarks = ServerConfig::pipeline_threads("landmark");
+    const int extracts = ServerConfig::pipeline_threads("extract");
+    const int searches = ServerConfig::pipeline_threads("search");
+
+    start_threads(detects, [this](){ detect_stage(); });
+    start_threads(landmarks, [this](){ landmark_stage(); });
+    start_threads(extracts, [this](){ extract_stage(); });
+    for(int i = 0; i < searches; i++){
+        searchers.push_back(new QFaceObject(nullptr, true));
+    }
+    for(int i = 0; i < searches; i++){
+        QFaceObject *searcher = searchers[i];
+        start_threads(1, [this, searcher](){ search_stage(searcher); });
+    }
+    stagesizes = {detects, landmarks, extracts, searches};
+    qDebug()<<"识别流水线线程数：检测"<<detects<<"关键点"<<landmarks<<"特征提取"<<extracts<<"比对"<<searches
+            <<"队列容量"<<ServerConfig::pipeline_queue_capacity();
+}
+
+/**
+ * @brief FacePipeline析构函数
+ * @details 从入口开始逐个阶段关闭队列并等待该阶段的线程退出，
+ *          上游退出之后下游才关闭，已经进入流水线的帧都会处理完
+ */
+FacePipeline::~FacePipeline()
+{
+    BoundedQueue<FramePtr> *queues[] = {&detectqueue, &landmarkqueue, &extractqueue, &searchqueue};
+    std::size_t next = 0;
+    for(std::size_t stage = 0; stage < stagesizes.size(); stage++){
+        queues[stage]->close();
+        for(int i = 0; i < stagesizes[stage]; i++, next++){
+            threads[next]->wait();
+            delete threads[next];
+        }
+    }
+    for(QFaceObject *searcher : searchers){
+        delete searcher;
+    }
+}
+
+template <typename Func>
+void FacePipeline::start_threads(int count, Func func)
+{
+    for(int i = 0; i < count; i++){
+        QThread *thread = QThread::create(func);
+        thread->start();
+        threads.push_back(thread);
+    }
+}
+
+/**
+ * @brief 提交一帧
+ * @details 入口队列满时说明流水线已经饱和，直接返回丢弃结果，由终端继续发送下一帧
+ *          cv::Mat按值保存，只增加引用计数，不复制像素数据
+ */
+void FacePipeline::submit(quint64 sessionid, quint64 requestid, const cv::Mat &faceImage, const cv::Rect &face,
+                          const QElapsedTimer &queued)
+{
+    FramePtr frame = std::make_shared<PipelineFrame>();
+    frame->sessionid = sessionid;
+    frame->requestid = requestid;
+    frame->image = faceImage;
+    frame->hint = face;
+    frame->submitted = queued;
+    if(!frame->submitted.isValid()) frame->submitted.start();
+    if(!detectqueue.try_push(frame)){
+        qDebug()<<"识别流水线已满，丢弃会话"<<sessionid<<"的请求"<<requestid;
+        frame->result.dropped = true;
+        emit send_result(sessionid, requestid, frame->result);
+    }
+}
+
+void FacePipeline::submit_feature(quint64 sessionid, quint64 requestid, const std::vector<float> &feature,
+                                  const QElapsedTimer &queued)
+{
+    FramePtr frame = std::make_shared<PipelineFrame>();
+    frame->sessionid = sessionid;
+    frame->requestid = requestid;
+    frame->feature = feature;
+    frame->submitted = queued;
+    if(!frame->submitted.isValid()) frame->submitted.start();
+    if((int)feature.size() != featuresize){
+        qDebug()<<"终端特征维度"<<feature.size()<<"与识别模型"<<featuresize<<"不一致";
+        finish(frame);
+        return;
+    }
+    if(!searchqueue.try_push(frame)){
+        qDebug()<<"比对队列已满，丢弃会话"<<sessionid<<"的请求"<<requestid;
+        frame->result.dropped = true;
+        finish(frame);
+    }
+}
+
+int FacePipeline::capacity() const
+{
+    int count = (int)stagesizes.size();
+    for(int size : stagesizes) count += size;
+    return count;
+}
+
+/**
+ * @brief 检测阶段
+ * @details 检测图像中的人脸，取面积最大的一张；没有人脸的帧直接结束，不进入后续阶段
+ *          终端给出了人脸框时按recognition/client_face的配置跳过检测或只检测人脸框附近
+ *          在入口队列中等待超过最长排队时间的帧直接丢弃
+ */
+void FacePipeline::detect_stage()
+{
+    std::shared_ptr<seeta::FaceDetector> detector = FaceEngineRegistry::instance().detector();
+    std::vector<FramePtr> items;
+    while(detectqueue.pop(items)){
+        const FramePtr &frame = items.front();
+        if(maxage > 0 && frame->submitted.elapsed() > maxage){
+            frame->result.dropped = true;
+            finish(frame);
+            continue;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        bool found = !frame->image.empty()
+                     && QFaceObject::locate_face(detector.get(), frame->image, frame->hint, frame->face);
+        frame->result.times.detect = timer.nsecsElapsed() / 1000;
+        frame->busy += frame->result.times.detect;
+        if(!found){
+            finish(frame);
+            continue;
+        }
+        landmarkqueue.push(frame);
+    }
+}
+
+/**
+ * @brief 关键点定位阶段
+ */
+void FacePipeline::landmark_stage()
+{
+    std::shared_ptr<seeta::FaceLandmarker> landmarker = FaceEngineRegistry::instance().landmarker();
+    std::vector<FramePtr> items;
+    while(landmarkqueue.pop(items)){
+        const FramePtr &frame = items.front();
+        QElapsedTimer timer;
+        timer.start();
+        frame->points.resize(landmarker->number());
+        landmarker->mark(QFaceObject::seeta_image(frame->image), frame->face, frame->points.data());
+        frame->result.times.landmark = timer.nsecsElapsed() / 1000;
+        frame->busy += frame->result.times.landmark;
+        extractqueue.push(frame);
+    }
+}
+
+/**
+ * @brief 特征提取阶段
+ * @details 提取完成后图像不再需要，提前释放以减少排队帧占用的内存
+ */
+void FacePipeline::extract_stage()
+{
+    std::shared_ptr<seeta::FaceRecognizer> recognizer = FaceEngineRegistry::instance().recognizer();
+    std::vector<FramePtr> items;
+    while(extractqueue.pop(items)){
+        const FramePtr &frame = items.front();
+        QElapsedTimer timer;
+        timer.start();
+        frame->feature.resize(featuresize);
+        bool ok = recognizer->Extract(QFaceObject::seeta_image(frame->image), frame->points.data(), frame->feature.data());
+        frame->image.release();
+        frame->result.times.extract = timer.nsecsElapsed() / 1000;
+        frame->busy += frame->result.times.extract;
+        if(!ok){
+            finish(frame);
+            continue;
+        }
+        searchqueue.push(frame);
+    }
+}
+
+/**
+ * @brief 特征比对阶段
+ * @details 每次取出队列中已有的全部特征（最多SEARCH_BATCH个）整批比对，再按相似度阈值判定结果
+ */
+void FacePipeline::search_stage(QFaceObject *searcher)
+{
+    std::vector<FramePtr> items;
+    std::vector<float> features;
+    while(searchqueue.pop(items, SEARCH_BATCH)){
+        QElapsedTimer timer;
+        timer.start();
+        features.resize(items.size() * featuresize);
+        for(std::size_t i = 0; i < items.size(); i++){
+            std::copy(items[i]->feature.begin(), items[i]->feature.end(), features.begin() + i * featuresize);
+        }
+        std::vector<std::vector<FaceMatch>> matches = searcher->search_features(features.data(), (int)items.size(), topk);
+        qint64 search = timer.nsecsElapsed() / 1000;
+        for(std::size_t i = 0; i < items.size(); i++){
+            FaceResult &result = items[i]->result;
+            result.matches.swap(matches[i]);
+            result.times.search = search;
+            items[i]->busy += search;
+            if(!result.matches.empty() && result.matches.front().similarity > QFaceObject::similarity_threshold()){
+                result.faceid = result.matches.front().faceid;
+            }
+            finish(items[i]);
+        }
+    }
+}
+
+void FacePipeline::finish(const FramePtr &frame)
+{
+    // total与工作池一致，只计各阶段实际处理的时间，其余都算作排队
+    FaceResult &result = frame->result;
+    result.times.total = frame->busy;
+    result.times.queue = std::max<qint64>(0, frame->submitted.nsecsElapsed() / 1000 - frame->busy);
+    emit send_result(frame->sessionid, frame->requestid, result);
+}
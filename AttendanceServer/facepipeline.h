@@ -0,0 +1,207 @@
+#ifndef FACEPIPELINE_H
+#define FACEPIPELINE_H
+
+#include "qfaceobject.h"
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <deque>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief 有界阻塞队列
+ * @details 流水线相邻两个阶段之间的缓冲区，队列满时生产者等待，下游阶段的速度自然限制上游
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(int capacity) : mcapacity(capacity), mclosed(false) {}
+
+    /**
+     * @brief 放入一项，队列满时等待
+     * @return 队列已关闭时返回false
+     */
+    bool push(const T &item)
+    {
+        QMutexLocker locker(&mmutex);
+        while(!mclosed && (int)mitems.size() >= mcapacity){
+            mnotfull.wait(&mmutex);
+        }
+        if(mclosed) return false;
+        mitems.push_back(item);
+        mnotempty.wakeOne();
+        return true;
+    }
+
+    /**
+     * @brief 放入一项，队列满时立即返回false
+     */
+    bool try_push(const T &item)
+    {
+        QMutexLocker locker(&mmutex);
+        if(mclosed || (int)mitems.size() >= mcapacity) return false;
+        mitems.push_back(item);
+        mnotempty.wakeOne();
+        return true;
+    }
+
+    /**
+     * @brief 取出至少一项、至多max项，队列空时等待
+     * @return 队列已关闭且为空时返回false
+     */
+    bool pop(std::vector<T> &items, int max = 1)
+    {
+        QMutexLocker locker(&mmutex);
+        while(!mclosed && mitems.empty()){
+            mnotempty.wait(&mmutex);
+        }
+        if(mitems.empty()) return false;
+        items.clear();
+        while(!mitems.empty() && (int)items.size() < max){
+            items.push_back(mitems.front());
+            mitems.pop_front();
+        }
+        mnotfull.wakeAll();
+        return true;
+    }
+
+    /**
+     * @brief 关闭队列，唤醒所有等待的线程
+     * @details 关闭后不能再放入，已有的项仍可取出
+     */
+    void close()
+    {
+        QMutexLocker locker(&mmutex);
+        mclosed = true;
+        mnotempty.wakeAll();
+        mnotfull.wakeAll();
+    }
+
+private:
+    QMutex mmutex;
+    QWaitCondition mnotempty;
+    QWaitCondition mnotfull;
+    std::deque<T> mitems;
+    int mcapacity;
+    bool mclosed;
+};
+
+/**
+ * @brief 流水线中的一帧
+ * @details 依次经过各阶段，每个阶段填写自己的输出和耗时
+ */
+struct PipelineFrame
+{
+    quint64 sessionid;              ///< 客户端会话ID
+    quint64 requestid;              ///< 会话内的请求ID
+    cv::Mat image;                  ///< 待识别的图像
+    cv::Rect hint;                  ///< 终端检测到的人脸框，没有时为空
+    SeetaRect face;                 ///< 检测阶段输出：面积最大的人脸
+    std::vector<SeetaPointF> points; ///< 关键点阶段输出：5个关键点
+    std::vector<float> feature;     ///< 特征提取阶段输出
+    FaceResult result;              ///< 识别结果
+    QElapsedTimer submitted;        ///< 进入流水线时开始计时
+    qint64 busy = 0;                ///< 各阶段实际处理的累计耗时
+};
+
+/**
+ * @brief 分阶段的人脸识别流水线
+ * @details 把一帧的识别拆成检测、关键点定位、特征提取和特征比对四个阶段，每个阶段运行在自己的线程组中，
+ *          阶段之间用有界队列连接：
+ *          - 不同的帧可以同时处于不同阶段，吞吐量取决于最慢的阶段而不是各阶段耗时之和
+ *          - 各阶段的线程数在server.ini中单独配置，给最慢的阶段多分配线程
+ *          - 每个检测、关键点和特征提取线程从FaceEngineRegistry取用自己的引擎
+ *          - 比对阶段每次取出队列中已有的全部特征，整批与特征库做一次矩阵乘法
+ *          - 入口队列满时新帧直接以丢弃结果返回，不阻塞UI线程；排队超过recognition/max_queue_age的帧不再检测
+ *          - 同一终端的新帧替换旧帧和recognition/admission_capacity由FaceWorkerPool在送入之前处理，
+ *            工作池让流水线中的帧数不超过capacity()，内部队列不会积压
+ *          识别结果通过send_result信号返回，与FaceWorkerPool的信号一致
+ */
+class FacePipeline : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief 构造函数
+     * @param parent 父对象指针
+     * @details 按server.ini的配置创建各阶段的线程并启动
+     */
+    explicit FacePipeline(QObject *parent = nullptr);
+
+    /**
+     * @brief 析构函数
+     * @details 依次关闭各阶段的队列，等待所有线程处理完已经进入的帧后退出
+     */
+    ~FacePipeline();
+
+    /**
+     * @brief 提交一帧
+     * @param sessionid 客户端会话ID
+     * @param requestid 会话内的请求ID
+     * @param faceImage 待识别的图像
+     * @param face 终端检测到的人脸框，没有时为空
+     * @param queued 在工作池准入队列中开始排队的计时器，未启动时从提交时开始计时
+     */
+    void submit(quint64 sessionid, quint64 requestid, const cv::Mat &faceImage, const cv::Rect &face = cv::Rect(),
+                const QElapsedTimer &queued = QElapsedTimer());
+
+    /**
+     * @brief 提交一个终端提取的特征
+     * @param sessionid 客户端会话ID
+     * @param requestid 会话内的请求ID
+     * @param feature 终端在本地提取的特征
+     * @param queued 在工作池准入队列中开始排队的计时器，未启动时从提交时开始计时
+     * @details 直接进入比对阶段的队列，队列满时以未识别结果返回
+     */
+    void submit_feature(quint64 sessionid, quint64 requestid, const std::vector<float> &feature,
+                        const QElapsedTimer &queued = QElapsedTimer());
+
+    /**
+     * @brief 流水线中同时容纳的帧数
+     * @details 每个线程处理一帧，每个阶段再有一帧排队，线程不会空等，新帧也不会在内部队列中积压
+     */
+    int capacity() const;
+
+signals:
+    /**
+     * @brief 发送识别结果信号
+     * @details 在比对线程中发出，跨线程排队到接收者所在线程
+     */
+    void send_result(quint64 sessionid, quint64 requestid, FaceResult result);
+
+private:
+    typedef std::shared_ptr<PipelineFrame> FramePtr;
+
+    void detect_stage();
+    void landmark_stage();
+    void extract_stage();
+    void search_stage(QFaceObject *searcher);
+
+    /**
+     * @brief 填写总耗时和排队时间并发出结果
+     */
+    void finish(const FramePtr &frame);
+
+    /**
+     * @brief 启动count个运行func的线程
+     */
+    template <typename Func>
+    void start_threads(int count, Func func);
+
+    BoundedQueue<FramePtr> detectqueue;     ///< 入口队列
+    BoundedQueue<FramePtr> landmarkqueue;   ///< 检测之后
+    BoundedQueue<FramePtr> extractqueue;    ///< 关键点定位之后
+    BoundedQueue<FramePtr> searchqueue;     ///< 特征提取之后
+    std::vector<QThread*> threads;          ///< 所有阶段的线程，按阶段顺序排列
+    std::vector<int> stagesizes;            ///< 每个阶段的线程数
+    std::vector<QFaceObject*> searchers;    ///< 比对线程各自的特征库对象
+    int featuresize;                        ///< 特征维度
+    int topk;                               ///< 识别结果中保留的候选数
+    qint64 maxage;                          ///< 最长排队时间，单位毫秒，0表示不限制
+};
+
+#endif // FACEPIPELINE_H
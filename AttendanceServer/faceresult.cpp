@@ -0,0 +1,16 @@
+#include "faceresult.h"
+
+#include <QStringList>
+
+QString FaceResult::json_fields() const
+{
+    QStringList list;
+    for(const FaceMatch &match : matches){
+        list << QString("{\"faceID\":%1,\"similarity\":%2}").arg(match.faceid).arg(match.similarity, 0, 'f', 4);
+    }
+    return QString("\"faceID\":%1,\"matches\":[%2],\"timings\":{\"queue\":%3,\"detect\":%4,\"landmark\":%5,"
+                   "\"extract\":%6,\"search\":%7,\"total\":%8}")
+            .arg(faceid).arg(list.join(","))
+            .arg(times.queue).arg(times.detect).arg(times.landmark)
+            .arg(times.extract).arg(times.search).arg(times.total);
+}
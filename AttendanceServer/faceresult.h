@@ -0,0 +1,44 @@
+#ifndef FACERESULT_H
+#define FACERESULT_H
+
+#include "facegallery.h"
+#include <QString>
+#include <QMetaType>
+#include <vector>
+
+/**
+ * @brief 一次识别各阶段的耗时，单位微秒
+ * @details 批量比对时search为整批比对的耗时，同一批中的请求共享这一数值
+ */
+struct FaceStageTimes
+{
+    qint64 queue = 0;       ///< 在工作对象队列中等待的时间
+    qint64 detect = 0;      ///< 人脸检测
+    qint64 landmark = 0;    ///< 关键点定位
+    qint64 extract = 0;     ///< 特征提取
+    qint64 search = 0;      ///< 特征比对
+    qint64 total = 0;       ///< 从开始处理到得出结果，不含排队
+};
+
+/**
+ * @brief 人脸识别结果
+ * @details 除了判定结果外还保留前k个候选及其相似度，以及各阶段耗时，
+ *          后续的多帧融合、结果缓存等处理可以直接使用，无需重新识别
+ */
+struct FaceResult
+{
+    int64_t faceid = -1;            ///< 相似度超过阈值的最佳匹配，未识别为-1
+    std::vector<FaceMatch> matches; ///< 前k个候选，按相似度从高到低排列，没有检测到人脸时为空
+    FaceStageTimes times;           ///< 各阶段耗时
+    bool dropped = false;           ///< 帧在识别之前被丢弃：同一终端有更新的帧、队列已满或排队超时
+
+    /**
+     * @brief 生成应答JSON中的识别结果字段
+     * @return 形如"faceID":3,"matches":[...],"timings":{...}的片段，不含外层花括号
+     */
+    QString json_fields() const;
+};
+
+Q_DECLARE_METATYPE(FaceResult)
+
+#endif // FACERESULT_H
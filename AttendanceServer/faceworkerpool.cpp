@@ -0,0 +1,323 @@
+#include "faceworkerpool.h"
+#include "serverconfig.h"
+
+#include <QStringList>
+#include <QMutexLocker>
+#include <memory>
+
+/**
+ * @brief 吞吐量统计窗口
+ * @details 每完成这么多次识别输出一次吞吐量和各工作线程的分担情况
+ */
+static const quint64 STAT_WINDOW = 200;
+
+/**
+ * @brief 扩展性评估中每种线程数识别的总帧数
+ */
+static const int SCALING_FRAMES = 256;
+
+/**
+ * @brief FaceWorkerPool构造函数
+ * @param workercount 工作线程数量
+ * @param parent 父对象指针
+ * @details 1. 创建workercount个QFaceObject，每个对象加载自己的SeetaFace引擎
+ *          2. 为每个对象创建独立线程，并把对象移动到该线程中执行
+ *          3. 关联识别结果信号，结果在本对象所在线程（UI线程）中汇总
+ *          使用流水线时只建立一个准入队列，流水线每完成一帧就从中补充一帧
+ */
+FaceWorkerPool::FaceWorkerPool(int workercount, QObject *parent)
+    : QObject{parent}
+    , pipeline(nullptr)
+    , queuedcount(0)
+    , capacity(ServerConfig::admission_capacity())
+    , maxage(ServerConfig::max_queue_age())
+    , replacedcount(0)
+    , overflowcount(0)
+    , expiredcount(0)
+    , nextworker(0)
+    , statcount(0)
+{
+    stattimer.start();
+    if(ServerConfig::pipeline_enabled()){
+        pipeline = new FacePipeline(this);
+        connect(pipeline,&FacePipeline::send_result,this,[this](quint64 sessionid, quint64 requestid, FaceResult result){
+            worker_done(0, sessionid, requestid, result);
+            feed_pipeline();
+        });
+        pending.append(0);
+        completed.append(0);
+        queues.append(std::vector<FaceRequest>());
+        return;
+    }
+    if(workercount < 1) workercount = 1;
+    for(int i = 0; i < workercount; i++){
+        QFaceObject *worker = new QFaceObject();
+        QThread *thread = new QThread();
+        // 将耗时的人脸识别计算放到工作线程，多个线程同时占用多个CPU核心
+        worker->moveToThread(thread);
+        thread->start();
+        // 结果信号跨线程排队回到工作池所在线程，先记账再转发
+        connect(worker,&QFaceObject::send_result,this,[this,i](quint64 sessionid, quint64 requestid, FaceResult result){
+            worker_done(i, sessionid, requestid, result);
+        });
+        workers.append(worker);
+        threads.append(thread);
+        pending.append(0);
+        completed.append(0);
+        queues.append(std::vector<FaceRequest>());
+    }
+    qDebug()<<"人脸识别工作线程数量："<<workercount;
+}
+
+FaceWorkerPool::~FaceWorkerPool()
+{
+    // 先停止所有线程的事件循环，再释放工作对象
+    for(QThread *thread : threads){
+        thread->quit();
+    }
+    for(int i = 0; i < threads.size(); i++){
+        threads[i]->wait();
+        delete workers[i];
+        delete threads[i];
+    }
+}
+
+int FaceWorkerPool::worker_count() const
+{
+    return workers.size();
+}
+
+/**
+ * @brief 分发人脸查询请求
+ * @param sessionid 客户端会话ID
+ * @param requestid 会话内的请求ID
+ * @param faceImage 待识别的人脸图像
+ * @param face 终端检测到的人脸框，随请求交给工作对象
+ * @details 从轮询起点开始选择排队数最少的工作对象，把请求放入其队列
+ *          队列原本为空时通过排队调用在其线程中执行drain_queue，否则由已投递的任务一并处理，
+ *          这样工作对象忙碌时累积的多帧会合并为一批比对
+ *          cv::Mat按值保存，只增加引用计数，不复制像素数据；入队时开始计时，用于统计排队耗时
+ */
+void FaceWorkerPool::face_query(quint64 sessionid, quint64 requestid, cv::Mat &faceImage, cv::Rect face)
+{
+    FaceRequest request{sessionid, requestid, faceImage, face, std::vector<float>(), QElapsedTimer()};
+    dispatch(request);
+}
+
+/**
+ * @brief 分发终端特征查询请求
+ * @details 终端已经完成了检测和特征提取，请求只占用工作对象一次比对的时间
+ */
+void FaceWorkerPool::face_search(quint64 sessionid, quint64 requestid, std::vector<float> feature)
+{
+    FaceRequest request{sessionid, requestid, cv::Mat(), cv::Rect(), std::move(feature), QElapsedTimer()};
+    dispatch(request);
+}
+
+/**
+ * @brief 准入并分发一个请求
+ * @details 1. 同一终端的旧帧还在队列中时，新帧原地替换旧帧，沿用其位置和工作对象
+ *          2. 队列已满时先丢弃等待最久的帧（各队列按先后排列，只需比较队首）
+ *          3. 选择排队数最少的工作对象放入新帧
+ *          被丢弃的帧在解锁后返回结果；使用流水线时只有一个准入队列，放入后直接尝试送入流水线
+ */
+void FaceWorkerPool::dispatch(FaceRequest &request)
+{
+    std::vector<std::pair<int, FaceRequest>> dropped;
+    int best = -1;
+    bool idle = false;
+    {
+        QMutexLocker locker(&queuemutex);
+        request.queued.start();
+        for(std::vector<FaceRequest> &queue : queues){
+            for(FaceRequest &old : queue){
+                if(old.sessionid != request.sessionid) continue;
+                // 被替换的帧仍占着该工作对象的排队计数，由新帧继承
+                dropped.emplace_back(-1, std::move(old));
+                old = std::move(request);
+                replacedcount++;
+                break;
+            }
+            if(!dropped.empty()) break;
+        }
+        if(dropped.empty()){
+            if(queuedcount >= capacity){
+                int oldest = -1;
+                for(int i = 0; i < queues.size(); i++){
+                    if(queues[i].empty()) continue;
+                    if(oldest < 0 || queues[i].front().queued.elapsed() > queues[oldest].front().queued.elapsed()) oldest = i;
+                }
+                if(oldest >= 0){
+                    dropped.emplace_back(oldest, std::move(queues[oldest].front()));
+                    queues[oldest].erase(queues[oldest].begin());
+                    queuedcount--;
+                    overflowcount++;
+                }
+            }
+            best = nextworker;
+            for(int k = 1; k < queues.size(); k++){
+                int i = (nextworker + k) % queues.size();
+                if(pending[i] < pending[best]) best = i;
+            }
+            nextworker = (best + 1) % queues.size();
+            pending[best]++;
+            idle = queues[best].empty();
+            queues[best].push_back(std::move(request));
+            queuedcount++;
+        }
+    }
+    for(const std::pair<int, FaceRequest> &item : dropped){
+        drop_request(item.first, item.second.sessionid, item.second.requestid);
+    }
+    if(pipeline != nullptr){
+        feed_pipeline();
+    }else if(idle){
+        QMetaObject::invokeMethod(workers[best],[this,best](){
+            drain_queue(best);
+        },Qt::QueuedConnection);
+    }
+}
+
+/**
+ * @brief 取出工作对象队列中的全部请求并按批处理
+ * @details 排队超过最长排队时间的帧不再识别，回到工作池所在线程返回丢弃结果
+ */
+void FaceWorkerPool::drain_queue(int index)
+{
+    std::vector<FaceRequest> batch;
+    {
+        QMutexLocker locker(&queuemutex);
+        batch.swap(queues[index]);
+        queuedcount -= (int)batch.size();
+    }
+    if(maxage > 0){
+        std::vector<FaceRequest> fresh;
+        fresh.reserve(batch.size());
+        for(FaceRequest &request : batch){
+            if(request.queued.elapsed() <= maxage){
+                fresh.push_back(std::move(request));
+                continue;
+            }
+            quint64 sessionid = request.sessionid;
+            quint64 requestid = request.requestid;
+            QMetaObject::invokeMethod(this,[this,index,sessionid,requestid](){
+                expiredcount++;
+                drop_request(index, sessionid, requestid);
+            },Qt::QueuedConnection);
+        }
+        batch.swap(fresh);
+    }
+    if(batch.empty()) return;
+    workers[index]->face_query_requests(batch);
+}
+
+/**
+ * @brief 把准入队列中的请求送入流水线
+ * @details pending[0]减去准入队列的长度就是流水线中的帧数；流水线每完成一帧都会再调用一次，
+ *          所以准入队列中的帧只在流水线有空位时才开始计算排队超时之后的去留
+ */
+void FaceWorkerPool::feed_pipeline()
+{
+    const int window = pipeline->capacity();
+    while(true){
+        FaceRequest request;
+        {
+            QMutexLocker locker(&queuemutex);
+            if(queues[0].empty() || pending[0] - (int)queues[0].size() >= window) return;
+            request = std::move(queues[0].front());
+            queues[0].erase(queues[0].begin());
+            queuedcount--;
+        }
+        if(maxage > 0 && request.queued.elapsed() > maxage){
+            expiredcount++;
+            drop_request(0, request.sessionid, request.requestid);
+            continue;
+        }
+        if(!request.feature.empty()){
+            pipeline->submit_feature(request.sessionid, request.requestid, request.feature, request.queued);
+        }else{
+            pipeline->submit(request.sessionid, request.requestid, request.image, request.face, request.queued);
+        }
+    }
+}
+
+void FaceWorkerPool::drop_request(int index, quint64 sessionid, quint64 requestid)
+{
+    if(index >= 0) pending[index]--;
+    FaceResult result;
+    result.dropped = true;
+    emit send_result(sessionid, requestid, result);
+}
+
+/**
+ * @brief 工作对象完成一次识别
+ * @param index 工作对象下标
+ * @param sessionid 客户端会话ID
+ * @param requestid 会话内的请求ID
+ * @param result 识别结果
+ */
+void FaceWorkerPool::worker_done(int index, quint64 sessionid, quint64 requestid, const FaceResult &result)
+{
+    if(index >= 0){
+        pending[index]--;
+        completed[index]++;
+    }
+
+    // 吞吐量统计：用于确认增加工作线程后吞吐量是否随核心数线性增长
+    if(++statcount >= STAT_WINDOW){
+        double seconds = stattimer.elapsed() / 1000.0;
+        QStringList share;
+        for(quint64 n : completed) share << QString::number(n);
+        qDebug()<<"识别吞吐量："<<(seconds > 0 ? statcount / seconds : 0.0)<<"帧/秒"
+                <<"工作线程"<<workers.size()<<"各线程累计完成"<<share.join(",")
+                <<"累计丢弃：被新帧替换"<<replacedcount<<"队列满"<<overflowcount<<"排队超时"<<expiredcount;
+        statcount = 0;
+        stattimer.restart();
+    }
+
+    emit send_result(sessionid, requestid, result);
+}
+
+/**
+ * @brief 识别吞吐量扩展性评估
+ * @details 对每种线程数n：
+ *          1. 创建n个QFaceObject，每个从注册表取用一组引擎
+ *          2. 每个线程先识别一帧预热，把特征库页面和引擎的内部缓冲区准备好
+ *          3. 第t个线程依次识别下标为t、t+n、t+2n……的帧，计时从所有线程启动到全部结束
+ *          每帧单独识别，与工作池逐帧处理的代价相同，不受批量合并的影响
+ */
+void FaceWorkerPool::benchmark_scaling(const std::vector<cv::Mat> &frames, int maxworkers)
+{
+    if(frames.empty() || maxworkers < 1) return;
+    qDebug()<<"识别扩展性评估："<<frames.size()<<"张图像，每轮"<<SCALING_FRAMES<<"帧，工作线程1到"<<maxworkers;
+    double single = 0;
+    for(int n = 1; n <= maxworkers; n++){
+        std::vector<std::unique_ptr<QFaceObject>> objects;
+        for(int t = 0; t < n; t++){
+            objects.emplace_back(new QFaceObject());
+            objects.back()->face_query_batch({frames[t % frames.size()]});
+        }
+
+        std::vector<QThread*> pool;
+        QElapsedTimer timer;
+        timer.start();
+        for(int t = 0; t < n; t++){
+            QFaceObject *object = objects[t].get();
+            QThread *thread = QThread::create([object, t, n, &frames](){
+                for(int i = t; i < SCALING_FRAMES; i += n){
+                    object->face_query_batch({frames[i % frames.size()]});
+                }
+            });
+            thread->start();
+            pool.push_back(thread);
+        }
+        for(QThread *thread : pool){
+            thread->wait();
+            delete thread;
+        }
+        const double seconds = timer.nsecsElapsed() / 1e9;
+        const double fps = seconds > 0 ? SCALING_FRAMES / seconds : 0.0;
+        if(n == 1) single = fps;
+        qDebug()<<"  工作线程"<<n<<"吞吐量"<<fps<<"帧/秒，加速比"<<(single > 0 ? fps / single : 0.0);
+    }
+}
@@ -0,0 +1,142 @@
+#ifndef FACEWORKERPOOL_H
+#define FACEWORKERPOOL_H
+
+#include "qfaceobject.h"
+#include "facepipeline.h"
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QVector>
+#include <QElapsedTimer>
+
+/**
+ * @brief 人脸识别工作池
+ * @details 创建N个QFaceObject，每个对象拥有独立的SeetaFace引擎并运行在独立线程中
+ *          AttendanceWin发出的查询请求由工作池分发给当前排队最少的工作对象，
+ *          工作对象忙碌期间到达的请求在其队列中累积，下一次一起按批处理
+ *          识别结果统一通过send_result信号返回，调用方无需关心由哪个线程完成
+ *          准入控制保证过载时的延迟有上限：
+ *          - 同一终端尚未开始识别的帧被它的新帧原地替换，只识别最新的一帧
+ *          - 尚未开始识别的帧总数不超过recognition/admission_capacity，超出时丢弃等待最久的帧
+ *          - 排队超过recognition/max_queue_age的帧在开始识别前丢弃
+ *          被丢弃的帧以dropped为true的结果返回，各类丢弃数随吞吐量统计输出
+ *          server.ini中开启recognition/pipeline时不创建工作对象，请求全部交给FacePipeline分阶段处理；
+ *          此时工作池只有一个准入队列，同样按上述规则替换、丢弃和过期，
+ *          流水线中的帧数达到FacePipeline::capacity()时新帧在准入队列中等待，不进入流水线内部的队列
+ */
+class FaceWorkerPool : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief 构造函数
+     * @param workercount 工作线程数量，至少为1，使用流水线时忽略
+     * @param parent 父对象指针
+     * @details 每个工作对象都会取用一组SeetaFace引擎，启动时间随数量线性增长
+     */
+    explicit FaceWorkerPool(int workercount, QObject *parent = nullptr);
+
+    /**
+     * @brief 析构函数
+     * @details 停止所有工作线程并释放工作对象
+     */
+    ~FaceWorkerPool();
+
+    /**
+     * @brief 获取工作线程数量
+     */
+    int worker_count() const;
+
+    /**
+     * @brief 识别吞吐量随工作线程数的扩展性评估
+     * @param frames 评估用的图像，循环使用直到凑满固定帧数
+     * @param maxworkers 评估的最大工作线程数
+     * @details 对1到maxworkers个工作线程，各自取用一组引擎，把同一组帧轮流分给各线程识别，
+     *          输出每种线程数下的帧/秒和相对单线程的加速比；在物理核心数以内应接近线性增长
+     *          评估期间加载的引擎留在注册表中，之后创建工作池时直接复用
+     */
+    static void benchmark_scaling(const std::vector<cv::Mat> &frames, int maxworkers);
+
+public slots:
+    /**
+     * @brief 人脸查询槽函数
+     * @param sessionid 客户端会话ID
+     * @param requestid 会话内的请求ID
+     * @param faceImage 待识别的人脸图像
+     * @param face 终端检测到的人脸框，没有时为空
+     * @details 选择排队请求最少的工作对象处理该帧，排队数相同时轮流分配
+     *          请求先放入该工作对象的队列，队列原本为空时才投递一次处理任务
+     */
+    void face_query(quint64 sessionid, quint64 requestid, cv::Mat& faceImage, cv::Rect face = cv::Rect());
+
+    /**
+     * @brief 终端特征查询槽函数
+     * @param sessionid 客户端会话ID
+     * @param requestid 会话内的请求ID
+     * @param feature 终端在本地提取的特征
+     * @details 跳过检测、关键点定位和特征提取，按与face_query相同的规则分发，直接参与比对
+     */
+    void face_search(quint64 sessionid, quint64 requestid, std::vector<float> feature);
+
+signals:
+    /**
+     * @brief 发送识别结果信号
+     * @param sessionid 客户端会话ID
+     * @param requestid 会话内的请求ID
+     * @param result 识别结果，result.faceid未识别为-1
+     */
+    void send_result(quint64 sessionid, quint64 requestid, FaceResult result);
+
+private:
+    /**
+     * @brief 把请求放入排队最少的工作对象的队列
+     */
+    void dispatch(FaceRequest &request);
+
+    /**
+     * @brief 把准入队列中的请求送入流水线
+     * @details 在工作池所在线程中调用，流水线中的帧数不超过FacePipeline::capacity()，
+     *          排队超时的请求在送入前丢弃
+     */
+    void feed_pipeline();
+
+    /**
+     * @brief 返回一个被丢弃的请求
+     * @param index 请求原本所在的工作对象下标，已经从排队计数中扣除时为-1
+     * @details 在工作池所在线程中调用，结果的dropped为true
+     */
+    void drop_request(int index, quint64 sessionid, quint64 requestid);
+
+    /**
+     * @brief 工作对象完成一次识别
+     * @param index 工作对象下标，来自流水线的结果为0
+     * @details 更新排队计数和吞吐量统计，并转发识别结果
+     */
+    void worker_done(int index, quint64 sessionid, quint64 requestid, const FaceResult &result);
+
+    /**
+     * @brief 取出工作对象队列中的全部请求并按批处理
+     * @param index 工作对象下标
+     * @details 在工作线程中执行
+     */
+    void drain_queue(int index);
+
+    FacePipeline *pipeline;        ///< 分阶段识别流水线，未开启时为nullptr
+    QVector<QFaceObject*> workers; ///< 工作对象，每个拥有独立的SeetaFace引擎
+    QVector<QThread*> threads;     ///< 工作线程，与workers一一对应
+    QVector<int> pending;          ///< 每个工作对象已分发但尚未完成的请求数，使用流水线时只有一项
+    QVector<std::vector<FaceRequest>> queues; ///< 每个工作对象尚未开始处理的请求，使用流水线时只有一个准入队列
+    QMutex queuemutex;             ///< 保护queues和queuedcount，分发在UI线程、取出在工作线程
+    int queuedcount;               ///< 所有工作对象队列中尚未开始处理的请求数
+    int capacity;                  ///< queuedcount的上限
+    qint64 maxage;                 ///< 最长排队时间，单位毫秒，0表示不限制
+    quint64 replacedcount;         ///< 被同一终端的新帧替换而丢弃的帧数
+    quint64 overflowcount;         ///< 队列满时丢弃的帧数
+    quint64 expiredcount;          ///< 排队超时丢弃的帧数
+    QVector<quint64> completed;    ///< 每个工作对象累计完成的请求数，用于统计负载是否均衡
+    int nextworker;                ///< 轮询起点，排队数相同时轮流分配
+    quint64 statcount;             ///< 当前统计窗口内完成的请求数
+    QElapsedTimer stattimer;       ///< 当前统计窗口的计时器
+};
+
+#endif // FACEWORKERPOOL_H
@@ -0,0 +1,61 @@
+#include "framepacket.h"
+
+#include <QDataStream>
+#include <QFloat16>
+
+bool FramePacket::parse(const QByteArray &data, FramePacket &packet)
+{
+    packet.face = cv::Rect();
+    packet.feature.clear();
+    packet.requestid = 0;
+    packet.binaryreply = false;
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_15);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    quint32 magic = 0;
+    stream>>magic;
+    if(stream.status() != QDataStream::Ok || magic != MAGIC){
+        // 旧终端：整帧都是JPEG数据
+        packet.image = data;
+        return true;
+    }
+
+    quint8 version = 0;
+    quint8 flags = 0;
+    stream>>version>>flags;
+    // 标志位决定之后的字段布局，不认识的标志位无法跳过，只能整包拒绝
+    if(version == VERSION_FACE_ONLY){
+        if(flags & ~FLAG_FACE) return false;
+    }else if(version != VERSION || (flags & ~KNOWN_FLAGS)){
+        return false;
+    }
+    packet.binaryreply = (flags & FLAG_BINARY_REPLY) != 0;
+    if(flags & FLAG_REQUEST_ID){
+        stream>>packet.requestid;
+    }
+    if(flags & FLAG_FACE){
+        qint32 x, y, width, height;
+        stream>>x>>y>>width>>height;
+        packet.face = cv::Rect(x, y, width, height);
+    }
+    if(flags & FLAG_FEATURE){
+        quint16 dim = 0;
+        stream>>dim;
+        if(dim == 0 || dim > MAX_FEATURE_SIZE) return false;
+        packet.feature.resize(dim);
+        for(float &value : packet.feature){
+            if(flags & FLAG_FP16){
+                qfloat16 half;
+                stream>>half;
+                value = half;
+            }else{
+                stream>>value;
+            }
+        }
+    }
+    if(stream.status() != QDataStream::Ok) return false;
+    // 包头之后的JPEG数据直接引用data，不复制
+    const int offset = (int)stream.device()->pos();
+    packet.image = QByteArray::fromRawData(data.constData() + offset, data.size() - offset);
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef FRAMEPACKET_H
+#define FRAMEPACKET_H
+
+#include <QByteArray>
+#include <opencv.hpp>
+
+/**
+ * @brief 终端上传的一帧
+ * @details 旧终端直接发送JPEG数据；新终端在JPEG数据前加一个包头，携带终端已经检测到的人脸框，
+ *          或者终端在本地提取好的人脸特征
+ *          包头格式（QDataStream，Qt_5_15，大端，浮点数为单精度）：
+ *          - quint32 标识"FAFR"
+ *          - quint8 版本，当前为2；第1版只有FLAG_FACE，服务器仍然接受
+ *          - quint8 标志位，带有该版本未定义的标志位时整包拒绝，不会把后面的字段错位解析
+ *          - 带FLAG_REQUEST_ID时为quint64请求ID，由终端分配，服务器在应答中原样返回
+ *          - 带FLAG_FACE时为qint32 x、y、width、height，坐标相对于JPEG图像
+ *          - 带FLAG_FEATURE时为quint16特征维度，之后是各维的值，带FLAG_FP16时每维为qfloat16，否则为float
+ *          - 其余字节是JPEG数据；带特征时是一张可以为空的小缩略图，只用于显示
+ *          JPEG数据总是以0xFFD8开头，与包头标识不会混淆，新旧终端可以同时连接
+ */
+struct FramePacket
+{
+    /**
+     * @brief 包头标识和版本号
+     */
+    static const quint32 MAGIC = 0x46414652; // "FAFR"
+    static const quint8 VERSION = 2;
+
+    /**
+     * @brief 第1版包头，只支持FLAG_FACE
+     */
+    static const quint8 VERSION_FACE_ONLY = 1;
+
+    /**
+     * @brief 标志位：带有终端检测到的人脸框
+     */
+    static const quint8 FLAG_FACE = 0x01;
+
+    /**
+     * @brief 标志位：带有终端提取的特征，服务器跳过检测、关键点定位和特征提取
+     */
+    static const quint8 FLAG_FEATURE = 0x02;
+
+    /**
+     * @brief 标志位：特征以半精度传输
+     */
+    static const quint8 FLAG_FP16 = 0x04;
+
+    /**
+     * @brief 标志位：带有终端分配的请求ID
+     * @details 会话收到带请求ID的帧后，之后的应答全部改为分帧格式，见ClientSession::send_response
+     */
+    static const quint8 FLAG_REQUEST_ID = 0x08;
+
+    /**
+     * @brief 标志位：终端希望接收二进制应答（见AttendanceReply），只在分帧应答的会话中生效
+     */
+    static const quint8 FLAG_BINARY_REPLY = 0x10;
+
+    /**
+     * @brief 当前版本定义的全部标志位
+     */
+    static const quint8 KNOWN_FLAGS = FLAG_FACE | FLAG_FEATURE | FLAG_FP16 | FLAG_REQUEST_ID | FLAG_BINARY_REPLY;
+
+    /**
+     * @brief 终端特征的最大维度
+     * @details 防止损坏的包头导致分配过大的内存
+     */
+    static const int MAX_FEATURE_SIZE = 4096;
+
+    QByteArray image;   ///< JPEG数据，引用parse()传入的数据，不拥有内存
+    cv::Rect face;      ///< 终端检测到的人脸框，没有时为空
+    std::vector<float> feature; ///< 终端提取的特征，没有时为空
+    quint64 requestid = 0;      ///< 终端分配的请求ID，0表示没有
+    bool binaryreply = false;   ///< 终端是否希望接收二进制应答
+
+    /**
+     * @brief 解析终端上传的数据
+     * @param data 会话拆出的一帧数据
+     * @param packet 输出
+     * @return 包头不完整、版本不支持或带有未知标志位时返回false；没有包头的数据整体作为JPEG数据
+     * @note packet.image不复制数据，只在data有效且未被修改期间可用
+     */
+    static bool parse(const QByteArray &data, FramePacket &packet);
+};
+
+#endif // FRAMEPACKET_H
@@ -0,0 +1,539 @@
+#include "hnswindex.h"
+
+#include <QSaveFile>
+#include <QFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <random>
+
+/**
+ * @brief 索引文件标识和版本号
+ */
+static const quint32 HNSW_MAGIC = 0x534E4846; // "FHNS"
+static const quint32 HNSW_VERSION = 1;
+
+/**
+ * @brief 索引文件中允许的最高层
+ * @details 随机层数的期望为ln(N)/ln(M)，百万人脸、M=2时也不到20层，超过上限的文件视为损坏
+ */
+static const int HNSW_MAX_LEVEL = 32;
+
+/**
+ * @brief 检查一个邻接表
+ * @param list 邻接表，第一个int为邻居数
+ * @param maxlinks 该层允许的最大邻居数
+ * @param level 邻接表所在的层
+ * @param levels 每个节点的最高层
+ * @return 邻居数超出上限、邻居越界或邻居不在这一层时返回false
+ */
+static bool valid_links(const int *list, int maxlinks, int level, const std::vector<int> &levels)
+{
+    if(list[0] < 0 || list[0] > maxlinks) return false;
+    for(int j = 1; j <= list[0]; j++){
+        const int neighbor = list[j];
+        if(neighbor < 0 || neighbor >= (int)levels.size() || levels[neighbor] < level) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 查询时的访问标记
+ * @details 每个线程一份，用递增的轮次号代替每次查询清零
+ */
+struct VisitedList
+{
+    std::vector<unsigned> marks;
+    unsigned round = 0;
+
+    void reset(int count)
+    {
+        if((int)marks.size() < count) marks.resize(count, 0);
+        if(++round == 0){
+            std::fill(marks.begin(), marks.end(), 0);
+            round = 1;
+        }
+    }
+    bool visit(int node)
+    {
+        if(marks[node] == round) return false;
+        marks[node] = round;
+        return true;
+    }
+};
+
+static VisitedList &visited_list()
+{
+    thread_local VisitedList list;
+    return list;
+}
+
+HnswIndex::HnswIndex(int m, int efconstruction)
+    : mm(std::max(2, m))
+    , mm0(2 * std::max(2, m))
+    , mefconstruction(std::max(efconstruction, std::max(2, m)))
+    , mefsearch(64)
+    , mlevelmult(1.0 / std::log((double)std::max(2, m)))
+    , mgallery(nullptr)
+    , mentry(-1)
+    , mmaxlevel(-1)
+    , mrng(0x9E3779B97F4A7C15ULL)
+    , mstop(nullptr)
+{
+}
+
+void HnswIndex::set_ef_search(int ef)
+{
+    mefsearch = std::max(1, ef);
+}
+
+int HnswIndex::ef_search() const
+{
+    return mefsearch;
+}
+
+int HnswIndex::m() const
+{
+    return mm;
+}
+
+int HnswIndex::size() const
+{
+    return (int)mlevels.size();
+}
+
+float HnswIndex::similarity(const float *query, int node) const
+{
+    return FaceGallery::dot(query, mgallery->row(node), mgallery->dimension());
+}
+
+/**
+ * @brief 随机生成新节点的最高层
+ * @details 层数服从参数为1/ln(M)的几何分布，使用splitmix64生成均匀随机数
+ */
+int HnswIndex::random_level()
+{
+    quint64 z = (mrng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    double u = ((z >> 11) + 1.0) / 9007199254740993.0; // (0,1]
+    return (int)(-std::log(u) * mlevelmult);
+}
+
+const int *HnswIndex::links(int node, int level) const
+{
+    if(level == 0) return mlinks0.data() + (std::size_t)node * (mm0 + 1);
+    return mupper[node].data() + (std::size_t)(level - 1) * (mm + 1);
+}
+
+int *HnswIndex::links(int node, int level)
+{
+    if(level == 0) return mlinks0.data() + (std::size_t)node * (mm0 + 1);
+    return mupper[node].data() + (std::size_t)(level - 1) * (mm + 1);
+}
+
+int HnswIndex::max_links(int level) const
+{
+    return level == 0 ? mm0 : mm;
+}
+
+/**
+ * @brief 在某一层做束搜索
+ * @param query 归一化的查询向量
+ * @param entry 入口节点
+ * @param ef 候选集大小
+ * @param level 层号
+ * @return 找到的最多ef个节点，按相似度从高到低排序
+ */
+std::vector<HnswIndex::Candidate> HnswIndex::search_layer(const float *query, int entry, int ef, int level) const
+{
+    VisitedList &visited = visited_list();
+    visited.reset(size());
+
+    // candidates：待扩展的节点，相似度最高的在堆顶
+    // results：当前最好的ef个节点，相似度最低的在堆顶
+    std::priority_queue<Candidate> candidates;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> results;
+
+    float s = similarity(query, entry);
+    visited.visit(entry);
+    candidates.push(Candidate(s, entry));
+    results.push(Candidate(s, entry));
+
+    while(!candidates.empty()){
+        Candidate current = candidates.top();
+        if((int)results.size() >= ef && current.first < results.top().first) break;
+        candidates.pop();
+
+        const int *nb = links(current.second, level);
+        for(int i = 1; i <= nb[0]; i++){
+            int node = nb[i];
+            if(!visited.visit(node)) continue;
+            float sim = similarity(query, node);
+            if((int)results.size() < ef || sim > results.top().first){
+                candidates.push(Candidate(sim, node));
+                results.push(Candidate(sim, node));
+                if((int)results.size() > ef) results.pop();
+            }
+        }
+    }
+
+    std::vector<Candidate> out;
+    out.reserve(results.size());
+    while(!results.empty()){
+        out.push_back(results.top());
+        results.pop();
+    }
+    std::reverse(out.begin(), out.end());
+    return out;
+}
+
+/**
+ * @brief 启发式邻居选择
+ * @param candidates 候选节点及其与基准节点的相似度
+ * @param count 最多选择的邻居数
+ * @details 候选按与基准节点的相似度从高到低考察，如果某个候选与已选邻居的相似度比与基准节点更高，
+ *          说明它可以经由已选邻居到达，跳过它，使邻居分布在不同方向上，提高图的连通性
+ */
+std::vector<int> HnswIndex::select_neighbors(std::vector<Candidate> candidates, int count) const
+{
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b){
+        return a.first > b.first;
+    });
+    std::vector<int> selected;
+    selected.reserve(count);
+    for(const Candidate &c : candidates){
+        if((int)selected.size() >= count) break;
+        const float *vec = mgallery->row(c.second);
+        bool good = true;
+        for(int s : selected){
+            if(FaceGallery::dot(vec, mgallery->row(s), mgallery->dimension()) > c.first){
+                good = false;
+                break;
+            }
+        }
+        if(good) selected.push_back(c.second);
+    }
+    return selected;
+}
+
+/**
+ * @brief 建立双向连接
+ * @details 邻居的邻接表已满时，重新对其邻居做启发式选择
+ */
+void HnswIndex::connect(int node, int level, const std::vector<int> &neighbors)
+{
+    int *own = links(node, level);
+    own[0] = (int)neighbors.size();
+    std::copy(neighbors.begin(), neighbors.end(), own + 1);
+
+    const int maxcount = max_links(level);
+    for(int nb : neighbors){
+        int *list = links(nb, level);
+        if(list[0] < maxcount){
+            list[++list[0]] = node;
+            continue;
+        }
+        const float *base = mgallery->row(nb);
+        std::vector<Candidate> candidates;
+        candidates.reserve(list[0] + 1);
+        candidates.push_back(Candidate(FaceGallery::dot(base, mgallery->row(node), mgallery->dimension()), node));
+        for(int i = 1; i <= list[0]; i++){
+            candidates.push_back(Candidate(FaceGallery::dot(base, mgallery->row(list[i]), mgallery->dimension()), list[i]));
+        }
+        std::vector<int> kept = select_neighbors(candidates, maxcount);
+        list[0] = (int)kept.size();
+        std::copy(kept.begin(), kept.end(), list + 1);
+    }
+}
+
+/**
+ * @brief 插入一个节点
+ * @param node 节点号，即特征库中的行号
+ */
+void HnswIndex::insert(int node)
+{
+    int level = random_level();
+    mlevels[node] = level;
+    mupper[node].assign((std::size_t)level * (mm + 1), 0);
+    links(node, 0)[0] = 0;
+
+    if(mentry < 0){
+        mentry = node;
+        mmaxlevel = level;
+        return;
+    }
+
+    const float *query = mgallery->row(node);
+    int entry = mentry;
+    float best = similarity(query, entry);
+    // 在高于新节点层数的各层上贪心下降
+    for(int l = mmaxlevel; l > level; l--){
+        bool changed = true;
+        while(changed){
+            changed = false;
+            const int *nb = links(entry, l);
+            for(int i = 1; i <= nb[0]; i++){
+                float s = similarity(query, nb[i]);
+                if(s > best){
+                    best = s;
+                    entry = nb[i];
+                    changed = true;
+                }
+            }
+        }
+    }
+    // 在新节点所在的各层上搜索并连接邻居
+    for(int l = std::min(level, mmaxlevel); l >= 0; l--){
+        std::vector<Candidate> candidates = search_layer(query, entry, mefconstruction, l);
+        std::vector<int> neighbors = select_neighbors(candidates, mm);
+        connect(node, l, neighbors);
+        entry = candidates.front().second;
+    }
+    if(level > mmaxlevel){
+        mentry = node;
+        mmaxlevel = level;
+    }
+}
+
+void HnswIndex::set_stop_flag(const std::atomic<bool> *stop)
+{
+    mstop = stop;
+}
+
+bool HnswIndex::build(const FaceGallery *gallery)
+{
+    mgallery = gallery;
+    mentry = -1;
+    mmaxlevel = -1;
+    mrng = 0x9E3779B97F4A7C15ULL;
+    mlevels.clear();
+    mlinks0.clear();
+    mupper.clear();
+    return append();
+}
+
+bool HnswIndex::append()
+{
+    if(mgallery == nullptr) return false;
+    int oldcount = size();
+    int newcount = mgallery->size();
+    if(newcount < oldcount) return false;
+    mlevels.resize(newcount, 0);
+    mupper.resize(newcount);
+    mlinks0.resize((std::size_t)newcount * (mm0 + 1), 0);
+    for(int node = oldcount; node < newcount; node++){
+        if(mstop != nullptr && mstop->load(std::memory_order_relaxed)) return false;
+        insert(node);
+    }
+    return true;
+}
+
+int64_t HnswIndex::search(const float *feature, float *similarity) const
+{
+    std::vector<FaceMatch> results = search_knn(feature, 1, mefsearch);
+    if(similarity) *similarity = results.empty() ? 0 : results.front().similarity;
+    return results.empty() ? -1 : results.front().faceid;
+}
+
+std::vector<FaceMatch> HnswIndex::search_topk(const float *feature, int k) const
+{
+    return search_knn(feature, k, std::max(mefsearch, k));
+}
+
+std::vector<FaceMatch> HnswIndex::search_knn(const float *feature, int k, int ef) const
+{
+    std::vector<FaceMatch> matches;
+    if(mgallery == nullptr || mentry < 0 || k <= 0) return matches;
+
+    std::vector<float> query(feature, feature + mgallery->dimension());
+    if(!FaceGallery::normalize(query.data(), mgallery->dimension())) return matches;
+
+    // 从最高层贪心下降到第1层
+    int entry = mentry;
+    float best = similarity(query.data(), entry);
+    for(int l = mmaxlevel; l > 0; l--){
+        bool changed = true;
+        while(changed){
+            changed = false;
+            const int *nb = links(entry, l);
+            for(int i = 1; i <= nb[0]; i++){
+                float s = similarity(query.data(), nb[i]);
+                if(s > best){
+                    best = s;
+                    entry = nb[i];
+                    changed = true;
+                }
+            }
+        }
+    }
+    // 在第0层做束搜索，结果已按相似度从高到低排列
+    std::vector<Candidate> results = search_layer(query.data(), entry, std::max(ef, k), 0);
+    int n = std::min(k, (int)results.size());
+    matches.reserve(n);
+    for(int i = 0; i < n; i++){
+        matches.push_back(FaceMatch{mgallery->id_at(results[i].second), results[i].first});
+    }
+    return matches;
+}
+
+/**
+ * @brief 计算前count行人脸ID的FNV-1a校验和
+ */
+quint64 HnswIndex::id_checksum(const FaceGallery *gallery, int count)
+{
+    quint64 hash = 1469598103934665603ULL;
+    for(int i = 0; i < count; i++){
+        quint64 id = (quint64)gallery->id_at(i);
+        for(int b = 0; b < 8; b++){
+            hash ^= (id >> (b * 8)) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+bool HnswIndex::matches(const FaceGallery *gallery) const
+{
+    if(gallery == nullptr || gallery->size() != size()) return false;
+    return id_checksum(gallery, size()) == id_checksum(mgallery, size());
+}
+
+/**
+ * @brief 保存图结构
+ * @details 文件格式：magic、版本、M、efConstruction、节点数、人脸ID校验和、入口点、最高层，
+ *          随后是每个节点的层数、第0层邻接表和各节点的高层邻接表
+ */
+bool HnswIndex::save(const QString &path) const
+{
+    if(mgallery == nullptr) return false;
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)){
+        qDebug()<<"HNSW索引保存失败："<<file.errorString();
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_15);
+    stream<<HNSW_MAGIC<<HNSW_VERSION<<(qint32)mm<<(qint32)mefconstruction<<(qint32)size()
+          <<id_checksum(mgallery, size())<<(qint32)mentry<<(qint32)mmaxlevel;
+    stream.writeRawData(reinterpret_cast<const char*>(mlevels.data()), (int)(mlevels.size() * sizeof(int)));
+    stream.writeRawData(reinterpret_cast<const char*>(mlinks0.data()), (int)(mlinks0.size() * sizeof(int)));
+    for(const std::vector<int> &upper : mupper){
+        if(upper.empty()) continue;
+        stream.writeRawData(reinterpret_cast<const char*>(upper.data()), (int)(upper.size() * sizeof(int)));
+    }
+    if(stream.status() != QDataStream::Ok) return false;
+    return file.commit();
+}
+
+bool HnswIndex::load(const QString &path, const FaceGallery *gallery)
+{
+    QFile file(path);
+    if(gallery == nullptr || !file.open(QIODevice::ReadOnly)) return false;
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_15);
+
+    quint32 magic = 0, version = 0;
+    qint32 m = 0, efc = 0, count = 0, entry = -1, maxlevel = -1;
+    quint64 checksum = 0;
+    stream>>magic>>version>>m>>efc>>count>>checksum>>entry>>maxlevel;
+    if(stream.status() != QDataStream::Ok || magic != HNSW_MAGIC || version != HNSW_VERSION){
+        qDebug()<<"HNSW索引文件格式不正确："<<path;
+        return false;
+    }
+    // 参数M变化或特征库已经改变时需要重新建图
+    if(m != mm || count != gallery->size() || checksum != id_checksum(gallery, count)){
+        return false;
+    }
+    if(count > 0 && (entry < 0 || entry >= count || maxlevel < 0)) return false;
+    if(efc <= 0 || maxlevel > HNSW_MAX_LEVEL){
+        qDebug()<<"HNSW索引文件参数异常："<<path;
+        return false;
+    }
+
+    std::vector<int> levels(count);
+    std::vector<int> links0((std::size_t)count * (mm0 + 1));
+    stream.readRawData(reinterpret_cast<char*>(levels.data()), (int)(levels.size() * sizeof(int)));
+    stream.readRawData(reinterpret_cast<char*>(links0.data()), (int)(links0.size() * sizeof(int)));
+    std::vector<std::vector<int>> upper(count);
+    for(int i = 0; i < count; i++){
+        if(levels[i] < 0 || levels[i] > maxlevel) return false;
+        if(levels[i] == 0) continue;
+        upper[i].resize((std::size_t)levels[i] * (mm + 1));
+        stream.readRawData(reinterpret_cast<char*>(upper[i].data()), (int)(upper[i].size() * sizeof(int)));
+    }
+    if(stream.status() != QDataStream::Ok){
+        qDebug()<<"HNSW索引文件不完整："<<path;
+        return false;
+    }
+    // 文件中没有邻接表的校验和，逐个检查结构，损坏的文件在查询时才会越界访问
+    if(count > 0 && levels[entry] != maxlevel){
+        qDebug()<<"HNSW索引文件损坏："<<path;
+        return false;
+    }
+    for(int i = 0; i < count; i++){
+        bool valid = valid_links(links0.data() + (std::size_t)i * (mm0 + 1), mm0, 0, levels);
+        for(int level = 1; valid && level <= levels[i]; level++){
+            valid = valid_links(upper[i].data() + (std::size_t)(level - 1) * (mm + 1), mm, level, levels);
+        }
+        if(!valid){
+            qDebug()<<"HNSW索引文件损坏：第"<<i<<"个节点的邻接表越界"<<path;
+            return false;
+        }
+    }
+
+    mgallery = gallery;
+    mefconstruction = efc;
+    mentry = entry;
+    mmaxlevel = maxlevel;
+    mlevels.swap(levels);
+    mlinks0.swap(links0);
+    mupper.swap(upper);
+    // 追加节点时的随机层数不必与建图时相同，用节点数扰动一下即可
+    mrng = 0x9E3779B97F4A7C15ULL ^ (quint64)count;
+    return true;
+}
+
+void HnswIndex::evaluate(int samples) const
+{
+    if(mgallery == nullptr || size() == 0 || samples <= 0) return;
+    const int dim = mgallery->dimension();
+    samples = std::min(samples, size());
+
+    // 抽取特征库中的行并叠加噪声，模拟同一个人不同时刻拍到的照片
+    std::mt19937 rng(20240601);
+    std::uniform_int_distribution<int> pick(0, size() - 1);
+    std::normal_distribution<float> noise(0.0f, 0.6f / std::sqrt((float)dim));
+    std::vector<std::vector<float>> queries(samples, std::vector<float>(dim));
+    for(std::vector<float> &q : queries){
+        const float *row = mgallery->row(pick(rng));
+        for(int i = 0; i < dim; i++) q[i] = row[i] + noise(rng);
+    }
+
+    // 精确搜索作为标准答案
+    std::vector<int64_t> truth(samples);
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0; i < samples; i++){
+        truth[i] = mgallery->search(queries[i].data());
+    }
+    double exactus = timer.nsecsElapsed() / 1000.0 / samples;
+    qDebug()<<"HNSW评估：人脸数"<<size()<<"M"<<mm<<"查询数"<<samples<<"精确搜索平均延迟"<<exactus<<"微秒";
+
+    static const int EF_LIST[] = {10, 20, 40, 80, 160, 320};
+    for(int ef : EF_LIST){
+        int hits = 0;
+        timer.restart();
+        for(int i = 0; i < samples; i++){
+            std::vector<FaceMatch> result = search_knn(queries[i].data(), 1, ef);
+            if(!result.empty() && result.front().faceid == truth[i]) hits++;
+        }
+        double us = timer.nsecsElapsed() / 1000.0 / samples;
+        qDebug()<<"  efSearch"<<ef<<"recall@1"<<(double)hits / samples<<"平均延迟"<<us<<"微秒"
+                <<"加速比"<<(us > 0 ? exactus / us : 0.0);
+    }
+}
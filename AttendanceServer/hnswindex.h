@@ -0,0 +1,149 @@
+#ifndef HNSWINDEX_H
+#define HNSWINDEX_H
+
+#include "facegallery.h"
+#include <QString>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief HNSW近似最近邻索引
+ * @details 在FaceGallery的特征矩阵之上建立分层可导航小世界图（Hierarchical Navigable Small World）
+ *          - 图中的节点就是特征库的行号，索引本身不复制特征，只保存各层的邻接表
+ *          - 查询从最高层的入口点贪心下降到第0层，再在第0层做宽度为efSearch的束搜索
+ *          - 查询代价约为O(log N)，适合十万到百万级的人脸库
+ *          - M越大召回率越高、内存和建图时间越多；efSearch越大召回率越高、查询越慢
+ * @note 建图之后特征库只能追加行（append），删除或重排行之后必须重新build
+ *       查询是只读的，多个线程可以同时查询同一个索引，但不能与append并发
+ */
+class HnswIndex
+{
+public:
+    /**
+     * @brief 构造函数
+     * @param m 每个节点在第1层及以上保留的邻居数，第0层保留2*m个
+     * @param efconstruction 建图时的候选集大小
+     */
+    explicit HnswIndex(int m = 16, int efconstruction = 200);
+
+    /**
+     * @brief 设置查询时的候选集大小
+     * @details 不会小于1，实际使用时不小于要返回的结果数
+     */
+    void set_ef_search(int ef);
+
+    /**
+     * @brief 查询时的候选集大小
+     */
+    int ef_search() const;
+
+    /**
+     * @brief 设置停止标志
+     * @param stop 建图时每插入一个节点检查一次，置位后build和append中途返回false，可为nullptr
+     * @details 标志由调用方持有，生命周期必须长于建图过程
+     */
+    void set_stop_flag(const std::atomic<bool> *stop);
+
+    /**
+     * @brief 参数M
+     */
+    int m() const;
+
+    /**
+     * @brief 图中的节点数
+     */
+    int size() const;
+
+    /**
+     * @brief 在特征库上重新建图
+     * @param gallery 特征库，索引只保存指针，特征库的生命周期必须长于索引
+     * @return 停止标志置位时返回false，此时图不完整，不能保存或查询
+     */
+    bool build(const FaceGallery *gallery);
+
+    /**
+     * @brief 把特征库新追加的行插入图中
+     * @return 特征库行数与图中节点数不一致时返回false，此时应重新build；停止标志置位时也返回false
+     */
+    bool append();
+
+    /**
+     * @brief 近似查找最相似的人脸
+     * @param feature 查询特征，可以未归一化
+     * @param similarity 输出找到的人脸的余弦相似度，可为nullptr
+     * @return 人脸ID，索引为空时返回-1
+     */
+    int64_t search(const float *feature, float *similarity = nullptr) const;
+
+    /**
+     * @brief 近似查找最相似的k张人脸
+     * @param feature 查询特征，可以未归一化
+     * @param k 返回的结果数，候选集大小不小于k
+     * @return 按相似度从高到低排列的结果
+     */
+    std::vector<FaceMatch> search_topk(const float *feature, int k) const;
+
+    /**
+     * @brief 判断索引是否与特征库一致
+     * @details 比较节点数和按行顺序计算的人脸ID校验和
+     */
+    bool matches(const FaceGallery *gallery) const;
+
+    /**
+     * @brief 保存图结构到文件
+     * @details 只保存邻接表和建图参数，特征仍以特征库文件为准
+     */
+    bool save(const QString &path) const;
+
+    /**
+     * @brief 从文件加载图结构
+     * @param path 文件路径
+     * @param gallery 图所对应的特征库
+     * @return 文件不存在、格式不对、与特征库不一致或邻接表损坏时返回false
+     * @details 逐个检查层数、邻居数和邻居编号，损坏的文件不会被加载，调用方重新建图
+     */
+    bool load(const QString &path, const FaceGallery *gallery);
+
+    /**
+     * @brief 评估召回率和查询延迟
+     * @param samples 抽样的查询数量
+     * @details 从特征库中抽取若干行并叠加噪声作为查询，以精确搜索的结果为标准答案，
+     *          对一组efSearch分别统计recall@1和平均查询延迟并输出到日志，用于选择运行参数
+     */
+    void evaluate(int samples) const;
+
+private:
+    /**
+     * @brief 候选节点（相似度，节点号）
+     */
+    typedef std::pair<float, int> Candidate;
+
+    float similarity(const float *query, int node) const;
+    int random_level();
+    const int *links(int node, int level) const;
+    int *links(int node, int level);
+    int max_links(int level) const;
+    std::vector<Candidate> search_layer(const float *query, int entry, int ef, int level) const;
+    std::vector<int> select_neighbors(std::vector<Candidate> candidates, int count) const;
+    void connect(int node, int level, const std::vector<int> &neighbors);
+    void insert(int node);
+    std::vector<FaceMatch> search_knn(const float *feature, int k, int ef) const;
+    static quint64 id_checksum(const FaceGallery *gallery, int count);
+
+    int mm;                 ///< 第1层及以上的最大邻居数
+    int mm0;                ///< 第0层的最大邻居数
+    int mefconstruction;    ///< 建图时的候选集大小
+    int mefsearch;          ///< 查询时的候选集大小
+    double mlevelmult;      ///< 随机层数的系数 1/ln(M)
+    const FaceGallery *mgallery; ///< 特征库
+    int mentry;             ///< 入口点，-1表示空图
+    int mmaxlevel;          ///< 当前最高层
+    quint64 mrng;           ///< 随机层数使用的随机数状态
+    const std::atomic<bool> *mstop; ///< 停止标志，可为nullptr
+    std::vector<int> mlevels;   ///< 每个节点的最高层
+    std::vector<int> mlinks0;   ///< 第0层邻接表，每个节点占mm0+1个int，第一个为邻居数
+    std::vector<std::vector<int>> mupper; ///< 第1层及以上的邻接表，每层占mm+1个int
+};
+
+#endif // HNSWINDEX_H
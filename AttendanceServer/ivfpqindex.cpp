@@ -0,0 +1,726 @@
+#include "ivfpqindex.h"
+
+#include <QSaveFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * @brief 索引文件标识和版本号
+ */
+static const quint32 IVFPQ_MAGIC = 0x50564946; // "FIVP"
+static const quint32 IVFPQ_VERSION = 2;
+
+/**
+ * @brief 文件头字节数：magic、版本、维度、簇数、段数、码字数、人脸数、训练后的累计变化数、校验和、原始特征偏移
+ * @details 第2版增加了累计变化数，第1版文件不再加载，启动时重新训练
+ */
+static const qint64 HEADER_SIZE = 4 + 4 + 4 * 4 + 8 + 8 + 8 + 8;
+
+/**
+ * @brief 原始特征区按页对齐，映射后的起始地址同样按页对齐
+ */
+static const qint64 PAGE_SIZE = 4096;
+
+/**
+ * @brief 训练参数
+ * @details 训练只用抽样的一部分特征，k-means迭代次数固定，每个簇至少需要约39个训练样本
+ */
+static const int TRAIN_SAMPLES = 65536;
+static const int KMEANS_ITERATIONS = 10;
+static const int MIN_POINTS_PER_LIST = 39;
+static const int MAX_CODEWORDS = 256;
+
+/**
+ * @brief 把[0, count)分段交给多个线程并行处理
+ * @details 只在建立索引时使用，每段调用一次fn(begin, end)
+ */
+static void parallel_for(int count, const std::function<void(int, int)> &fn)
+{
+    int threads = std::max(1, std::min(QThread::idealThreadCount(), count));
+    if(threads <= 1){
+        fn(0, count);
+        return;
+    }
+    int chunk = (count + threads - 1) / threads;
+    std::vector<std::thread> pool;
+    for(int begin = 0; begin < count; begin += chunk){
+        pool.emplace_back(fn, begin, std::min(count, begin + chunk));
+    }
+    for(std::thread &t : pool){
+        t.join();
+    }
+}
+
+/**
+ * @brief 把每个向量分配到点积最大的簇中心
+ */
+static void assign_lists(const std::vector<const float*> &rows, const float *centroids, int nlist, int dim, int *assign)
+{
+    parallel_for((int)rows.size(), [&](int begin, int end){
+        std::vector<float> scores(nlist);
+        for(int i = begin; i < end; i++){
+            FaceGallery::dot_rows(rows[i], centroids, dim, nlist, dim, scores.data());
+            assign[i] = (int)(std::max_element(scores.begin(), scores.end()) - scores.begin());
+        }
+    });
+}
+
+/**
+ * @brief 在码本中查找欧氏距离最近的码字
+ */
+static int nearest_code(const float *x, const float *codebook, int ks, int dsub)
+{
+    int best = 0;
+    float bestdist = std::numeric_limits<float>::max();
+    for(int k = 0; k < ks; k++){
+        const float *c = codebook + (std::size_t)k * dsub;
+        float dist = 0;
+        for(int t = 0; t < dsub; t++){
+            float d = x[t] - c[t];
+            dist += d * d;
+        }
+        if(dist < bestdist){
+            bestdist = dist;
+            best = k;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief 训练粗量化簇中心
+ * @details 球面k-means：按点积分配，更新后的中心重新归一化，空簇用随机样本重新初始化
+ */
+static std::vector<float> train_coarse(const std::vector<const float*> &samples, int dim, int nlist, std::mt19937 &rng,
+                                       const std::atomic<bool> *stop)
+{
+    const int n = (int)samples.size();
+    std::vector<float> centroids((std::size_t)nlist * dim);
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    for(int c = 0; c < nlist; c++){
+        std::memcpy(centroids.data() + (std::size_t)c * dim, samples[order[c]], dim * sizeof(float));
+    }
+
+    std::uniform_int_distribution<int> pick(0, n - 1);
+    std::vector<int> assign(n);
+    for(int it = 0; it < KMEANS_ITERATIONS; it++){
+        if(stop != nullptr && stop->load(std::memory_order_relaxed)) break;
+        assign_lists(samples, centroids.data(), nlist, dim, assign.data());
+        std::vector<float> sums((std::size_t)nlist * dim, 0.0f);
+        std::vector<int> counts(nlist, 0);
+        for(int i = 0; i < n; i++){
+            float *sum = sums.data() + (std::size_t)assign[i] * dim;
+            for(int d = 0; d < dim; d++) sum[d] += samples[i][d];
+            counts[assign[i]]++;
+        }
+        for(int c = 0; c < nlist; c++){
+            float *centroid = centroids.data() + (std::size_t)c * dim;
+            if(counts[c] == 0){
+                std::memcpy(centroid, samples[pick(rng)], dim * sizeof(float));
+            }else{
+                std::memcpy(centroid, sums.data() + (std::size_t)c * dim, dim * sizeof(float));
+            }
+            FaceGallery::normalize(centroid, dim);
+        }
+    }
+    return centroids;
+}
+
+/**
+ * @brief 训练乘积量化码本
+ * @param residuals 训练样本的残差，n*dim
+ * @param stop 停止标志，置位后提前结束迭代，可为nullptr
+ * @details 每一段独立做欧氏距离k-means，各段之间并行
+ */
+static std::vector<float> train_codebooks(const std::vector<float> &residuals, int n, int dim, int m, int ks, unsigned seed,
+                                          const std::atomic<bool> *stop)
+{
+    const int dsub = dim / m;
+    std::vector<float> codebooks((std::size_t)m * ks * dsub);
+    parallel_for(m, [&](int begin, int end){
+        std::vector<float> sub((std::size_t)n * dsub);
+        std::vector<int> assign(n);
+        std::vector<float> sums((std::size_t)ks * dsub);
+        std::vector<int> counts(ks);
+        for(int j = begin; j < end; j++){
+            for(int i = 0; i < n; i++){
+                std::memcpy(sub.data() + (std::size_t)i * dsub, residuals.data() + (std::size_t)i * dim + j * dsub, dsub * sizeof(float));
+            }
+            float *codebook = codebooks.data() + (std::size_t)j * ks * dsub;
+            std::mt19937 rng(seed + j);
+            std::vector<int> order(n);
+            std::iota(order.begin(), order.end(), 0);
+            std::shuffle(order.begin(), order.end(), rng);
+            for(int k = 0; k < ks; k++){
+                std::memcpy(codebook + (std::size_t)k * dsub, sub.data() + (std::size_t)order[k] * dsub, dsub * sizeof(float));
+            }
+
+            std::uniform_int_distribution<int> pick(0, n - 1);
+            for(int it = 0; it < KMEANS_ITERATIONS; it++){
+                if(stop != nullptr && stop->load(std::memory_order_relaxed)) break;
+                for(int i = 0; i < n; i++){
+                    assign[i] = nearest_code(sub.data() + (std::size_t)i * dsub, codebook, ks, dsub);
+                }
+                std::fill(sums.begin(), sums.end(), 0.0f);
+                std::fill(counts.begin(), counts.end(), 0);
+                for(int i = 0; i < n; i++){
+                    const float *x = sub.data() + (std::size_t)i * dsub;
+                    float *sum = sums.data() + (std::size_t)assign[i] * dsub;
+                    for(int t = 0; t < dsub; t++) sum[t] += x[t];
+                    counts[assign[i]]++;
+                }
+                for(int k = 0; k < ks; k++){
+                    float *code = codebook + (std::size_t)k * dsub;
+                    if(counts[k] == 0){
+                        std::memcpy(code, sub.data() + (std::size_t)pick(rng) * dsub, dsub * sizeof(float));
+                        continue;
+                    }
+                    for(int t = 0; t < dsub; t++) code[t] = sums[(std::size_t)k * dsub + t] / counts[k];
+                }
+            }
+        }
+    });
+    return codebooks;
+}
+
+IvfPqIndex::IvfPqIndex(int nlist, int m, int nprobe, int rerank)
+    : mnlist(nlist)
+    , mm(std::max(1, m))
+    , mks(0)
+    , mdim(0)
+    , mdsub(0)
+    , mnprobe(std::max(1, nprobe))
+    , mrerank(std::max(1, rerank))
+    , mchanged(0)
+    , mvectors(nullptr)
+    , mstop(nullptr)
+{
+}
+
+IvfPqIndex::~IvfPqIndex()
+{
+    unmap();
+}
+
+void IvfPqIndex::set_nprobe(int nprobe)
+{
+    mnprobe = std::max(1, nprobe);
+}
+
+void IvfPqIndex::set_rerank(int rerank)
+{
+    mrerank = std::max(1, rerank);
+}
+
+void IvfPqIndex::set_stop_flag(const std::atomic<bool> *stop)
+{
+    mstop = stop;
+}
+
+bool IvfPqIndex::stopped() const
+{
+    return mstop != nullptr && mstop->load(std::memory_order_relaxed);
+}
+
+int IvfPqIndex::size() const
+{
+    return (int)mids.size();
+}
+
+qint64 IvfPqIndex::memory_bytes() const
+{
+    return (qint64)(mcentroids.size() * sizeof(float) + mcodebooks.size() * sizeof(float)
+                    + moffsets.size() * sizeof(int) + mids.size() * sizeof(int64_t) + mcodes.size());
+}
+
+void IvfPqIndex::unmap()
+{
+    if(mvectors != nullptr){
+        mfile.unmap(mvectors);
+        mvectors = nullptr;
+    }
+    mfile.close();
+}
+
+const float *IvfPqIndex::full_vector(int entry) const
+{
+    return reinterpret_cast<const float*>(mvectors) + (std::size_t)entry * mdim;
+}
+
+/**
+ * @brief 训练并写入索引
+ * @details 抽样训练簇中心和码本，编码所有人脸后按簇排列写入
+ */
+bool IvfPqIndex::build(const FaceGallery &gallery, const QString &path)
+{
+    const int count = gallery.size();
+    const int dim = gallery.dimension();
+    if(count == 0 || dim <= 0) return false;
+
+    // 段数必须整除维度；簇数默认取4*sqrt(N)，并保证每个簇有足够的训练样本
+    int m = std::min(mm, dim);
+    while(dim % m != 0) m--;
+    int nlist = mnlist > 0 ? mnlist : (int)std::lround(4.0 * std::sqrt((double)count));
+    nlist = std::max(1, std::min(nlist, count / MIN_POINTS_PER_LIST));
+    const int ks = std::min(MAX_CODEWORDS, count);
+
+    // 训练样本
+    std::mt19937 rng(20240601);
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    const int n = std::min(count, TRAIN_SAMPLES);
+    nlist = std::min(nlist, n);
+    std::vector<const float*> samples(n);
+    for(int i = 0; i < n; i++){
+        samples[i] = gallery.row(order[i]);
+    }
+
+    std::vector<float> centroids = train_coarse(samples, dim, nlist, rng, mstop);
+    if(stopped()) return false;
+    std::vector<int> sampleassign(n);
+    assign_lists(samples, centroids.data(), nlist, dim, sampleassign.data());
+    std::vector<float> residuals((std::size_t)n * dim);
+    for(int i = 0; i < n; i++){
+        const float *c = centroids.data() + (std::size_t)sampleassign[i] * dim;
+        float *r = residuals.data() + (std::size_t)i * dim;
+        for(int d = 0; d < dim; d++) r[d] = samples[i][d] - c[d];
+    }
+    std::vector<float> codebooks = train_codebooks(residuals, n, dim, m, ks, rng(), mstop);
+    if(stopped()) return false;
+    residuals.clear();
+    residuals.shrink_to_fit();
+
+    // 编码所有人脸
+    std::vector<const float*> rows(count);
+    std::vector<int64_t> galleryids(count);
+    for(int i = 0; i < count; i++){
+        rows[i] = gallery.row(i);
+        galleryids[i] = gallery.id_at(i);
+    }
+    std::vector<int> assign(count);
+    std::vector<uint8_t> codes((std::size_t)count * m);
+    encode(rows, centroids.data(), codebooks.data(), nlist, dim, m, ks, assign.data(), codes.data());
+    if(stopped()) return false;
+
+    // 按簇做计数排序，同一个簇的条目在文件中连续存放
+    std::vector<int> offsets(nlist + 1, 0);
+    for(int i = 0; i < count; i++) offsets[assign[i] + 1]++;
+    for(int l = 0; l < nlist; l++) offsets[l + 1] += offsets[l];
+    std::vector<int> entries(count);
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for(int i = 0; i < count; i++) entries[fill[assign[i]]++] = i;
+
+    std::vector<int64_t> entryids(count);
+    std::vector<uint8_t> entrycodes((std::size_t)count * m);
+    std::vector<const float*> entryrows(count);
+    for(int e = 0; e < count; e++){
+        entryids[e] = galleryids[entries[e]];
+        std::memcpy(entrycodes.data() + (std::size_t)e * m, codes.data() + (std::size_t)entries[e] * m, m);
+        entryrows[e] = rows[entries[e]];
+    }
+    return write(path, centroids, codebooks, offsets, entryids, entrycodes, entryrows, nlist, m, ks, 0, galleryids);
+}
+
+/**
+ * @brief 增量更新索引
+ * @details 1. 读取旧的索引文件，不检查人脸ID，沿用其中的簇中心和码本
+ *          2. 与特征库的人脸ID比较：索引中有而特征库中没有的人脸已删除，特征库中有而索引中没有的人脸是新增的；
+ *             人脸ID不会复用，同一ID的特征不变，已编码的条目可以直接保留
+ *          3. 变化比例在阈值以内时，新增的人脸分配到最近的簇并编码，与保留的条目按簇合并后重新写入；
+ *             原始特征从特征库读取，不依赖旧文件的映射
+ *          簇中心和码本不随新增人脸调整，变化积累过多时量化误差变大，由阈值触发重新训练
+ */
+bool IvfPqIndex::update(const FaceGallery &gallery, const QString &path, double drift)
+{
+    if(!read(path, nullptr)) return false;
+    const int count = gallery.size();
+    if(mdim != gallery.dimension() || mids.empty()){
+        unmap();
+        return false;
+    }
+
+    std::unordered_map<int64_t, int> rowof;
+    rowof.reserve(count);
+    std::vector<int64_t> galleryids(count);
+    for(int i = 0; i < count; i++){
+        galleryids[i] = gallery.id_at(i);
+        rowof[galleryids[i]] = i;
+    }
+    std::vector<char> indexed(count, 0);
+    int removed = 0;
+    for(int64_t id : mids){
+        auto it = rowof.find(id);
+        if(it == rowof.end()){
+            removed++;
+        }else{
+            indexed[it->second] = 1;
+        }
+    }
+    std::vector<const float*> fresh;
+    std::vector<int64_t> freshids;
+    for(int i = 0; i < count; i++){
+        if(indexed[i]) continue;
+        fresh.push_back(gallery.row(i));
+        freshids.push_back(galleryids[i]);
+    }
+    // 变化从上次训练起累计，多次小的增量更新同样会触发重新训练
+    const qint64 changed = mchanged + removed + (qint64)fresh.size();
+    if(changed > drift * size()){
+        qDebug()<<"IVF-PQ索引训练后累计变化"<<changed<<"张人脸，超过"<<size()<<"张的"<<drift<<"，需要重新训练";
+        unmap();
+        return false;
+    }
+
+    // 新增的人脸用原有的簇中心和码本编码
+    std::vector<int> assign(fresh.size());
+    std::vector<uint8_t> freshcodes(fresh.size() * mm);
+    encode(fresh, mcentroids.data(), mcodebooks.data(), mnlist, mdim, mm, mks, assign.data(), freshcodes.data());
+    if(stopped()){
+        unmap();
+        return false;
+    }
+    std::vector<std::vector<int>> lists(mnlist);
+    for(std::size_t j = 0; j < fresh.size(); j++) lists[assign[j]].push_back((int)j);
+
+    // 每个簇先放保留的条目，再放新增的条目
+    std::vector<int> offsets(mnlist + 1, 0);
+    std::vector<int64_t> ids;
+    std::vector<uint8_t> codes;
+    std::vector<const float*> rows;
+    ids.reserve(count);
+    codes.reserve((std::size_t)count * mm);
+    rows.reserve(count);
+    for(int l = 0; l < mnlist; l++){
+        for(int e = moffsets[l]; e < moffsets[l + 1]; e++){
+            auto it = rowof.find(mids[e]);
+            if(it == rowof.end()) continue;
+            ids.push_back(mids[e]);
+            codes.insert(codes.end(), mcodes.begin() + (std::size_t)e * mm, mcodes.begin() + (std::size_t)(e + 1) * mm);
+            rows.push_back(gallery.row(it->second));
+        }
+        for(int j : lists[l]){
+            ids.push_back(freshids[j]);
+            codes.insert(codes.end(), freshcodes.begin() + (std::size_t)j * mm, freshcodes.begin() + (std::size_t)(j + 1) * mm);
+            rows.push_back(fresh[j]);
+        }
+        offsets[l + 1] = (int)ids.size();
+    }
+    const std::vector<float> centroids = mcentroids;
+    const std::vector<float> codebooks = mcodebooks;
+    qDebug()<<"增量更新IVF-PQ索引：新增"<<fresh.size()<<"张人脸，删除"<<removed<<"张，沿用"<<mnlist<<"个簇中心和码本";
+    return write(path, centroids, codebooks, offsets, ids, codes, rows, mnlist, mm, mks, changed, galleryids);
+}
+
+/**
+ * @brief 编码一批特征
+ * @details 先分配到点积最大的簇，再把残差的每一段编码为欧氏距离最近的码字
+ */
+void IvfPqIndex::encode(const std::vector<const float*> &rows, const float *centroids, const float *codebooks,
+                        int nlist, int dim, int m, int ks, int *assign, uint8_t *codes)
+{
+    const int dsub = dim / m;
+    assign_lists(rows, centroids, nlist, dim, assign);
+    parallel_for((int)rows.size(), [&](int begin, int end){
+        std::vector<float> r(dim);
+        for(int i = begin; i < end; i++){
+            const float *c = centroids + (std::size_t)assign[i] * dim;
+            for(int d = 0; d < dim; d++) r[d] = rows[i][d] - c[d];
+            uint8_t *code = codes + (std::size_t)i * m;
+            for(int j = 0; j < m; j++){
+                code[j] = (uint8_t)nearest_code(r.data() + j * dsub, codebooks + (std::size_t)j * ks * dsub, ks, dsub);
+            }
+        }
+    });
+}
+
+/**
+ * @brief 写入索引文件
+ * @details 文件格式：文件头，随后是簇中心、码本、倒排表偏移、按簇排列的人脸ID和PQ编码，
+ *          补齐到页边界后是按同样顺序排列的原始特征
+ *          写入之前解除对旧文件的映射，Windows上映射中的文件不能被替换
+ */
+bool IvfPqIndex::write(const QString &path, const std::vector<float> &centroids, const std::vector<float> &codebooks,
+                       const std::vector<int> &offsets, const std::vector<int64_t> &ids, const std::vector<uint8_t> &codes,
+                       const std::vector<const float*> &rows, int nlist, int m, int ks, qint64 changed,
+                       const std::vector<int64_t> &galleryids)
+{
+    unmap();
+    const int count = (int)ids.size();
+    const int dim = nlist > 0 ? (int)(centroids.size() / nlist) : 0;
+    const qint64 body = (qint64)centroids.size() * sizeof(float) + (qint64)codebooks.size() * sizeof(float)
+                        + (qint64)offsets.size() * sizeof(qint32) + (qint64)count * (sizeof(qint64) + m);
+    const qint64 vecoffset = (HEADER_SIZE + body + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)){
+        qDebug()<<"IVF-PQ索引保存失败："<<file.errorString();
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_15);
+    stream<<IVFPQ_MAGIC<<IVFPQ_VERSION<<(qint32)dim<<(qint32)nlist<<(qint32)m<<(qint32)ks
+          <<(qint64)count<<changed<<id_checksum(galleryids)<<vecoffset;
+    stream.writeRawData(reinterpret_cast<const char*>(centroids.data()), (int)(centroids.size() * sizeof(float)));
+    stream.writeRawData(reinterpret_cast<const char*>(codebooks.data()), (int)(codebooks.size() * sizeof(float)));
+    stream.writeRawData(reinterpret_cast<const char*>(offsets.data()), (int)(offsets.size() * sizeof(int)));
+    for(int64_t id : ids){
+        stream<<(qint64)id;
+    }
+    stream.writeRawData(reinterpret_cast<const char*>(codes.data()), (int)codes.size());
+    std::vector<char> padding(vecoffset - HEADER_SIZE - body, 0);
+    stream.writeRawData(padding.data(), (int)padding.size());
+    for(const float *row : rows){
+        stream.writeRawData(reinterpret_cast<const char*>(row), dim * sizeof(float));
+    }
+    if(stream.status() != QDataStream::Ok || !file.commit()) return false;
+
+    return load(path, galleryids);
+}
+
+bool IvfPqIndex::load(const QString &path, const std::vector<int64_t> &ids)
+{
+    return read(path, &ids);
+}
+
+bool IvfPqIndex::read(const QString &path, const std::vector<int64_t> *ids)
+{
+    unmap();
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)) return false;
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_15);
+
+    quint32 magic = 0, version = 0;
+    qint32 dim = 0, nlist = 0, m = 0, ks = 0;
+    qint64 count = 0, changed = 0, vecoffset = 0;
+    quint64 checksum = 0;
+    stream>>magic>>version>>dim>>nlist>>m>>ks>>count>>changed>>checksum>>vecoffset;
+    if(stream.status() != QDataStream::Ok || magic != IVFPQ_MAGIC || version != IVFPQ_VERSION
+            || dim <= 0 || nlist <= 0 || m <= 0 || dim % m != 0 || ks <= 0 || ks > MAX_CODEWORDS || count < 0){
+        qDebug()<<"IVF-PQ索引文件格式不正确："<<path;
+        return false;
+    }
+    // 特征库已经改变时需要重新训练
+    if(ids != nullptr && (count != (qint64)ids->size() || checksum != id_checksum(*ids))) return false;
+    if(vecoffset < HEADER_SIZE || file.size() < vecoffset + count * dim * (qint64)sizeof(float)){
+        qDebug()<<"IVF-PQ索引文件不完整："<<path;
+        return false;
+    }
+
+    std::vector<float> centroids((std::size_t)nlist * dim);
+    std::vector<float> codebooks((std::size_t)ks * dim);
+    std::vector<int> offsets(nlist + 1);
+    std::vector<int64_t> entryids(count);
+    std::vector<uint8_t> codes((std::size_t)count * m);
+    stream.readRawData(reinterpret_cast<char*>(centroids.data()), (int)(centroids.size() * sizeof(float)));
+    stream.readRawData(reinterpret_cast<char*>(codebooks.data()), (int)(codebooks.size() * sizeof(float)));
+    stream.readRawData(reinterpret_cast<char*>(offsets.data()), (int)(offsets.size() * sizeof(int)));
+    for(qint64 i = 0; i < count; i++){
+        qint64 id = -1;
+        stream>>id;
+        entryids[i] = id;
+    }
+    stream.readRawData(reinterpret_cast<char*>(codes.data()), (int)codes.size());
+    if(stream.status() != QDataStream::Ok || offsets.front() != 0 || offsets.back() != count
+            || !std::is_sorted(offsets.begin(), offsets.end())){
+        qDebug()<<"IVF-PQ索引文件不完整："<<path;
+        return false;
+    }
+    // 码字直接用来索引码本和距离表，超出码本大小的文件视为损坏
+    if(!codes.empty() && *std::max_element(codes.begin(), codes.end()) >= ks){
+        qDebug()<<"IVF-PQ索引文件损坏，码字超出码本大小："<<path;
+        return false;
+    }
+
+    mnlist = nlist;
+    mm = m;
+    mks = ks;
+    mdim = dim;
+    mdsub = dim / m;
+    mcentroids.swap(centroids);
+    mcodebooks.swap(codebooks);
+    moffsets.swap(offsets);
+    mchanged = changed;
+    mids.swap(entryids);
+    mcodes.swap(codes);
+
+    // 原始特征只映射不读入，重排时按需由操作系统调入
+    if(count > 0){
+        mfile.setFileName(path);
+        if(!mfile.open(QIODevice::ReadOnly)) return false;
+        mvectors = mfile.map(vecoffset, count * dim * (qint64)sizeof(float));
+        if(mvectors == nullptr){
+            qDebug()<<"IVF-PQ原始特征映射失败："<<mfile.errorString();
+            mfile.close();
+            return false;
+        }
+    }
+    return true;
+}
+
+int64_t IvfPqIndex::search(const float *feature, float *similarity) const
+{
+    std::vector<FaceMatch> results = search_with(feature, 1, mnprobe, mrerank);
+    if(similarity) *similarity = results.empty() ? 0 : results.front().similarity;
+    return results.empty() ? -1 : results.front().faceid;
+}
+
+std::vector<FaceMatch> IvfPqIndex::search_topk(const float *feature, int k) const
+{
+    return search_with(feature, k, mnprobe, std::max(mrerank, k));
+}
+
+std::vector<FaceMatch> IvfPqIndex::search_with(const float *feature, int k, int nprobe, int rerank) const
+{
+    std::vector<FaceMatch> matches;
+    if(mids.empty() || mvectors == nullptr || k <= 0) return matches;
+
+    std::vector<float> query(feature, feature + mdim);
+    if(!FaceGallery::normalize(query.data(), mdim)) return matches;
+
+    // 步骤1: 粗量化，选出与查询最相似的nprobe个簇
+    std::vector<float> coarse(mnlist);
+    FaceGallery::dot_rows(query.data(), mcentroids.data(), mdim, mnlist, mdim, coarse.data());
+    nprobe = std::min(nprobe, mnlist);
+    std::vector<int> lists(mnlist);
+    std::iota(lists.begin(), lists.end(), 0);
+    std::partial_sort(lists.begin(), lists.begin() + nprobe, lists.end(), [&](int a, int b){
+        return coarse[a] > coarse[b];
+    });
+
+    // 步骤2: 非对称距离表，查询的每一段与该段所有码字的点积
+    // 由于q·x = q·c + q·r，残差部分的点积与簇无关，整张表每次查询只算一次
+    std::vector<float> table((std::size_t)mm * mks);
+    for(int j = 0; j < mm; j++){
+        FaceGallery::dot_rows(query.data() + j * mdsub, mcodebooks.data() + (std::size_t)j * mks * mdsub,
+                              mdsub, mks, mdsub, table.data() + (std::size_t)j * mks);
+    }
+
+    // 步骤3: 扫描选中的簇，查表累加得到近似相似度，保留最高的rerank个候选
+    typedef std::pair<float, int> Candidate;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+    for(int p = 0; p < nprobe; p++){
+        const int l = lists[p];
+        const float base = coarse[l];
+        for(int e = moffsets[l]; e < moffsets[l + 1]; e++){
+            const uint8_t *code = mcodes.data() + (std::size_t)e * mm;
+            const float *t = table.data();
+            float s = base;
+            for(int j = 0; j < mm; j++, t += mks){
+                s += t[code[j]];
+            }
+            if((int)candidates.size() < rerank){
+                candidates.push(Candidate(s, e));
+            }else if(s > candidates.top().first){
+                candidates.pop();
+                candidates.push(Candidate(s, e));
+            }
+        }
+    }
+
+    // 步骤4: 用原始特征精确重排，返回的相似度与精确搜索一致，可以直接和阈值比较
+    matches.reserve(candidates.size());
+    while(!candidates.empty()){
+        int e = candidates.top().second;
+        candidates.pop();
+        matches.push_back(FaceMatch{mids[e], FaceGallery::dot(query.data(), full_vector(e), mdim)});
+    }
+    std::sort(matches.begin(), matches.end(), [](const FaceMatch &a, const FaceMatch &b){
+        return a.similarity > b.similarity;
+    });
+    if((int)matches.size() > k) matches.resize(k);
+    return matches;
+}
+
+/**
+ * @brief 计算人脸ID序列的FNV-1a校验和
+ */
+quint64 IvfPqIndex::id_checksum(const std::vector<int64_t> &ids)
+{
+    quint64 hash = 1469598103934665603ULL;
+    for(int64_t value : ids){
+        quint64 id = (quint64)value;
+        for(int b = 0; b < 8; b++){
+            hash ^= (id >> (b * 8)) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+void IvfPqIndex::evaluate(int samples) const
+{
+    if(mids.empty() || mvectors == nullptr || samples <= 0) return;
+    samples = std::min(samples, size());
+
+    // 抽取人脸特征并叠加噪声，模拟同一个人不同时刻拍到的照片
+    std::mt19937 rng(20240601);
+    std::uniform_int_distribution<int> pick(0, size() - 1);
+    std::normal_distribution<float> noise(0.0f, 0.6f / std::sqrt((float)mdim));
+    std::vector<std::vector<float>> queries(samples, std::vector<float>(mdim));
+    for(std::vector<float> &q : queries){
+        const float *row = full_vector(pick(rng));
+        for(int i = 0; i < mdim; i++) q[i] = row[i] + noise(rng);
+    }
+
+    // 在原始特征上做精确搜索作为标准答案
+    static const int BLOCK = 256;
+    std::vector<float> scores(BLOCK);
+    std::vector<int64_t> truth(samples);
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0; i < samples; i++){
+        std::vector<float> query = queries[i];
+        FaceGallery::normalize(query.data(), mdim);
+        float best = -2.0f;
+        int bestentry = 0;
+        for(int begin = 0; begin < size(); begin += BLOCK){
+            int n = std::min(BLOCK, size() - begin);
+            FaceGallery::dot_rows(query.data(), full_vector(begin), mdim, n, mdim, scores.data());
+            for(int k = 0; k < n; k++){
+                if(scores[k] > best){
+                    best = scores[k];
+                    bestentry = begin + k;
+                }
+            }
+        }
+        truth[i] = mids[bestentry];
+    }
+    double exactus = timer.nsecsElapsed() / 1000.0 / samples;
+
+    const double fullmb = (double)size() * mdim * sizeof(float) / 1048576.0;
+    const double residentmb = memory_bytes() / 1048576.0;
+    qDebug()<<"IVF-PQ评估：人脸数"<<size()<<"簇数"<<mnlist<<"段数"<<mm<<"重排候选"<<mrerank<<"查询数"<<samples;
+    qDebug()<<"  常驻内存"<<residentmb<<"MB，float特征库"<<fullmb<<"MB，压缩比"
+            <<(residentmb > 0 ? fullmb / residentmb : 0.0)<<"，每张人脸编码"<<mm<<"字节";
+    qDebug()<<"  精确搜索平均延迟"<<exactus<<"微秒";
+
+    static const int NPROBE_LIST[] = {1, 2, 4, 8, 16, 32, 64, 128};
+    for(int nprobe : NPROBE_LIST){
+        if(nprobe > mnlist) break;
+        int hits = 0;
+        timer.restart();
+        for(int i = 0; i < samples; i++){
+            std::vector<FaceMatch> result = search_with(queries[i].data(), 1, nprobe, mrerank);
+            if(!result.empty() && result.front().faceid == truth[i]) hits++;
+        }
+        double us = timer.nsecsElapsed() / 1000.0 / samples;
+        qDebug()<<"  nprobe"<<nprobe<<"recall@1"<<(double)hits / samples<<"平均延迟"<<us<<"微秒"
+                <<"加速比"<<(us > 0 ? exactus / us : 0.0);
+    }
+}
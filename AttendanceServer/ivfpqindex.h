@@ -0,0 +1,173 @@
+#ifndef IVFPQINDEX_H
+#define IVFPQINDEX_H
+
+#include "facegallery.h"
+#include <QFile>
+#include <QString>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief IVF-PQ压缩人脸索引
+ * @details 倒排文件（IVF）+ 乘积量化（PQ），用于几十万到上百万人脸、内存放不下全部float特征的场景
+ *          - 粗量化：球面k-means把特征分到nlist个簇，查询时只扫描最相似的nprobe个簇
+ *          - 乘积量化：特征减去簇中心后的残差切成m段，每段用256个码字之一表示，每张人脸只占m字节
+ *          - 非对称距离表：查询向量不量化，每段预先计算与256个码字的点积，扫描时只需查表累加
+ *          - 精确重排：取近似分数最高的rerank个候选，用原始float特征重新计算相似度
+ *          原始特征放在索引文件末尾，通过内存映射按需读取，只有重排用到的行会被调入内存
+ *          fr_2_10的1024维特征在m=128时每张人脸由4096字节压缩为128字节（32倍），m=256时为16倍
+ * @note 索引建立后只读，查询可以多线程并发；特征库变化不大时用update沿用已训练的簇中心和码本，
+ *       只编码新增的人脸，变化超过阈值时才重新build
+ */
+class IvfPqIndex
+{
+public:
+    /**
+     * @brief 构造函数
+     * @param nlist 粗量化簇数，<=0时根据人脸数自动选择
+     * @param m 乘积量化的段数，必须能整除特征维度
+     * @param nprobe 查询时扫描的簇数
+     * @param rerank 参与精确重排的候选数
+     */
+    explicit IvfPqIndex(int nlist = 0, int m = 128, int nprobe = 16, int rerank = 64);
+    ~IvfPqIndex();
+
+    /**
+     * @brief 设置查询时扫描的簇数
+     */
+    void set_nprobe(int nprobe);
+
+    /**
+     * @brief 设置参与精确重排的候选数
+     */
+    void set_rerank(int rerank);
+
+    /**
+     * @brief 设置停止标志
+     * @param stop 训练时每轮k-means和每个阶段之间检查一次，置位后build和update不写文件、返回false，可为nullptr
+     * @details 标志由调用方持有，生命周期必须长于建立索引的过程
+     */
+    void set_stop_flag(const std::atomic<bool> *stop);
+
+    /**
+     * @brief 索引中的人脸数
+     */
+    int size() const;
+
+    /**
+     * @brief 常驻内存的字节数
+     * @details 包括簇中心、码本、倒排表、人脸ID和PQ编码，不包括按需映射的原始特征
+     */
+    qint64 memory_bytes() const;
+
+    /**
+     * @brief 训练并写入索引文件
+     * @param gallery 完整的特征库，只在建立索引期间使用
+     * @param path 索引文件路径
+     * @return 写入并重新加载成功时返回true，停止标志置位时返回false
+     */
+    bool build(const FaceGallery &gallery, const QString &path);
+
+    /**
+     * @brief 把已过期的索引文件增量更新到特征库的当前内容
+     * @param gallery 完整的特征库
+     * @param path 索引文件路径，其中的簇中心和码本沿用
+     * @param drift 允许的变化比例，上次训练之后累计新增和删除的人脸数超过索引人脸数的这一比例时不更新
+     * @return 写入并重新加载成功时返回true；文件不可用、维度不符或变化过大时返回false，调用方应重新build；
+     *         停止标志置位时也返回false
+     * @details 新增的人脸分配到最近的簇并用原有码本编码，删除的人脸从倒排表中去掉，不重新训练
+     */
+    bool update(const FaceGallery &gallery, const QString &path, double drift);
+
+    /**
+     * @brief 加载索引文件
+     * @param path 索引文件路径
+     * @param ids 当前特征库的人脸ID（按行顺序），用于判断索引是否过期
+     * @return 文件不存在、格式不对或已过期时返回false
+     */
+    bool load(const QString &path, const std::vector<int64_t> &ids);
+
+    /**
+     * @brief 查找最相似的人脸
+     * @param feature 查询特征，可以未归一化
+     * @param similarity 输出重排后的余弦相似度，可为nullptr
+     * @return 人脸ID，索引为空时返回-1
+     */
+    int64_t search(const float *feature, float *similarity = nullptr) const;
+
+    /**
+     * @brief 查找最相似的k张人脸
+     * @param feature 查询特征，可以未归一化
+     * @param k 返回的结果数，重排候选数不小于k
+     * @return 按重排后的相似度从高到低排列的结果
+     */
+    std::vector<FaceMatch> search_topk(const float *feature, int k) const;
+
+    /**
+     * @brief 评估内存、召回率和查询延迟
+     * @param samples 抽样的查询数量
+     * @details 抽取人脸特征叠加噪声作为查询，以原始特征上的精确搜索为标准答案，
+     *          对一组nprobe统计recall@1和平均延迟，并输出与float特征库相比的内存压缩比
+     */
+    void evaluate(int samples) const;
+
+    /**
+     * @brief 计算人脸ID序列的校验和
+     */
+    static quint64 id_checksum(const std::vector<int64_t> &ids);
+
+private:
+    /**
+     * @brief 读取索引文件
+     * @param ids 不为nullptr时检查索引是否与之一致
+     * @return 格式不对、与ids不一致、倒排表偏移无序或码字不小于码本大小时返回false
+     */
+    bool read(const QString &path, const std::vector<int64_t> *ids);
+
+    /**
+     * @brief 把按条目排列的索引内容写入文件并重新加载
+     * @param rows 与ids一一对应的原始特征
+     * @param ids 按簇排列的人脸ID
+     * @param codes 与ids一一对应的PQ编码
+     * @param offsets 每个簇在条目数组中的起始位置
+     * @param changed 上次训练之后累计新增和删除的人脸数
+     * @param galleryids 特征库按行顺序的人脸ID，用于计算校验和
+     */
+    bool write(const QString &path, const std::vector<float> &centroids, const std::vector<float> &codebooks,
+               const std::vector<int> &offsets, const std::vector<int64_t> &ids, const std::vector<uint8_t> &codes,
+               const std::vector<const float*> &rows, int nlist, int m, int ks, qint64 changed,
+               const std::vector<int64_t> &galleryids);
+
+    /**
+     * @brief 用给定的簇中心和码本编码一批特征
+     * @param assign 输出每个特征所属的簇
+     * @param codes 输出每个特征的PQ编码，每条m字节
+     */
+    static void encode(const std::vector<const float*> &rows, const float *centroids, const float *codebooks,
+                       int nlist, int dim, int m, int ks, int *assign, uint8_t *codes);
+
+    void unmap();
+    bool stopped() const;
+    const float *full_vector(int entry) const;
+    std::vector<FaceMatch> search_with(const float *feature, int k, int nprobe, int rerank) const;
+
+    int mnlist;     ///< 粗量化簇数
+    int mm;         ///< 乘积量化段数
+    int mks;        ///< 每段的码字数，不超过256
+    int mdim;       ///< 特征维度
+    int mdsub;      ///< 每段的维度
+    int mnprobe;    ///< 查询时扫描的簇数
+    int mrerank;    ///< 参与精确重排的候选数
+    qint64 mchanged; ///< 上次训练之后累计新增和删除的人脸数
+    std::vector<float> mcentroids;  ///< 簇中心，nlist*dim，已归一化
+    std::vector<float> mcodebooks;  ///< 码本，m*ks*dsub
+    std::vector<int> moffsets;      ///< 每个簇在条目数组中的起始位置，nlist+1个
+    std::vector<int64_t> mids;      ///< 按簇排列的人脸ID
+    std::vector<uint8_t> mcodes;    ///< 按簇排列的PQ编码，每条m字节
+    QFile mfile;                    ///< 索引文件，用于映射原始特征
+    uchar *mvectors;                ///< 映射的原始特征，按条目顺序排列
+    const std::atomic<bool> *mstop; ///< 停止标志，可为nullptr
+};
+
+#endif // IVFPQINDEX_H
@@ -0,0 +1,518 @@
+#include "livegallery.h"
+#include "serverconfig.h"
+
+#include <QMutexLocker>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+
+/**
+ * @brief 特征库文件路径
+ * @details SeetaFace引擎自带的face.db无法读出特征向量，特征库改为保存在face.gallery中；
+ *          快照按代保存为face.gallery.N，face.gallery.current记录当前一代
+ */
+static const char *GALLERY_FILE = "./face.gallery";
+
+/**
+ * @brief 特征库日志文件路径
+ * @details 记录face.gallery快照之后的注册和删除，启动时重放
+ */
+static const char *JOURNAL_FILE = "./face.journal";
+
+/**
+ * @brief HNSW索引文件路径
+ * @details 只保存图结构，特征仍以特征库快照为准
+ */
+static const char *HNSW_FILE = "./face.hnsw";
+
+/**
+ * @brief IVF-PQ索引文件路径
+ * @details 包含PQ编码和一份原始特征，原始特征只在精确重排时按需映射
+ */
+static const char *IVFPQ_FILE = "./face.ivfpq";
+
+/**
+ * @brief 使用IVF-PQ的最少人脸数
+ * @details 人脸太少时码本训练不充分，而且精确搜索本身就足够快，直接退回精确搜索
+ */
+static const int IVFPQ_MIN_FACES = 1024;
+
+GalleryOverlay GalleryOverlay::from(const FaceGallery &gallery)
+{
+    GalleryOverlay overlay;
+    const int dim = gallery.dimension();
+    for(int begin = 0; begin < gallery.size(); begin += CHUNK_FACES){
+        const int end = std::min(gallery.size(), begin + CHUNK_FACES);
+        std::shared_ptr<FaceGallery> chunk = std::make_shared<FaceGallery>(dim);
+        chunk->reserve(end - begin);
+        for(int i = begin; i < end; i++) chunk->add(gallery.id_at(i), gallery.row(i));
+        overlay.mchunks.push_back(chunk);
+    }
+    overlay.msize = gallery.size();
+    overlay.mnextid = gallery.next_id();
+    return overlay;
+}
+
+int GalleryOverlay::size() const
+{
+    return msize;
+}
+
+int64_t GalleryOverlay::next_id() const
+{
+    return mnextid;
+}
+
+bool GalleryOverlay::contains(int64_t faceid) const
+{
+    for(const std::shared_ptr<const FaceGallery> &chunk : mchunks){
+        if(chunk->contains(faceid)) return true;
+    }
+    return false;
+}
+
+int GalleryOverlay::count_upto(int64_t faceid) const
+{
+    int count = 0;
+    for(const std::shared_ptr<const FaceGallery> &chunk : mchunks){
+        for(int i = 0; i < chunk->size(); i++){
+            if(chunk->id_at(i) <= faceid) count++;
+        }
+    }
+    return count;
+}
+
+std::vector<FaceMatch> GalleryOverlay::search_topk(const float *feature, int k) const
+{
+    std::vector<FaceMatch> matches;
+    for(const std::shared_ptr<const FaceGallery> &chunk : mchunks){
+        std::vector<FaceMatch> part = chunk->search_topk(feature, k);
+        matches.insert(matches.end(), part.begin(), part.end());
+    }
+    std::sort(matches.begin(), matches.end(), [](const FaceMatch &a, const FaceMatch &b){
+        return a.similarity > b.similarity;
+    });
+    if((int)matches.size() > k) matches.resize(k);
+    return matches;
+}
+
+bool GalleryOverlay::add(int64_t faceid, const float *feature, int dim)
+{
+    // 已发布的块不修改，复制最后一块，最多CHUNK_FACES行
+    const bool append = !mchunks.empty() && mchunks.back()->size() < CHUNK_FACES;
+    std::shared_ptr<FaceGallery> chunk = append ? std::make_shared<FaceGallery>(*mchunks.back())
+                                                : std::make_shared<FaceGallery>(dim);
+    if(!chunk->add(faceid, feature)) return false;
+    if(append){
+        mchunks.back() = chunk;
+    }else{
+        mchunks.push_back(chunk);
+    }
+    msize++;
+    mnextid = std::max(mnextid, faceid + 1);
+    return true;
+}
+
+bool GalleryOverlay::remove(int64_t faceid)
+{
+    for(std::size_t i = 0; i < mchunks.size(); i++){
+        if(!mchunks[i]->contains(faceid)) continue;
+        std::shared_ptr<FaceGallery> chunk = std::make_shared<FaceGallery>(*mchunks[i]);
+        chunk->remove(faceid);
+        if(chunk->size() == 0){
+            mchunks.erase(mchunks.begin() + i);
+        }else{
+            mchunks[i] = chunk;
+        }
+        msize--;
+        return true;
+    }
+    return false;
+}
+
+int GalleryDelta::extra() const
+{
+    return overridden;
+}
+
+bool GalleryDelta::contains(int64_t faceid) const
+{
+    if(added.contains(faceid)) return true;
+    if(removed.count(faceid) > 0) return false;
+    return base != nullptr && base->contains(faceid);
+}
+
+/**
+ * @brief 合并查询结果
+ * @details 1. 从基础结果中去掉已删除的人脸和增量中重新注册过的人脸
+ *          2. 在增量中做精确比对，与基础结果合并后按相似度排序取前k个
+ */
+void GalleryDelta::merge(const float *feature, std::vector<FaceMatch> &matches, int k) const
+{
+    if(removed.empty() && added.size() == 0){
+        if((int)matches.size() > k) matches.resize(k);
+        return;
+    }
+    std::vector<FaceMatch> merged;
+    merged.reserve(matches.size() + k);
+    for(const FaceMatch &match : matches){
+        if(removed.count(match.faceid) > 0) continue;
+        if(added.contains(match.faceid)) continue;
+        merged.push_back(match);
+    }
+    if(added.size() > 0){
+        std::vector<FaceMatch> fresh = added.search_topk(feature, k);
+        merged.insert(merged.end(), fresh.begin(), fresh.end());
+    }
+    std::sort(merged.begin(), merged.end(), [](const FaceMatch &a, const FaceMatch &b){
+        return a.similarity > b.similarity;
+    });
+    if((int)merged.size() > k) merged.resize(k);
+    matches.swap(merged);
+}
+
+std::vector<FaceMatch> GalleryDelta::search(const float *feature, int k) const
+{
+    const int basek = k + extra();
+    std::vector<FaceMatch> matches;
+    if(hnsw != nullptr){
+        matches = hnsw->search_topk(feature, basek);
+    }else if(ivfpq != nullptr){
+        matches = ivfpq->search_topk(feature, basek);
+    }else{
+        matches = base->search_topk(feature, basek);
+    }
+    merge(feature, matches, k);
+    return matches;
+}
+
+std::vector<std::vector<FaceMatch>> GalleryDelta::search_batch(const float *features, int count, int k) const
+{
+    const int dim = base->dimension();
+    if(hnsw != nullptr || ivfpq != nullptr){
+        std::vector<std::vector<FaceMatch>> results(std::max(count, 0));
+        for(int p = 0; p < count; p++){
+            results[p] = search(features + (std::size_t)p * dim, k);
+        }
+        return results;
+    }
+    std::vector<std::vector<FaceMatch>> results = base->search_batch(features, count, k + extra());
+    for(int p = 0; p < count; p++){
+        merge(features + (std::size_t)p * dim, results[p], k);
+    }
+    return results;
+}
+
+LiveGallery &LiveGallery::instance()
+{
+    static LiveGallery gallery;
+    return gallery;
+}
+
+LiveGallery::LiveGallery()
+{
+    // load()之前的版本只有一个空的基础特征库，查询返回空结果
+    std::shared_ptr<GalleryDelta> delta = std::make_shared<GalleryDelta>();
+    delta->base = std::make_shared<FaceGallery>();
+    mcurrent = delta;
+}
+
+LiveGallery::~LiveGallery()
+{
+    // 没有经过aboutToQuit退出时，在这里回收后台线程
+    shutdown();
+}
+
+QString LiveGallery::gallery_file()
+{
+    return FaceJournal::snapshot_file(GALLERY_FILE);
+}
+
+QString LiveGallery::journal_file()
+{
+    return JOURNAL_FILE;
+}
+
+/**
+ * @brief 加载特征库
+ * @details 1. 只读映射快照作为基础特征库，进程内所有工作对象共享这一份映射
+ *          2. 配置了gallery/verify_snapshot时在重放日志之前校验特征矩阵，此时基础特征库还是快照的原样
+ *          3. 日志中的注册和删除重放进增量，不修改基础特征库，映射的页面不会被复制到堆内存
+ */
+bool LiveGallery::load(int dim)
+{
+    QMutexLocker locker(&writemutex);
+    QElapsedTimer timer;
+    timer.start();
+    journal = FaceJournal(JOURNAL_FILE, dim);
+    std::shared_ptr<FaceGallery> base = std::make_shared<FaceGallery>(dim);
+    FaceGallery added(dim);
+    std::shared_ptr<GalleryDelta> delta = std::make_shared<GalleryDelta>();
+    const bool verified = journal.load(*base, added, delta->removed, GALLERY_FILE, ServerConfig::verify_snapshot(),
+                                       &delta->generation);
+    delta->version = current()->version;
+    delta->base = base;
+    delta->added = GalleryOverlay::from(added);
+    publish(delta);
+    qDebug()<<"加载人脸特征库：快照"<<delta->generation<<base->size()<<"张人脸，映射"<<base->is_mapped()
+            <<"日志新增"<<added.size()<<"张，删除"<<delta->removed.size()<<"张"
+            <<"耗时"<<timer.nsecsElapsed() / 1000<<"微秒，比对内核"<<FaceGallery::kernel_name();
+    return verified;
+}
+
+/**
+ * @brief 准备近似搜索索引
+ * @details 同一时间只有一个线程建立索引；运行期间快照又切换过时，线程结束前为最新一代再建立一次。
+ *          线程由LiveGallery持有，上一次的线程在启动新线程或shutdown()时回收
+ */
+void LiveGallery::build_index()
+{
+    const QString backend = ServerConfig::search_backend();
+    if(backend != "hnsw" && backend != "ivfpq") return;
+    QMutexLocker locker(&indexmutex);
+    if(stopping) return;
+    if(indexrunning){
+        indexpending = true;
+        return;
+    }
+    indexrunning = true;
+    // indexrunning已经清除，上一个线程只剩下退出，等待很短
+    if(indexthread != nullptr){
+        indexthread->wait();
+    }
+    indexthread.reset(QThread::create([this, backend](){
+        for(;;){
+            prepare_index(backend);
+            QMutexLocker locker(&indexmutex);
+            if(!indexpending || stopping){
+                indexrunning = false;
+                return;
+            }
+            indexpending = false;
+        }
+    }));
+    indexthread->start();
+}
+
+/**
+ * @brief 停止后台线程
+ * @details 1. 在写入锁内置位停止标志，之后的注册和删除不再触发压缩
+ *          2. 等待压缩线程和它的回调结束，回调中为新一代发起的建立索引看到停止标志后直接返回
+ *          3. 建立索引的线程在下一个节点或下一轮k-means检查停止标志，不保存不完整的索引
+ */
+void LiveGallery::shutdown()
+{
+    {
+        QMutexLocker locker(&writemutex);
+        stopping = true;
+    }
+    FaceJournal::wait_compaction();
+    std::unique_ptr<QThread> thread;
+    {
+        QMutexLocker locker(&indexmutex);
+        thread.swap(indexthread);
+    }
+    if(thread != nullptr){
+        thread->wait();
+    }
+}
+
+/**
+ * @brief 为当前一代快照准备索引
+ * @details 1. 后台线程加载或建立索引，期间查询照常使用内存中的基础特征库，启动和首次查询都不等待建图；
+ *             IVF-PQ索引文件与快照不一致时先尝试增量更新，变化超过search/ivfpq_retrain_drift才重新训练
+ *          2. 日志压缩出的新一代快照在这里映射，旧的基础特征库和索引在新索引就绪之前继续服务
+ *          3. 在写入锁内把索引挂到当前版本的副本上发布，或者连同新一代快照和日志中剩余的记录一起发布，
+ *             之后发布的版本由副本复制，一直共享这份索引
+ *          4. 召回率和延迟评估作为启动时的基准测试，第一次发布索引之后运行一次，不阻塞查询
+ */
+void LiveGallery::prepare_index(const QString &backend)
+{
+    const QString generation = FaceJournal::snapshot_file(GALLERY_FILE);
+    std::shared_ptr<const GalleryDelta> now = current();
+    std::shared_ptr<const FaceGallery> base = now->base;
+    if(now->generation != generation){
+        std::shared_ptr<FaceGallery> mapped = std::make_shared<FaceGallery>(now->base->dimension());
+        if(!mapped->load(generation)){
+            qDebug()<<"新一代特征库快照加载失败，继续使用"<<now->generation;
+            return;
+        }
+        base = mapped;
+    }
+
+    std::shared_ptr<HnswIndex> hnsw;
+    std::shared_ptr<IvfPqIndex> ivfpq;
+    QElapsedTimer timer;
+    timer.start();
+    if(backend == "hnsw"){
+        hnsw = std::make_shared<HnswIndex>(ServerConfig::hnsw_m(), ServerConfig::hnsw_ef_construction());
+        hnsw->set_ef_search(ServerConfig::hnsw_ef_search());
+        hnsw->set_stop_flag(&stopping);
+        if(hnsw->load(HNSW_FILE, base.get())){
+            qDebug()<<"加载HNSW索引："<<hnsw->size()<<"个节点";
+        }else{
+            // 索引文件不存在，或者快照已经切换，重新建图；退出时中途停止，不完整的图不保存
+            if(!hnsw->build(base.get())) return;
+            hnsw->save(HNSW_FILE);
+            qDebug()<<"重建HNSW索引："<<hnsw->size()<<"个节点，M"<<hnsw->m()<<"耗时"<<timer.elapsed()<<"毫秒";
+        }
+    }else{
+        ivfpq = std::make_shared<IvfPqIndex>(ServerConfig::ivfpq_nlist(), ServerConfig::ivfpq_m(),
+                                             ServerConfig::ivfpq_nprobe(), ServerConfig::ivfpq_rerank());
+        ivfpq->set_stop_flag(&stopping);
+        // 基础特征库是映射的，只读取人脸ID判断索引是否过期，特征矩阵的页面不会因此调入内存
+        std::vector<int64_t> ids(base->size());
+        for(int i = 0; i < base->size(); i++) ids[i] = base->id_at(i);
+        if(ivfpq->load(IVFPQ_FILE, ids)){
+            qDebug()<<"加载IVF-PQ索引："<<ivfpq->size()<<"张人脸，常驻内存"<<ivfpq->memory_bytes() / 1024<<"KB";
+        }else if(base->size() < IVFPQ_MIN_FACES){
+            qDebug()<<"人脸数"<<base->size()<<"不足以建立IVF-PQ索引，使用精确搜索";
+            ivfpq.reset();
+        }else if(ivfpq->update(*base, IVFPQ_FILE, ServerConfig::ivfpq_retrain_drift())){
+            // 快照合并了日志中的注册和删除，变化不大时只编码新增的人脸，不重新训练
+            qDebug()<<"更新IVF-PQ索引："<<ivfpq->size()<<"张人脸，耗时"<<timer.elapsed()<<"毫秒";
+        }else if(!ivfpq->build(*base, IVFPQ_FILE)){
+            if(stopping) return;
+            qDebug()<<"建立IVF-PQ索引失败，使用精确搜索";
+            ivfpq.reset();
+        }else{
+            qDebug()<<"重建IVF-PQ索引："<<ivfpq->size()<<"张人脸，耗时"<<timer.elapsed()<<"毫秒";
+        }
+    }
+
+    if(stopping) return;
+    {
+        QMutexLocker locker(&writemutex);
+        std::shared_ptr<const GalleryDelta> old = current();
+        if(old->base == base){
+            std::shared_ptr<GalleryDelta> delta = std::make_shared<GalleryDelta>(*old);
+            delta->hnsw = hnsw;
+            delta->ivfpq = ivfpq;
+            publish(delta);
+        }else if(!publish_rebased(base, generation, hnsw, ivfpq)){
+            qDebug()<<"特征库快照在建立索引期间再次切换，丢弃该索引";
+            return;
+        }
+    }
+
+    static bool evaluated = false;
+    const int samples = ServerConfig::evaluate_samples();
+    if(samples > 0 && !evaluated){
+        evaluated = true;
+        if(hnsw != nullptr) hnsw->evaluate(samples);
+        if(ivfpq != nullptr) ivfpq->evaluate(samples);
+    }
+}
+
+std::shared_ptr<const GalleryDelta> LiveGallery::current() const
+{
+    return std::atomic_load(&mcurrent);
+}
+
+/**
+ * @brief 注册一张人脸
+ * @details 新ID取基础特征库和增量中出现过的最大ID加1，删除过的ID不会复用；
+ *          先写日志再发布，日志写入失败时查询方看不到这张人脸
+ */
+int64_t LiveGallery::add(const float *feature)
+{
+    QMutexLocker locker(&writemutex);
+    std::shared_ptr<const GalleryDelta> old = current();
+    GalleryOverlay added = old->added;
+    const int64_t faceid = std::max(old->base->next_id(), added.next_id());
+    if(!added.add(faceid, feature, old->base->dimension())) return -1;
+    if(!journal.append_add(faceid, feature)) return -1;
+    // 增量只复制块指针和最后一块，已发布的版本保持不变
+    std::shared_ptr<GalleryDelta> delta = std::make_shared<GalleryDelta>(*old);
+    delta->added = added;
+    delta->removed.erase(faceid);
+    publish(delta);
+    compact_journal();
+    return faceid;
+}
+
+bool LiveGallery::remove(int64_t faceid)
+{
+    QMutexLocker locker(&writemutex);
+    std::shared_ptr<const GalleryDelta> old = current();
+    if(!old->contains(faceid)) return false;
+    if(!journal.append_remove(faceid)) return false;
+    std::shared_ptr<GalleryDelta> delta = std::make_shared<GalleryDelta>(*old);
+    delta->added.remove(faceid);
+    if(old->base->contains(faceid)) delta->removed.insert(faceid);
+    publish(delta);
+    compact_journal();
+    return true;
+}
+
+bool LiveGallery::save_snapshot(const FaceGallery &gallery)
+{
+    QMutexLocker locker(&writemutex);
+    return FaceJournal(JOURNAL_FILE, gallery.dimension()).save_snapshot(gallery, GALLERY_FILE);
+}
+
+void LiveGallery::compact_journal()
+{
+    if(stopping) return;
+    if(journal.record_count() < ServerConfig::journal_compact_records()) return;
+    journal.compact(GALLERY_FILE, [this](const QString &){
+        rebase();
+    });
+}
+
+/**
+ * @brief 切换到新一代快照
+ * @details 精确搜索时立即映射新一代并发布，增量中已经合并进快照的人脸随之释放；
+ *          近似搜索时旧的基础特征库和索引继续服务，由建立索引的线程在新索引就绪后一起切换
+ *          旧的一代在最后一个使用它的查询结束时解除映射
+ */
+void LiveGallery::rebase()
+{
+    const QString backend = ServerConfig::search_backend();
+    if(backend == "hnsw" || backend == "ivfpq"){
+        build_index();
+        return;
+    }
+    const QString generation = FaceJournal::snapshot_file(GALLERY_FILE);
+    std::shared_ptr<FaceGallery> base = std::make_shared<FaceGallery>(current()->base->dimension());
+    if(!base->load(generation)){
+        qDebug()<<"新一代特征库快照加载失败，继续使用"<<current()->generation;
+        return;
+    }
+    QMutexLocker locker(&writemutex);
+    publish_rebased(base, generation, nullptr, nullptr);
+}
+
+bool LiveGallery::publish_rebased(const std::shared_ptr<const FaceGallery> &base, const QString &generation,
+                                  const std::shared_ptr<const HnswIndex> &hnsw, const std::shared_ptr<const IvfPqIndex> &ivfpq)
+{
+    FaceGallery added(base->dimension());
+    std::shared_ptr<GalleryDelta> delta = std::make_shared<GalleryDelta>();
+    if(!journal.replay_pending(GALLERY_FILE, generation, added, delta->removed)) return false;
+    delta->version = current()->version;
+    delta->base = base;
+    delta->generation = generation;
+    delta->added = GalleryOverlay::from(added);
+    delta->hnsw = hnsw;
+    delta->ivfpq = ivfpq;
+    publish(delta);
+    qDebug()<<"基础特征库切换到"<<generation<<"："<<base->size()<<"张人脸，日志中剩余新增"<<added.size()
+            <<"张，删除"<<delta->removed.size()<<"张";
+    return true;
+}
+
+void LiveGallery::publish(std::shared_ptr<GalleryDelta> delta)
+{
+    delta->version++;
+    delta->overridden = 0;
+    const int64_t basemax = delta->base != nullptr ? delta->base->next_id() - 1 : -1;
+    for(int64_t faceid : delta->removed){
+        if(faceid <= basemax) delta->overridden++;
+    }
+    delta->overridden += delta->added.count_upto(basemax);
+    std::atomic_store(&mcurrent, std::shared_ptr<const GalleryDelta>(delta));
+    qDebug()<<"发布特征库版本"<<delta->version<<"：新增"<<delta->added.size()
+            <<"张人脸，删除"<<delta->removed.size()<<"张，索引"<<(delta->hnsw != nullptr ? "hnsw" : delta->ivfpq != nullptr ? "ivfpq" : "无");
+}
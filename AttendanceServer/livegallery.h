@@ -0,0 +1,270 @@
+#ifndef LIVEGALLERY_H
+#define LIVEGALLERY_H
+
+#include "facegallery.h"
+#include "facejournal.h"
+#include "hnswindex.h"
+#include "ivfpqindex.h"
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief 快照之后注册的人脸
+ * @details 按块存放，每块是一个最多CHUNK_FACES张人脸的FaceGallery，块发布之后不再修改，在版本之间共享
+ *          - 注册只复制最后一块，删除只复制所在的那一块，复制量与增量的总人脸数无关
+ *          - 复制整个增量只复制块指针，批量注册时不会反复复制全部特征
+ */
+class GalleryOverlay
+{
+public:
+    /**
+     * @brief 每块的人脸数
+     * @details 1024维特征每块约256KB
+     */
+    static constexpr int CHUNK_FACES = 64;
+
+    /**
+     * @brief 把一个特征库切成块
+     * @details 用于启动和切换快照时重放日志之后，块只在这里原地填充
+     */
+    static GalleryOverlay from(const FaceGallery &gallery);
+
+    /**
+     * @brief 人脸数
+     */
+    int size() const;
+
+    /**
+     * @brief 出现过的最大人脸ID加1，没有人脸时为0
+     */
+    int64_t next_id() const;
+
+    /**
+     * @brief 人脸ID是否在增量中
+     */
+    bool contains(int64_t faceid) const;
+
+    /**
+     * @brief ID不大于faceid的人脸数
+     */
+    int count_upto(int64_t faceid) const;
+
+    /**
+     * @brief 精确查找最相似的k张人脸
+     */
+    std::vector<FaceMatch> search_topk(const float *feature, int k) const;
+
+    /**
+     * @brief 注册一张人脸
+     * @param faceid 人脸ID，不能已经在增量中
+     * @param dim 特征维度，新建块时使用
+     * @details 复制最后一块再修改，最后一块已满时新建一块
+     */
+    bool add(int64_t faceid, const float *feature, int dim);
+
+    /**
+     * @brief 删除一张人脸
+     * @details 复制所在的块再修改，块删空后去掉
+     */
+    bool remove(int64_t faceid);
+
+private:
+    std::vector<std::shared_ptr<const FaceGallery>> mchunks; ///< 各块，发布之后只读
+    int msize = 0;          ///< 各块人脸数之和
+    int64_t mnextid = 0;    ///< 出现过的最大人脸ID加1
+};
+
+/**
+ * @brief 特征库的一个不可变版本
+ * @details 由只读的基础特征库和叠加在它上面的增量组成，发布之后不再修改，查询线程持有shared_ptr期间可以无锁读取
+ *          - 基础特征库是启动时映射的快照，进程内只有一份，所有工作对象共享，从不修改
+ *          - 增量是快照之后的注册和删除：日志中重放的记录和运行期间的变化，
+ *            日志压缩出新一代快照后基础特征库切换到新快照，增量只剩切换时日志中的记录
+ *          - 近似搜索索引建立在基础特征库上，后台就绪后随新版本发布，所有工作对象共享同一份只读索引
+ */
+struct GalleryDelta
+{
+    quint64 version = 0;                        ///< 版本号，每次发布加1
+    std::shared_ptr<const FaceGallery> base;    ///< 只读的基础特征库，没有快照时为空特征库
+    QString generation;                         ///< 基础特征库映射的快照文件，没有快照时为空
+    GalleryOverlay added;                       ///< 快照之后注册的人脸
+    std::unordered_set<int64_t> removed;        ///< 快照之后删除的人脸ID
+    int overridden = 0;                         ///< 基础特征库中被删除或被增量覆盖的人脸数，发布时计算
+    std::shared_ptr<const HnswIndex> hnsw;      ///< 基础特征库上的HNSW索引，搜索后端不是hnsw或尚未就绪时为nullptr
+    std::shared_ptr<const IvfPqIndex> ivfpq;    ///< 基础特征库上的IVF-PQ索引，搜索后端不是ivfpq、尚未就绪或人脸太少时为nullptr
+
+    /**
+     * @brief 查询基础特征库时需要多取的结果数
+     * @details 基础特征库的结果中可能有已删除或被增量覆盖的人脸，多取这么多条才能保证过滤后仍有k条；
+     *          新注册的人脸ID都大于基础特征库的最大ID，不会覆盖基础特征库中的人脸，不计入其中
+     */
+    int extra() const;
+
+    /**
+     * @brief 人脸ID是否在这个版本中
+     */
+    bool contains(int64_t faceid) const;
+
+    /**
+     * @brief 把增量合并进基础特征库的查询结果
+     * @param feature 查询特征
+     * @param matches 基础特征库的结果，输出合并后的前k个结果，按相似度从高到低排列
+     * @param k 返回的结果数
+     */
+    void merge(const float *feature, std::vector<FaceMatch> &matches, int k) const;
+
+    /**
+     * @brief 查找最相似的k张人脸
+     * @param feature 查询特征，可以未归一化
+     * @param k 返回的结果数
+     * @return 按相似度从高到低排列的结果，已合并增量
+     * @details 索引就绪时在索引中查找，否则在基础特征库上精确搜索
+     */
+    std::vector<FaceMatch> search(const float *feature, int k) const;
+
+    /**
+     * @brief 批量查找
+     * @param features count个查询特征，按行连续存放
+     * @param count 查询数
+     * @param k 每个查询返回的结果数
+     * @return 每个查询的前k个结果，按相似度从高到低排列
+     * @details 没有索引时整批与基础特征库做一次分块矩阵乘法，有索引时逐个查询
+     */
+    std::vector<std::vector<FaceMatch>> search_batch(const float *features, int count, int k) const;
+};
+
+/**
+ * @brief 进程内共享的实时特征库
+ * @details 特征库的唯一所有者，负责加载快照、重放日志、注册和删除人脸，以RCU方式发布特征库的变化：
+ *          - 启动时只读映射快照作为基础特征库，先按配置校验，再把日志重放进增量，基础特征库不会被复制到堆内存
+ *          - 写入方在锁内追加日志、复制当前增量并修改副本，再原子地替换当前版本
+ *          - 查询方每批查询开始时原子地取得当前版本，整批查询都使用这个版本，不需要加锁，
+ *            写入方发布新版本时正在进行的查询继续使用旧版本，旧版本在最后一个查询结束时释放
+ *          新注册的人脸在发布之后的下一次查询即可被识别，无需重启服务器
+ * @note 增量只包含快照之后的变化，日志压缩后随快照切换清空，通常只有几十到几百张人脸，精确比对的代价很小；
+ *       索引只覆盖基础特征库，注册和删除不修改索引，在合并结果时处理；
+ *       日志在后台压缩为新快照，下次启动时增量重新变小
+ */
+class LiveGallery
+{
+public:
+    /**
+     * @brief 获取进程内唯一的实时特征库
+     */
+    static LiveGallery &instance();
+
+    /**
+     * @brief 加载特征库快照并重放日志
+     * @param dim 特征维度
+     * @return 快照校验失败时返回false，此时只发布日志中的记录，调用方应重建快照后重新加载
+     * @details 在创建工作对象之前调用一次
+     */
+    bool load(int dim);
+
+    /**
+     * @brief 在后台线程中准备近似搜索索引
+     * @details 搜索后端为hnsw或ivfpq时，在指针指向的当前一代快照上从文件加载索引，
+     *          文件不存在或与快照不一致时重新建立并保存，就绪后发布带索引的新版本，
+     *          当前一代比内存中的基础特征库新时同时切换基础特征库；
+     *          配置了search/evaluate_samples时再评估召回率和延迟；
+     *          索引就绪之前查询在基础特征库上精确搜索。在load()之后调用
+     */
+    void build_index();
+
+    /**
+     * @brief 停止并等待后台线程
+     * @details 置位停止标志，等待日志压缩和建立索引的线程结束，未完成的索引不保存也不发布；
+     *          之后不再压缩日志和建立索引。在退出事件循环时（aboutToQuit）调用，
+     *          必须早于静态对象析构，调用方不能持有本对象的锁
+     */
+    void shutdown();
+
+    /**
+     * @brief 获取当前版本
+     */
+    std::shared_ptr<const GalleryDelta> current() const;
+
+    /**
+     * @brief 注册一张人脸
+     * @param feature 特征向量，长度为load()时的维度
+     * @return 分配的人脸ID，特征无效或日志写入失败时返回-1
+     * @details 分配新ID、追加日志并发布，日志记录数达到阈值时在后台压缩
+     */
+    int64_t add(const float *feature);
+
+    /**
+     * @brief 删除一张人脸
+     * @param faceid 人脸ID
+     * @return 人脸ID不存在或日志写入失败时返回false
+     */
+    bool remove(int64_t faceid);
+
+    /**
+     * @brief 把完整的特征库保存为新一代快照并清空日志
+     * @details 用于从员工头像重建特征库，在load()之前调用；已映射的旧快照不会被覆盖
+     */
+    bool save_snapshot(const FaceGallery &gallery);
+
+    /**
+     * @brief 当前一代特征库快照的文件路径
+     */
+    static QString gallery_file();
+
+    /**
+     * @brief 特征库日志文件路径
+     */
+    static QString journal_file();
+
+private:
+    LiveGallery();
+    ~LiveGallery();
+
+    /**
+     * @brief 原子地替换当前版本
+     * @details 重新计算被覆盖的基础人脸数后发布
+     */
+    void publish(std::shared_ptr<GalleryDelta> delta);
+
+    /**
+     * @brief 日志记录数达到阈值时在后台压缩
+     */
+    void compact_journal();
+
+    /**
+     * @brief 日志压缩出新一代快照之后把基础特征库切换过去
+     * @details 在压缩线程中调用；搜索后端为近似搜索时交给build_index()，索引就绪后一起切换
+     */
+    void rebase();
+
+    /**
+     * @brief 为当前一代快照准备索引并发布
+     * @param backend 搜索后端，hnsw或ivfpq
+     */
+    void prepare_index(const QString &backend);
+
+    /**
+     * @brief 以新一代快照为基础特征库发布
+     * @param base 映射的新一代快照
+     * @param generation 快照文件路径
+     * @return 指针已经切换到更新的一代时返回false，不发布
+     * @details 在writemutex内调用，增量重新由日志重放得到，之前的增量和删除集合全部丢弃
+     */
+    bool publish_rebased(const std::shared_ptr<const FaceGallery> &base, const QString &generation,
+                         const std::shared_ptr<const HnswIndex> &hnsw, const std::shared_ptr<const IvfPqIndex> &ivfpq);
+
+    QMutex writemutex;                          ///< 串行化写入方
+    QMutex indexmutex;                          ///< 保护indexrunning、indexpending和indexthread，同一时间只有一个线程建立索引、写索引文件
+    bool indexrunning = false;                  ///< 建立索引的线程是否在运行，由indexmutex保护
+    bool indexpending = false;                  ///< 运行期间快照又切换过，线程结束前再为最新一代建立一次
+    std::unique_ptr<QThread> indexthread;       ///< 建立索引的线程，由indexmutex保护
+    std::atomic<bool> stopping{false};          ///< 停止标志，建图和训练过程中检查，置位后不再启动后台线程
+    FaceJournal journal;                        ///< 特征库变更日志，由writemutex保护
+    std::shared_ptr<const GalleryDelta> mcurrent; ///< 当前版本，通过std::atomic_load/std::atomic_store访问
+};
+
+#endif // LIVEGALLERY_H
@@ -0,0 +1,30 @@
+#include "previewrenderer.h"
+
+PreviewRenderer::PreviewRenderer(QObject *parent)
+    : QObject{parent}
+{
+}
+
+/**
+ * @brief 渲染一帧预览
+ * @details 解码后的图像由QImage直接引用（Format_BGR888，不做颜色转换），发出的一定是独立的副本：
+ *          尺寸不变时scaled()返回原图本身，仍然引用cv::Mat的缓冲区，这时显式复制一份
+ */
+void PreviewRenderer::render(cv::Mat image, QByteArray jpeg, QSize size)
+{
+    QImage frame;
+    if(!image.empty()){
+        frame = QImage(image.data, image.cols, image.rows, (int)image.step, QImage::Format_BGR888);
+    }else{
+        frame.loadFromData(jpeg, "jpg");
+    }
+    if(frame.isNull()){
+        emit rendered(QImage());
+        return;
+    }
+    QImage scaled = frame.scaled(size);//固定图片缩放比例
+    if(scaled.constBits() == image.data){
+        scaled = scaled.copy();
+    }
+    emit rendered(scaled);
+}
@@ -0,0 +1,39 @@
+#ifndef PREVIEWRENDERER_H
+#define PREVIEWRENDERER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+#include <opencv.hpp>
+
+/**
+ * @brief 考勤图像预览渲染器
+ * @details 在独立线程中把解码后的图像或终端缩略图缩放为界面显示的大小，
+ *          主线程只把结果设置到标签上，网络拆包和数据库写入不再为界面显示付出缩放的开销
+ *          QPixmap只能在主线程使用，渲染结果以QImage返回
+ */
+class PreviewRenderer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PreviewRenderer(QObject *parent = nullptr);
+
+public slots:
+    /**
+     * @brief 渲染一帧预览
+     * @param image 解码后的BGR图像，与识别线程共享，只读；为空时使用jpeg
+     * @param jpeg 终端上传特征时附带的JPEG缩略图
+     * @param size 显示区域大小
+     */
+    void render(cv::Mat image, QByteArray jpeg, QSize size);
+
+signals:
+    /**
+     * @brief 渲染完成信号
+     * @param image 缩放后的图像，渲染失败时为空
+     */
+    void rendered(QImage image);
+};
+
+#endif // PREVIEWRENDERER_H
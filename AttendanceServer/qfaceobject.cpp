@@ -1,133 +1,289 @@
 #include "qfaceobject.h"
+#include "serverconfig.h"
+
+#include <QElapsedTimer>
+#include <algorithm>
+
+/**
+ * @brief 识别成功的相似度阈值
+ * @details 经验值，平衡了识别准确率和召回率
+ */
+static const float SIMILARITY_THRESHOLD = 0.7f;
+
+/**
+ * @brief 终端人脸框的最小边长
+ * @details 更小的框多为误检，关键点定位也不可靠，退回整帧检测
+ */
+static const int CLIENT_FACE_MIN_SIZE = 40;
 
 /**
  * @brief QFaceObject构造函数
  * @param parent Qt对象树中的父对象指针
- * @details 初始化SeetaFace人脸识别引擎，加载所需的人脸检测、关键点定位和识别模型
- *          1. 设置模型在CPU上运行，确保系统兼容性
- *          2. 加载人脸检测模型(fd_2_00.dat)
- *          3. 加载人脸关键点定位模型(pd_2_00_pts5.dat)
- *          4. 加载人脸识别模型(fr_2_10.dat)
- *          5. 创建完整的人脸识别引擎实例
- *          6. 加载已有的人脸数据库，实现数据持久化
- * @note 确保模型文件路径正确，数据库文件face.db保存在应用程序当前目录
+ * @param searchonly 只做特征比对时为true，不取用引擎
+ * @details 从FaceEngineRegistry取用人脸检测、关键点定位和识别引擎，注册表中没有空闲引擎时才加载模型
+ *          1. 人脸检测模型(fd_2_00.dat)
+ *          2. 人脸关键点定位模型(pd_2_00_pts5.dat)
+ *          3. 人脸识别模型(fr_2_10.dat)
+ *          4. 模型在CPU上运行，确保系统兼容性
+ *          5. 特征库由LiveGallery统一加载，所有工作对象共享同一份只读映射的快照
+ * @note 确保模型文件路径正确，特征库文件face.gallery和日志face.journal保存在应用程序当前目录
  */
-QFaceObject::QFaceObject(QObject *parent)
+QFaceObject::QFaceObject(QObject *parent, bool searchonly)
     : QObject{parent}
+    , topk(ServerConfig::result_topk())
 {
-    // 初始化SeetaFace人脸识别引擎
     // SeetaFace是一个完整的人脸识别系统，包含检测、对齐和识别三个模块
-    // FDmode: 人脸检测模块 - 检测图像中的人脸位置
-    seeta::ModelSetting FDmode("C:/SeetaFace/bin/model/fd_2_00.dat",seeta::ModelSetting::CPU,0);
-    
-    // PDmode: 人脸关键点定位模块 - 检测5个关键点（左眼、右眼、鼻子、左嘴角、右嘴角）
-    seeta::ModelSetting PDmode("C:/SeetaFace/bin/model/pd_2_00_pts5.dat",seeta::ModelSetting::CPU,0);
-    
-    // FRmode: 人脸识别模块 - 提取人脸特征向量用于身份识别
-    seeta::ModelSetting FRmode("C:/SeetaFace/bin/model/fr_2_10.dat",seeta::ModelSetting::CPU,0);
-    
-    // 使用三个模型设置创建完整的人脸识别引擎实例
-    // FaceEngine整合了人脸检测、对齐和识别的完整流程
-    this->fengineptr = new seeta::FaceEngine(FDmode,PDmode,FRmode);
-
-    // 导入已有的人脸数据库 - 实现数据持久化和系统恢复能力
-    // 程序重启后加载之前保存的人脸特征数据，避免重新注册所有员工人脸
-    // 确保考勤系统能够识别之前已经注册过的员工，实现连续性服务
-    this->fengineptr->Load("./face.db");
+    // 三个模块从进程内的引擎注册表取用，有空闲引擎时直接复用，不再重新读取模型文件
+    // 特征提取之后的比对由FaceGallery完成
+    // 只做特征比对的对象（流水线的比对阶段）不占用引擎
+    FaceEngineRegistry &registry = FaceEngineRegistry::instance();
+    if(!searchonly){
+        fdptr = registry.detector();
+        flptr = registry.landmarker();
+        frptr = registry.recognizer();
+    }
 
+    // 已注册的人脸特征由LiveGallery在启动时加载，这里的特征库只用于从员工头像重建
+    gallery = FaceGallery(registry.feature_size());
 }
 
 QFaceObject::~QFaceObject()
 {
-    delete fengineptr;
+    // fdptr、flptr、frptr析构时引擎回到注册表的空闲池
 }
 
 /**
- * @brief 人脸注册函数
- * @param faceImage OpenCV格式的人脸图像
- * @return 成功返回分配的人脸ID（>=0），失败返回-1
- * @details 将新的人脸图像注册到人脸识别系统中
- *          1. 将OpenCV的Mat数据转换为SeetaFace引擎所需的SeetaImageData格式
- *          2. 调用Register方法执行人脸注册，返回分配的唯一人脸ID
- *          3. 注册成功后保存数据库，确保数据持久化
- * @note 注册过程包括人脸检测、关键点定位和特征提取三个步骤
+ * @brief 把OpenCV的Mat数据转为SeetaFace的图像数据
+ * @details 只复制头信息，像素数据仍由Mat持有
  */
-int64_t QFaceObject::face_register(cv::Mat &faceImage)
+SeetaImageData QFaceObject::seeta_image(const cv::Mat &image)
 {
-    //把OpenCV的Mat数据转为seetaface的数据
     SeetaImageData simage;
-    simage.data = faceImage.data;
-    simage.width = faceImage.cols;
-    simage.height = faceImage.rows;
-    simage.channels = faceImage.channels();
-    int64_t faceid = this->fengineptr->Register(simage);//注册返回一个人脸id
-    if(faceid >= 0){
-        fengineptr->Save("./face.db");
+    simage.data = image.data;           // 图像数据指针
+    simage.width = image.cols;          // 图像宽度（列数）
+    simage.height = image.rows;         // 图像高度（行数）
+    simage.channels = image.channels(); // 图像通道数（通常为3，BGR格式）
+    return simage;
+}
+
+int QFaceObject::largest_face(const SeetaFaceInfoArray &faces)
+{
+    int best = -1;
+    for(int i = 0; i < faces.size; i++){
+        if(best < 0 || faces.data[i].pos.width * faces.data[i].pos.height > faces.data[best].pos.width * faces.data[best].pos.height){
+            best = i;
+        }
     }
-    return faceid;
+    return best;
 }
 
 /**
- * @brief 人脸查询函数
- * @param faceImage 待查询的人脸图像（OpenCV Mat格式）
- * @return 匹配的人脸ID（成功）或-1（未匹配）
- * @details 在人脸数据库中查找最匹配的人脸
- *          1. 将OpenCV的Mat数据转换为SeetaFace引擎所需的SeetaImageData格式
- *          2. 调用Query方法在数据库中查找最匹配的人脸
- *          3. 计算相似度值
- *          4. 根据相似度阈值（0.7）判断识别结果
- *          5. 发送识别结果信号
- * @note 这是计算密集型操作，包含特征提取和特征比对过程
+ * @brief 确定用于关键点定位的人脸框
+ * @details 终端用Haar分类器检测过人脸，整帧再检测一次是识别中最耗时的一步
+ *          - trust：人脸框直接交给关键点定位，不运行检测器
+ *          - refine（默认，未知的配置值也按此处理）：人脸框四周各扩展一半，只在这一小块区域内检测，区域内没有检测到时仍使用终端的人脸框
+ *          - ignore或没有人脸框：在整帧上检测，有多张人脸时取面积最大的一张
  */
-int QFaceObject::face_query(cv::Mat &faceImage)
-{
-    // 步骤1: 格式转换 - 将OpenCV的Mat数据结构转换为SeetaFace引擎所需的SeetaImageData格式
-    SeetaImageData simage;  // SeetaFace引擎使用的数据结构
-    simage.data = faceImage.data;      // 图像数据指针
-    simage.width = faceImage.cols;     // 图像宽度（列数）
-    simage.height = faceImage.rows;    // 图像高度（行数）
-    simage.channels = faceImage.channels();  // 图像通道数（通常为3，RGB格式）
-    
-    // 步骤2: 初始化相似度变量 - 用于存储查询结果的相似度值
-    float similarity = 0;
-    
-    // 步骤3: 执行人脸查询 - 调用SeetaFace引擎的Query方法在数据库中查找最匹配的人脸
-    // 这是计算密集型操作，包含特征提取和特征比对过程
-    int64_t faceid = fengineptr->Query(simage, &similarity);
-    
-    // 步骤4: 调试输出 - 打印查询结果，包括人脸ID和相似度值
-    qDebug() << "查询" << faceid << similarity;
-    
-    // 步骤5: 相似度判断与结果处理
-    // 设置相似度阈值为0.7，这是一个经验值，平衡了识别准确率和召回率
-    if (similarity > 0.7) {
-        // 相似度高于阈值，认为识别成功，发送匹配的人脸ID
-        // 信号发射语句的核心是 emit 关键字，用于触发一个已声明的信号，进而通知所有连接到该信号的槽函数执行
-        // 这里的 send_faceid 信号用于将识别结果（人脸ID）发送给连接的槽函数（如UI界面）
-        emit send_faceid(faceid);
-    } else {
-        // 相似度低于阈值，认为未识别到匹配人脸，发送-1表示识别失败
-        emit send_faceid(-1);
+bool QFaceObject::locate_face(seeta::FaceDetector *detector, const cv::Mat &image, const cv::Rect &hint, SeetaRect &face)
+{
+    // 配置只在第一次调用时读取
+    static const QString mode = ServerConfig::client_face_mode();
+    const cv::Rect bounds(0, 0, image.cols, image.rows);
+    const cv::Rect rect = hint & bounds;
+    if(mode != "ignore" && rect.width >= CLIENT_FACE_MIN_SIZE && rect.height >= CLIENT_FACE_MIN_SIZE){
+        face = SeetaRect{rect.x, rect.y, rect.width, rect.height};
+        if(mode == "trust") return true;
+        cv::Rect roi = cv::Rect(rect.x - rect.width / 2, rect.y - rect.height / 2, rect.width * 2, rect.height * 2) & bounds;
+        // SeetaFace要求像素连续存放，子区域复制一份，只有整帧的几分之一
+        cv::Mat patch = image(roi).clone();
+        SeetaFaceInfoArray faces = detector->detect(seeta_image(patch));
+        int best = largest_face(faces);
+        if(best >= 0){
+            face = faces.data[best].pos;
+            face.x += roi.x;
+            face.y += roi.y;
+        }
+        return true;
     }
-    
-    // 步骤6: 返回查询结果ID，供调用者进一步处理
-    return faceid;
+
+    SeetaFaceInfoArray faces = detector->detect(seeta_image(image));
+    int best = largest_face(faces);
+    if(best < 0) return false;
+    face = faces.data[best].pos;
+    return true;
 }
 
+bool QFaceObject::extract_feature(const cv::Mat &faceImage, float *feature, FaceStageTimes *times, const cv::Rect &face)
+{
+    if(faceImage.empty()) return false;
+    SeetaImageData simage = seeta_image(faceImage);
+    QElapsedTimer timer;
+    timer.start();
 
+    // 步骤1: 人脸检测，终端已经给出人脸框时按配置跳过或缩小检测范围
+    SeetaRect rect;
+    bool found = locate_face(fdptr.get(), faceImage, face, rect);
+    if(times != nullptr) times->detect = timer.nsecsElapsed() / 1000;
+    if(!found) return false;
 
+    // 步骤2: 关键点定位，用于人脸对齐
+    std::vector<SeetaPointF> points(flptr->number());
+    timer.restart();
+    flptr->mark(simage, rect, points.data());
+    if(times != nullptr) times->landmark = timer.nsecsElapsed() / 1000;
 
+    // 步骤3: 提取特征向量
+    timer.restart();
+    bool ok = frptr->Extract(simage, points.data(), feature);
+    if(times != nullptr) times->extract = timer.nsecsElapsed() / 1000;
+    return ok;
+}
 
+int QFaceObject::feature_size() const
+{
+    return gallery.dimension();
+}
 
+bool QFaceObject::face_import(int64_t faceid, const cv::Mat &faceImage)
+{
+    std::vector<float> feature(feature_size());
+    if(!extract_feature(faceImage, feature.data())) return false;
+    return gallery.add(faceid, feature.data());
+}
 
+/**
+ * @brief 删除一张人脸
+ * @details 只在LiveGallery中追加删除记录并发布，近似搜索索引建立在只读的基础特征库上，不需要重建，
+ *          被删除的人脸在合并结果时过滤掉
+ */
+bool QFaceObject::face_remove(int64_t faceid)
+{
+    return LiveGallery::instance().remove(faceid);
+}
 
+bool QFaceObject::save_gallery()
+{
+    return LiveGallery::instance().save_snapshot(gallery);
+}
 
+std::vector<std::vector<FaceMatch>> QFaceObject::face_query_batch(const std::vector<cv::Mat> &images, int k,
+                                                                  std::vector<FaceStageTimes> *times,
+                                                                  const std::vector<cv::Rect> *faces,
+                                                                  const std::vector<std::vector<float>> *features)
+{
+    std::vector<std::vector<FaceMatch>> results(images.size());
+    const int dim = feature_size();
+    if(times != nullptr) times->assign(images.size(), FaceStageTimes());
 
+    // 步骤1: 逐张提取特征，终端已经提取的特征直接使用，记录每个特征对应的图像下标
+    std::vector<float> probefeatures(images.size() * dim);
+    std::vector<int> probes;
+    for(std::size_t i = 0; i < images.size(); i++){
+        float *probe = probefeatures.data() + probes.size() * dim;
+        if(features != nullptr && !(*features)[i].empty()){
+            const std::vector<float> &feature = (*features)[i];
+            if((int)feature.size() != dim){
+                qDebug()<<"终端特征维度"<<feature.size()<<"与识别模型"<<dim<<"不一致";
+                continue;
+            }
+            std::copy(feature.begin(), feature.end(), probe);
+            probes.push_back((int)i);
+            continue;
+        }
+        FaceStageTimes *t = times != nullptr ? &(*times)[i] : nullptr;
+        cv::Rect face = faces != nullptr ? (*faces)[i] : cv::Rect();
+        if(extract_feature(images[i], probe, t, face)){
+            probes.push_back((int)i);
+        }
+    }
+    if(probes.empty()) return results;
+
+    // 步骤2: 精确搜索时整批做一次矩阵乘法，近似搜索时逐个查询
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<std::vector<FaceMatch>> matches = search_features(probefeatures.data(), (int)probes.size(), k);
+    for(std::size_t p = 0; p < probes.size(); p++){
+        results[probes[p]].swap(matches[p]);
+    }
+    if(times != nullptr){
+        qint64 search = timer.nsecsElapsed() / 1000;
+        for(int i : probes) (*times)[i].search = search;
+    }
+    return results;
+}
 
+std::vector<std::vector<FaceMatch>> QFaceObject::search_features(const float *features, int count, int k)
+{
+    // 整批使用同一个特征库版本，期间发布的新版本从下一批开始生效
+    // 近似搜索索引随版本发布，所有工作对象共享，工作对象自己不持有索引
+    return LiveGallery::instance().current()->search_batch(features, count, k);
+}
 
+float QFaceObject::similarity_threshold()
+{
+    return SIMILARITY_THRESHOLD;
+}
 
+int QFaceObject::result_topk() const
+{
+    return topk;
+}
 
+std::vector<FaceResult> QFaceObject::face_query_requests(const std::vector<FaceRequest> &requests)
+{
+    std::vector<FaceResult> results(requests.size());
+    if(requests.empty()) return results;
 
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<cv::Mat> images;
+    std::vector<cv::Rect> faces;
+    std::vector<std::vector<float>> features;
+    images.reserve(requests.size());
+    faces.reserve(requests.size());
+    features.reserve(requests.size());
+    for(const FaceRequest &request : requests){
+        images.push_back(request.image);
+        faces.push_back(request.face);
+        features.push_back(request.feature);
+    }
+    std::vector<FaceStageTimes> times;
+    std::vector<std::vector<FaceMatch>> matches = face_query_batch(images, topk, &times, &faces, &features);
+    qint64 total = timer.nsecsElapsed() / 1000;
+    if(requests.size() > 1) qDebug()<<"批量查询"<<requests.size()<<"帧";
 
+    for(std::size_t i = 0; i < requests.size(); i++){
+        FaceResult &result = results[i];
+        result.matches.swap(matches[i]);
+        result.times = times[i];
+        result.times.total = total;
+        if(requests[i].queued.isValid()) result.times.queue = requests[i].queued.nsecsElapsed() / 1000 - total;
+        if(!result.matches.empty()){
+            qDebug()<<"查询"<<result.matches.front().faceid<<result.matches.front().similarity;
+            if(result.matches.front().similarity > SIMILARITY_THRESHOLD) result.faceid = result.matches.front().faceid;
+        }
+        emit send_result(requests[i].sessionid, requests[i].requestid, result);
+    }
+    return results;
+}
 
+/**
+ * @brief 人脸注册函数
+ * @param faceImage OpenCV格式的人脸图像
+ * @return 成功返回分配的人脸ID（>=0），失败返回-1
+ * @details 将新的人脸图像注册到人脸识别系统中
+ *          1. 检测人脸、定位关键点并提取特征向量
+ *          2. 交给LiveGallery分配新的人脸ID，追加一条日志记录后发布给所有工作对象，
+ *             记录数达到阈值时在后台压缩为快照
+ *          近似搜索索引只覆盖启动时的快照，新注册的人脸在增量中精确比对，不修改索引
+ * @note 注册过程包括人脸检测、关键点定位和特征提取三个步骤
+ */
+int64_t QFaceObject::face_register(cv::Mat &faceImage)
+{
+    // 提取特征后分配新的人脸ID加入特征库
+    std::vector<float> feature(feature_size());
+    if(!extract_feature(faceImage, feature.data())) return -1;
+    // 发布给所有工作对象，下一次查询即可识别新注册的人脸
+    return LiveGallery::instance().add(feature.data());
+}
 
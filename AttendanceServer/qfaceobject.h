@@ -1,14 +1,36 @@
 #ifndef QFACEOBJECT_H
 #define QFACEOBJECT_H
 
+#include "facegallery.h"
+#include "faceresult.h"
+#include "faceengineregistry.h"
+#include "livegallery.h"
 #include <QObject>
-#include <seeta/FaceEngine.h>
+#include <QElapsedTimer>
 #include <opencv.hpp>
 #include <QDebug>
 
+/**
+ * @brief 一次人脸查询请求
+ * @details 工作池把同一工作对象上排队的多个请求合并成一批处理
+ */
+struct FaceRequest
+{
+    quint64 sessionid;  ///< 客户端会话ID
+    quint64 requestid;  ///< 会话内的请求ID
+    cv::Mat image;      ///< 待识别的图像
+    cv::Rect face;      ///< 终端检测到的人脸框，没有时为空
+    std::vector<float> feature; ///< 终端提取的特征，非空时image为空，直接比对
+    QElapsedTimer queued; ///< 进入队列时开始计时，未启动表示没有经过队列
+};
+
 /**
  * @brief 人脸识别核心类
- * @details 封装SeetaFace引擎，提供人脸检测、特征提取、人脸注册和识别功能
+ * @details 封装SeetaFace的人脸检测、关键点定位和特征提取模块，提供人脸注册和识别功能
+ *          特征比对不再交给SeetaFace引擎内部的数据库，而是由FaceGallery在连续的特征矩阵上完成
+ *          人脸库很大时可以在server.ini中把搜索后端切换为HNSW近似搜索，内存不足时可切换为IVF-PQ压缩搜索，
+ *          索引由LiveGallery在后台建立，与特征库一起随版本发布，所有工作对象共享
+ *          特征库由LiveGallery统一持有，注册和删除通过它追加日志并发布，查询时合并，无需重启即可识别
  *          支持在独立线程中运行，避免阻塞UI线程
  */
 class QFaceObject : public QObject
@@ -18,46 +40,169 @@ public:
     /**
      * @brief 构造函数
      * @param parent 父对象指针，用于Qt对象树管理
+     * @param searchonly 为true时只加载特征库，不取用SeetaFace引擎，只能调用search_features
      * @details 初始化人脸识别核心对象，创建并配置SeetaFace引擎
      * @note 使用explicit关键字防止隐式转换
      */
-    explicit QFaceObject(QObject *parent = nullptr);
+    explicit QFaceObject(QObject *parent = nullptr, bool searchonly = false);
     /**
      * @brief 析构函数
      * @details 释放人脸识别引擎资源
      */
     ~QFaceObject();
 
+    /**
+     * @brief 提取人脸特征
+     * @param faceImage BGR格式的图像
+     * @param feature 输出特征，长度为feature_size()
+     * @param times 输出检测、关键点定位和特征提取的耗时，可为nullptr
+     * @param face 终端检测到的人脸框，为空时在整帧上检测
+     * @return 图像中没有检测到人脸时返回false
+     * @details 依次执行人脸检测、5点关键点定位和特征提取，图像中有多张人脸时取面积最大的一张
+     */
+    bool extract_feature(const cv::Mat &faceImage, float *feature, FaceStageTimes *times = nullptr,
+                         const cv::Rect &face = cv::Rect());
+
+    /**
+     * @brief 确定用于关键点定位的人脸框
+     * @param detector 人脸检测器
+     * @param image BGR格式的图像
+     * @param hint 终端检测到的人脸框，为空时在整帧上检测
+     * @param face 输出人脸框
+     * @return 没有找到人脸时返回false
+     * @details 按recognition/client_face的配置直接使用终端的人脸框，或只在它周围的小区域内检测；
+     *          人脸框超出图像的部分被裁掉，太小时退回整帧检测
+     */
+    static bool locate_face(seeta::FaceDetector *detector, const cv::Mat &image, const cv::Rect &hint, SeetaRect &face);
+
+    /**
+     * @brief 把OpenCV的Mat数据转为SeetaFace的图像数据
+     * @details 只复制头信息，像素数据仍由Mat持有
+     */
+    static SeetaImageData seeta_image(const cv::Mat &image);
+
+    /**
+     * @brief 检测结果中面积最大的人脸
+     * @return 人脸下标，没有检测到人脸时返回-1
+     */
+    static int largest_face(const SeetaFaceInfoArray &faces);
+
+    /**
+     * @brief 特征向量的维度
+     */
+    int feature_size() const;
+
+    /**
+     * @brief 以指定的人脸ID导入人脸
+     * @param faceid 人脸ID
+     * @param faceImage 包含人脸的图像
+     * @return 提取特征失败时返回false
+     * @details 用于从员工头像重建特征库，导入到本对象自己的特征库中，不会立即保存，导入完成后调用save_gallery()
+     */
+    bool face_import(int64_t faceid, const cv::Mat &faceImage);
+
+    /**
+     * @brief 批量人脸查询
+     * @param images 待识别的图像
+     * @param k 每张图像返回的结果数
+     * @param times 输出与images一一对应的各阶段耗时，可为nullptr
+     * @param faces 与images一一对应的终端人脸框，可为nullptr
+     * @param features 与images一一对应的终端特征，可为nullptr；非空的特征直接参与比对，不再处理对应的图像
+     * @return 与images一一对应的前k个结果，按相似度从高到低排列；没有检测到人脸或特征维度不符的结果为空
+     * @details 先依次提取所有图像的特征，精确搜索时再把全部特征与特征库做一次分块矩阵乘法，
+     *          特征库的内存带宽由整批查询分摊；近似搜索后端逐个查询
+     */
+    std::vector<std::vector<FaceMatch>> face_query_batch(const std::vector<cv::Mat> &images, int k = 1,
+                                                         std::vector<FaceStageTimes> *times = nullptr,
+                                                         const std::vector<cv::Rect> *faces = nullptr,
+                                                         const std::vector<std::vector<float>> *features = nullptr);
+
+    /**
+     * @brief 批量特征比对
+     * @param features count个查询特征，按行连续存放
+     * @param count 查询数
+     * @param k 每个查询返回的结果数
+     * @return 每个查询的前k个结果，按相似度从高到低排列
+     * @details 精确搜索时整批做一次分块矩阵乘法，近似搜索后端逐个查询，
+     *          整批使用同一个特征库版本
+     */
+    std::vector<std::vector<FaceMatch>> search_features(const float *features, int count, int k);
+
+    /**
+     * @brief 识别成功的相似度阈值
+     */
+    static float similarity_threshold();
+
+    /**
+     * @brief 识别结果中保留的候选数
+     */
+    int result_topk() const;
+
+    /**
+     * @brief 处理一批排队的查询请求
+     * @param requests 查询请求
+     * @return 与requests一一对应的识别结果
+     * @details 调用face_query_batch识别整批图像和终端特征，按相似度阈值判定结果，
+     *          每个请求的识别结果仍然分别通过send_result发出
+     */
+    std::vector<FaceResult> face_query_requests(const std::vector<FaceRequest> &requests);
+
+    /**
+     * @brief 删除一张人脸
+     * @param faceid 人脸ID
+     * @return 人脸ID不存在时返回false
+     * @details 通过LiveGallery向日志追加一条删除记录并发布，不使用引擎，不需要创建对象即可调用；
+     *          员工从查询窗口删除之后调用，被删除的人脸从下一次查询起不再被识别
+     */
+    static bool face_remove(int64_t faceid);
+
+    /**
+     * @brief 把face_import导入的特征库完整保存为快照
+     * @details 用于重建特征库之后，保存成功后清空日志
+     */
+    bool save_gallery();
+
 public slots:
     /**
      * @brief 人脸注册槽函数
      * @param faceImage 包含人脸的OpenCV Mat格式图像
      * @return 成功注册的人脸ID（>=0），失败返回-1
-     * @details 将新的人脸图像注册到系统中，提取人脸特征并分配唯一ID
+     * @details 将新的人脸图像注册到系统中，提取人脸特征后由LiveGallery分配唯一ID，
+     *          只向日志追加一条记录，不重写整个特征库文件
      */
     int64_t face_register(cv::Mat& faceImage);
-    
-    /**
-     * @brief 人脸查询槽函数
-     * @param faceImage 待查询的人脸图像
-     * @return 匹配的人脸ID（>=0），未匹配返回-1
-     * @details 在注册数据库中查询匹配的人脸，提取当前人脸特征并与已注册特征比对
-     */
-    int face_query(cv::Mat& faceImage);
 
 signals:
     /**
-     * @brief 发送人脸ID信号
-     * @param faceid 识别出的人脸ID
+     * @brief 发送识别结果信号
+     * @param sessionid 发送该帧的客户端会话ID
+     * @param requestid 会话内的请求ID
+     * @param result 识别结果，包括判定的人脸ID、前k个候选和各阶段耗时
      * @details 当人脸识别完成后发送识别结果，供其他组件处理
      */
-    void send_faceid(int64_t faceid);
+    void send_result(quint64 sessionid, quint64 requestid, FaceResult result);
 private:
     /**
-     * @brief SeetaFace引擎指针
-     * @details 核心人脸识别引擎对象，负责执行人脸检测、关键点定位和特征提取等底层算法
+     * @brief SeetaFace人脸检测器
+     * @details 负责在图像中定位人脸矩形框，从FaceEngineRegistry取用，对象析构时归还
+     */
+    std::shared_ptr<seeta::FaceDetector> fdptr;
+    /**
+     * @brief SeetaFace关键点定位器
+     * @details 负责在人脸框内定位5个关键点，用于人脸对齐
+     */
+    std::shared_ptr<seeta::FaceLandmarker> flptr;
+    /**
+     * @brief SeetaFace人脸识别器
+     * @details 负责根据关键点对齐人脸并提取特征向量
+     */
+    std::shared_ptr<seeta::FaceRecognizer> frptr;
+    /**
+     * @brief 导入的人脸特征库
+     * @details 只用于face_import从员工头像重建，查询使用LiveGallery的当前版本
      */
-    seeta::FaceEngine *fengineptr;
+    FaceGallery gallery;
+    int topk;               ///< 识别结果中保留的候选数
 };
 
 #endif // QFACEOBJECT_H
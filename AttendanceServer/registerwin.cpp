@@ -3,22 +3,47 @@
 #include "ui_registerwin.h"
 #include <QFileDialog>
 #include <qfaceobject.h>
+#include "employeedirectory.h"
 #include <QSqlTableModel>
 #include <QSqlRecord>
 #include <QMessageBox>
+#include <QThread>
+#include <QCoreApplication>
 
 RegisterWin::RegisterWin(QWidget *parent)
     : QWidget(parent)
     , ui(new Ui::RegisterWin)
+    , preload(nullptr)
 {
     ui->setupUi(this);
+
+    // 注册使用的人脸识别对象在后台线程中创建，识别线程占用全部引擎时需要加载一套新模型，耗时以秒计，不阻塞界面
+    // 对象创建后移回主线程，之后与窗口同生命周期，每次注册都复用
+    preload = QThread::create([this](){
+        QFaceObject *object = new QFaceObject();
+        object->moveToThread(QCoreApplication::instance()->thread());
+        faceobj.reset(object);
+    });
+    preload->start();
 }
 
 RegisterWin::~RegisterWin()
 {
+    face_object();
+    faceobj.reset(); // 引擎回到注册表的空闲池
     delete ui;
 }
 
+QFaceObject *RegisterWin::face_object()
+{
+    if(preload != nullptr){
+        preload->wait();
+        delete preload;
+        preload = nullptr;
+    }
+    return faceobj.get();
+}
+
 // 定时器事件处理函数
 // 功能：
 // - 定期从摄像头获取图像数据
@@ -119,9 +144,9 @@ void RegisterWin::on_registerBtn_clicked()
 {
     // 通过照片，结合QFaceObject模块得到faceID
     // 这是人脸注册的核心流程，将用户上传的照片转换为唯一的faceID
-    QFaceObject faceobj;                                         // 创建人脸识别对象，用于调用SeetaFace引擎功能
+    // 人脸识别对象在窗口创建时已经准备好，模型还在加载时等待加载完成
     cv::Mat image = cv::imread(ui->picfileEdit->text().toUtf8().data());  // 从界面获取的图片路径，转换为OpenCV的Mat格式
-    int64_t faceID = faceobj.face_register(image);
+    int64_t faceID = face_object()->face_register(image);
     qDebug()<<faceID;    // 调用人脸注册接口，返回唯一的faceID用于后续考勤识别
 
     // 生成头像文件保存路径 - 定义图像存储位置和命名规则
@@ -166,6 +191,9 @@ void RegisterWin::on_registerBtn_clicked()
         // submitAll()方法将所有修改（包括新添加的记录）提交到数据库
         // 这是Qt SQL模型类的核心方法，确保内存中的数据变更被保存到物理数据库
         model.submitAll();
+
+        // 新员工加入员工目录，考勤服务识别到该人脸时可以直接查到
+        EmployeeDirectory::instance().reload(faceID);
     }else{
         // 注册失败：显示失败提示消息框
         // 用户界面保持不变，允许用户修改信息后重新尝试注册
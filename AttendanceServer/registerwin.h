@@ -3,6 +3,10 @@
 
 #include <QWidget>
 #include <opencv.hpp>
+#include <memory>
+
+class QFaceObject;
+class QThread;
 
 namespace Ui {
 class RegisterWin;
@@ -16,6 +20,7 @@ class RegisterWin;
  * - 头像上传或摄像头拍照
  * - 人脸特征提取和注册
  * - 员工信息保存
+ * 注册使用的人脸识别对象在窗口创建时由后台线程准备，之后一直复用，点击注册时不再创建对象、取用引擎
  */
 class RegisterWin : public QWidget
 {
@@ -84,6 +89,14 @@ private:
     int timeid;                  // 定时器ID
     cv::VideoCapture cap;        // 摄像头对象
     cv::Mat image;               // 摄像头采集图像
+    std::unique_ptr<QFaceObject> faceobj; // 注册使用的人脸识别对象，窗口存续期间一直持有一套SeetaFace引擎
+    QThread *preload;            // 准备faceobj的后台线程，准备完成并被等待过之后为nullptr
+
+    /**
+     * @brief 等待后台线程准备好人脸识别对象
+     * 功能：窗口刚创建、模型还在加载时点击注册，在这里等待加载完成
+     */
+    QFaceObject *face_object();
 };
 
 #endif // REGISTERWIN_H
@@ -1,5 +1,9 @@
 #include "seletwin.h"
 #include "ui_seletwin.h"
+#include "employeedirectory.h"
+#include "qfaceobject.h"
+#include <QSqlQuery>
+#include <QSqlRecord>
 
 /**
  * @brief 构造函数
@@ -15,6 +19,35 @@ SeletWin::SeletWin(QWidget *parent)
 {
     ui->setupUi(this);
     model = new QSqlTableModel(); // 创建数据库表模型，用于数据查询和显示
+
+    // 在表格中修改或删除员工后重新加载员工目录
+    // 信号在写入数据库之前发出，排队到写入完成之后再加载
+    auto reload_directory = [this](){
+        if(model->tableName() != "employee") return;
+        QMetaObject::invokeMethod(this,[](){
+            EmployeeDirectory::instance().load();
+        }, Qt::QueuedConnection);
+    };
+    connect(model,&QSqlTableModel::beforeUpdate,this,reload_directory);
+    connect(model,&QSqlTableModel::beforeDelete,this,reload_directory);
+
+    // 删除员工的同时从特征库中删除其人脸，否则被删除的员工仍会被识别出faceID
+    // 删除之前记下faceID，排队到写入之后确认员工记录确实已经删除再删除人脸
+    connect(model,&QSqlTableModel::beforeDelete,this,[this](int row){
+        if(model->tableName() != "employee") return;
+        bool ok = false;
+        const qint64 faceid = model->record(row).value("faceID").toLongLong(&ok);
+        if(!ok || faceid < 0) return;
+        QMetaObject::invokeMethod(this,[faceid](){
+            QSqlQuery query;
+            query.prepare("select count(*) from employee where faceID = ?");
+            query.addBindValue(faceid);
+            if(!query.exec() || !query.next() || query.value(0).toInt() > 0) return;
+            if(!QFaceObject::face_remove(faceid)){
+                qDebug()<<"从特征库删除人脸失败："<<faceid;
+            }
+        }, Qt::QueuedConnection);
+    });
 }
 
 SeletWin::~SeletWin()
@@ -36,9 +69,13 @@ void SeletWin::on_selectBtn_clicked()
 {
     if(ui->empRb->isChecked()){
         model->setTable("employee");//设置为员工表
+        ui->tableView->setEditTriggers(QAbstractItemView::DoubleClicked | QAbstractItemView::EditKeyPressed
+                                       | QAbstractItemView::AnyKeyPressed);
     }
     if(ui->attRb->isChecked()){
         model->setTable("attendance");//设置为考勤表
+        // attendance是合并各月分区的视图，不能写入，考勤记录只读显示
+        ui->tableView->setEditTriggers(QAbstractItemView::NoEditTriggers);
     }
 
     //设置过滤器（目前注释掉，可根据需要启用）
@@ -0,0 +1,174 @@
+#include "serverconfig.h"
+
+#include <QSettings>
+#include <QThread>
+
+/**
+ * @brief 配置文件路径
+ * @details 与server.db、face.db一样放在程序当前目录
+ */
+static const char *CONFIG_FILE = "./server.ini";
+
+QVariant ServerConfig::value(const QString &key, const QVariant &defaultValue)
+{
+    // QSettings不是线程安全的共享对象，每次读取时单独构造，配置只在启动阶段读取，开销可以忽略
+    QSettings settings(CONFIG_FILE, QSettings::IniFormat);
+    return settings.value(key, defaultValue);
+}
+
+int ServerConfig::worker_count()
+{
+    int count = value("recognition/workers", 0).toInt();
+    if(count <= 0){
+        // 默认每个CPU核心一个识别线程
+        count = QThread::idealThreadCount();
+    }
+    return count > 0 ? count : 1;
+}
+
+bool ServerConfig::pipeline_enabled()
+{
+    return value("recognition/pipeline", false).toBool();
+}
+
+int ServerConfig::pipeline_threads(const QString &stage)
+{
+    // 检测和特征提取是最耗时的两个阶段，默认多分配一个线程
+    int defaultCount = (stage == "detect" || stage == "extract") ? 2 : 1;
+    int count = value(QString("pipeline/%1_threads").arg(stage), defaultCount).toInt();
+    return count > 0 ? count : 1;
+}
+
+int ServerConfig::pipeline_queue_capacity()
+{
+    int capacity = value("pipeline/queue_capacity", 8).toInt();
+    return capacity > 0 ? capacity : 1;
+}
+
+int ServerConfig::admission_capacity()
+{
+    int capacity = value("recognition/admission_capacity", 0).toInt();
+    if(capacity <= 0){
+        // 每个工作线程一帧正在排队、一帧等待合并
+        capacity = worker_count() * 2;
+    }
+    return capacity;
+}
+
+int ServerConfig::max_queue_age()
+{
+    int age = value("recognition/max_queue_age", 1000).toInt();
+    return age > 0 ? age : 0;
+}
+
+int ServerConfig::result_topk()
+{
+    int k = value("recognition/topk", 5).toInt();
+    return k > 0 ? k : 1;
+}
+
+bool ServerConfig::benchmark_scaling()
+{
+    return value("recognition/benchmark_scaling", false).toBool();
+}
+
+QString ServerConfig::client_face_mode()
+{
+    return value("recognition/client_face", "refine").toString().toLower();
+}
+
+int ServerConfig::journal_compact_records()
+{
+    int count = value("gallery/journal_compact", 1000).toInt();
+    return count > 0 ? count : 1;
+}
+
+bool ServerConfig::verify_snapshot()
+{
+    return value("gallery/verify_snapshot", false).toBool();
+}
+
+bool ServerConfig::benchmark_startup()
+{
+    return value("gallery/benchmark_startup", false).toBool();
+}
+
+QString ServerConfig::search_backend()
+{
+    return value("search/backend", "exact").toString().toLower();
+}
+
+int ServerConfig::hnsw_m()
+{
+    return value("search/hnsw_m", 16).toInt();
+}
+
+int ServerConfig::hnsw_ef_construction()
+{
+    return value("search/hnsw_ef_construction", 200).toInt();
+}
+
+int ServerConfig::hnsw_ef_search()
+{
+    return value("search/hnsw_ef_search", 64).toInt();
+}
+
+int ServerConfig::ivfpq_nlist()
+{
+    return value("search/ivfpq_nlist", 0).toInt();
+}
+
+int ServerConfig::ivfpq_m()
+{
+    return value("search/ivfpq_m", 128).toInt();
+}
+
+int ServerConfig::ivfpq_nprobe()
+{
+    return value("search/ivfpq_nprobe", 16).toInt();
+}
+
+int ServerConfig::ivfpq_rerank()
+{
+    return value("search/ivfpq_rerank", 64).toInt();
+}
+
+double ServerConfig::ivfpq_retrain_drift()
+{
+    return value("search/ivfpq_retrain_drift", 0.2).toDouble();
+}
+
+int ServerConfig::evaluate_samples()
+{
+    return value("search/evaluate_samples", 0).toInt();
+}
+
+bool ServerConfig::benchmark_reply()
+{
+    return value("protocol/benchmark_reply", false).toBool();
+}
+
+bool ServerConfig::benchmark_writer()
+{
+    return value("database/benchmark_writer", false).toBool();
+}
+
+int ServerConfig::debounce_seconds()
+{
+    return qMax(0, value("attendance/debounce_seconds", 300).toInt());
+}
+
+int ServerConfig::archive_months()
+{
+    return value("attendance/archive_months", 0).toInt();
+}
+
+QString ServerConfig::archive_dir()
+{
+    return value("attendance/archive_dir", "./archive").toString();
+}
+
+int ServerConfig::preview_fps()
+{
+    return value("ui/preview_fps", 5).toInt();
+}
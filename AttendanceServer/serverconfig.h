@@ -0,0 +1,203 @@
+#ifndef SERVERCONFIG_H
+#define SERVERCONFIG_H
+
+#include <QString>
+#include <QVariant>
+
+/**
+ * @brief 服务器配置类
+ * @details 从程序当前目录下的server.ini读取部署相关的参数，文件不存在时全部使用默认值
+ *          每个考勤现场可以按终端数量和服务器硬件调整这些参数，无需重新编译
+ *          server.ini示例：
+ *          [recognition]
+ *          workers=8
+ *          [search]
+ *          backend=hnsw
+ */
+class ServerConfig
+{
+public:
+    /**
+     * @brief 读取任意配置项
+     * @param key 配置键，格式为"分组/名称"
+     * @param defaultValue 配置不存在时的默认值
+     */
+    static QVariant value(const QString &key, const QVariant &defaultValue = QVariant());
+
+    /**
+     * @brief 人脸识别工作线程数量
+     * @return 配置项recognition/workers，未配置或<=0时使用CPU核心数
+     */
+    static int worker_count();
+
+    /**
+     * @brief 是否使用分阶段流水线识别
+     * @return 配置项recognition/pipeline，默认false使用工作池，每个工作对象完成整帧识别
+     */
+    static bool pipeline_enabled();
+
+    /**
+     * @brief 流水线各阶段的线程数
+     * @param stage 阶段名称：detect、landmark、extract或search
+     * @return 配置项pipeline/<stage>_threads，默认检测和特征提取各2个线程，关键点定位和比对各1个，至少为1
+     */
+    static int pipeline_threads(const QString &stage);
+
+    /**
+     * @brief 流水线各阶段之间队列的容量
+     * @return 配置项pipeline/queue_capacity，默认8，至少为1
+     */
+    static int pipeline_queue_capacity();
+
+    /**
+     * @brief 等待识别的帧数上限
+     * @return 配置项recognition/admission_capacity，默认0表示工作线程数的2倍；
+     *         队列满时丢弃等待最久的帧；开启流水线时限制的是送入流水线之前的准入队列
+     */
+    static int admission_capacity();
+
+    /**
+     * @brief 帧的最长排队时间，单位毫秒
+     * @return 配置项recognition/max_queue_age，默认1000，排队超过该时间的帧不再识别；0表示不限制
+     */
+    static int max_queue_age();
+
+    /**
+     * @brief 识别结果中保留的候选数
+     * @return 配置项recognition/topk，默认5，至少为1
+     */
+    static int result_topk();
+
+    /**
+     * @brief 启动时是否运行识别吞吐量的扩展性评估
+     * @return 配置项recognition/benchmark_scaling，默认false；评估使用员工头像，工作线程数从1增加到worker_count()
+     */
+    static bool benchmark_scaling();
+
+    /**
+     * @brief 终端上传的人脸框的用法
+     * @return 配置项recognition/client_face：refine只在人脸框周围的小区域内检测（默认）；
+     *         trust直接在人脸框上定位关键点，跳过检测，终端的Haar框不够准时会降低识别率；ignore忽略人脸框，在整帧上检测
+     */
+    static QString client_face_mode();
+
+    /**
+     * @brief 触发特征库日志压缩的记录数
+     * @return 配置项gallery/journal_compact，默认1000，至少为1
+     */
+    static int journal_compact_records();
+
+    /**
+     * @brief 加载特征库快照时是否检查特征矩阵的校验和
+     * @return 配置项gallery/verify_snapshot，默认false；检查需要读取整个快照，会抵消映射加载节省的启动时间
+     */
+    static bool verify_snapshot();
+
+    /**
+     * @brief 启动时是否运行特征库加载耗时评估
+     * @return 配置项gallery/benchmark_startup，默认false
+     */
+    static bool benchmark_startup();
+
+    /**
+     * @brief 人脸特征搜索后端
+     * @return 配置项search/backend：exact为精确搜索（默认），hnsw为HNSW近似搜索，ivfpq为IVF-PQ压缩搜索
+     */
+    static QString search_backend();
+
+    /**
+     * @brief HNSW每个节点的邻居数M
+     * @return 配置项search/hnsw_m，默认16
+     */
+    static int hnsw_m();
+
+    /**
+     * @brief HNSW建图时的候选集大小
+     * @return 配置项search/hnsw_ef_construction，默认200
+     */
+    static int hnsw_ef_construction();
+
+    /**
+     * @brief HNSW查询时的候选集大小
+     * @return 配置项search/hnsw_ef_search，默认64
+     */
+    static int hnsw_ef_search();
+
+    /**
+     * @brief IVF-PQ粗量化簇数
+     * @return 配置项search/ivfpq_nlist，默认0表示按人脸数自动选择
+     */
+    static int ivfpq_nlist();
+
+    /**
+     * @brief IVF-PQ乘积量化段数，即每张人脸的编码字节数
+     * @return 配置项search/ivfpq_m，默认128
+     */
+    static int ivfpq_m();
+
+    /**
+     * @brief IVF-PQ查询时扫描的簇数
+     * @return 配置项search/ivfpq_nprobe，默认16
+     */
+    static int ivfpq_nprobe();
+
+    /**
+     * @brief IVF-PQ参与精确重排的候选数
+     * @return 配置项search/ivfpq_rerank，默认64
+     */
+    static int ivfpq_rerank();
+
+    /**
+     * @brief IVF-PQ索引需要重新训练的变化比例
+     * @return 配置项search/ivfpq_retrain_drift，默认0.2；索引文件与快照相比增删的人脸数
+     *         不超过索引人脸数的这一比例时，沿用已训练的簇中心和码本增量编码，超过时重新训练
+     */
+    static double ivfpq_retrain_drift();
+
+    /**
+     * @brief 近似搜索评估的抽样查询数
+     * @return 配置项search/evaluate_samples，大于0时索引就绪后输出召回率和延迟，默认0不评估
+     */
+    static int evaluate_samples();
+
+    /**
+     * @brief 启动时是否比较JSON和二进制应答的编解码耗时
+     * @return 配置项protocol/benchmark_reply，默认false
+     */
+    static bool benchmark_reply();
+
+    /**
+     * @brief 启动时是否比较逐条提交和组提交的考勤写入吞吐量
+     * @return 配置项database/benchmark_writer，默认false
+     */
+    static bool benchmark_writer();
+
+    /**
+     * @brief 考勤去重窗口，单位秒
+     * @return 配置项attendance/debounce_seconds，默认300；同一员工当天距上一条考勤记录不足该时长时不再记录，0为不去重
+     */
+    static int debounce_seconds();
+
+    /**
+     * @brief 考勤热数据保留的月数
+     * @return 配置项attendance/archive_months，包括当月，默认0不归档；更早的月分区在启动时移动到归档目录
+     */
+    static int archive_months();
+
+    /**
+     * @brief 考勤归档目录
+     * @return 配置项attendance/archive_dir，默认./archive，每个月一个数据库文件
+     */
+    static QString archive_dir();
+
+    /**
+     * @brief 服务器界面中考勤图像预览的最高帧率
+     * @return 配置项ui/preview_fps，默认5，0为不显示预览；无界面的attendance-serverd不使用
+     */
+    static int preview_fps();
+
+private:
+    ServerConfig() = delete;
+};
+
+#endif // SERVERCONFIG_H
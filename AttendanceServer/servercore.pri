@@ -0,0 +1,74 @@
+# 考勤服务核心：网络会话、人脸识别和考勤记录，不依赖图形界面
+# 图形界面的AttendanceServer.pro和无界面的serverd/attendance-serverd.pro都包含本文件
+QT += core network sql
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+#window平台opencv，seetaface环境
+win32{
+LIBS +=C:\opencv452\x64\mingw\lib\libopencv*
+LIBS +=C:\SeetaFace\lib\libSeeta*
+INCLUDEPATH +=C:\opencv452\include
+INCLUDEPATH += C:\opencv452\include\opencv2
+INCLUDEPATH += C:\SeetaFace\include
+INCLUDEPATH += C:\SeetaFace\include\seeta
+}
+
+#linux平台opencv seetaface环境
+unix{
+LIBS += -L/opt/opencv4-pc/lib -lopencv_world \
+-lSeetaFaceDetector \
+-lSeetaFaceLandmarker \
+-lSeetaFaceRecognizer \
+-lSeetaFaceTracker \
+-lSeetaNet \
+-lSeetaQualityAssessor \
+
+INCLUDEPATH += /opt/opencv4-pc/include/opencv4
+INCLUDEPATH += /opt/opencv4-pc/include/opencv4/opencv2
+INCLUDEPATH += /opt/opencv4-pc/include
+INCLUDEPATH += /opt/opencv4-pc/include/seeta
+}
+
+SOURCES += \
+    $$PWD/attendancereply.cpp \
+    $$PWD/attendanceservice.cpp \
+    $$PWD/attendancestore.cpp \
+    $$PWD/attendancewriter.cpp \
+    $$PWD/checkindebouncer.cpp \
+    $$PWD/clientsession.cpp \
+    $$PWD/employeedirectory.cpp \
+    $$PWD/faceengineregistry.cpp \
+    $$PWD/facepipeline.cpp \
+    $$PWD/facegallery.cpp \
+    $$PWD/facejournal.cpp \
+    $$PWD/framepacket.cpp \
+    $$PWD/faceresult.cpp \
+    $$PWD/faceworkerpool.cpp \
+    $$PWD/hnswindex.cpp \
+    $$PWD/ivfpqindex.cpp \
+    $$PWD/livegallery.cpp \
+    $$PWD/qfaceobject.cpp \
+    $$PWD/serverconfig.cpp
+
+HEADERS += \
+    $$PWD/attendancereply.h \
+    $$PWD/attendanceservice.h \
+    $$PWD/attendancestore.h \
+    $$PWD/attendancewriter.h \
+    $$PWD/checkindebouncer.h \
+    $$PWD/clientsession.h \
+    $$PWD/employeedirectory.h \
+    $$PWD/faceengineregistry.h \
+    $$PWD/facepipeline.h \
+    $$PWD/facegallery.h \
+    $$PWD/facejournal.h \
+    $$PWD/framepacket.h \
+    $$PWD/faceresult.h \
+    $$PWD/faceworkerpool.h \
+    $$PWD/hnswindex.h \
+    $$PWD/ivfpqindex.h \
+    $$PWD/livegallery.h \
+    $$PWD/qfaceobject.h \
+    $$PWD/serverconfig.h
@@ -0,0 +1,19 @@
+# 无界面的考勤服务器，只依赖QtCore、QtNetwork和QtSql，可以在没有X的机架服务器上运行
+# 与图形界面版本使用同一个server.db、人脸特征库和server.ini，在同一工作目录下运行即可
+QT       -= gui
+QT       += core network sql
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = attendance-serverd
+
+include(../servercore.pri)
+
+SOURCES += \
+    main.cpp
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,25 @@
+#include "attendanceservice.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QDebug>
+
+// 无界面考勤服务器的入口点
+// 功能：
+// - 使用QCoreApplication运行事件循环，不需要图形环境
+// - 初始化考勤服务：注册信号槽传递的数据类型、连接SQLite数据库并建表、必要时重建人脸特征库
+// - 启动考勤服务，不连接图像显示信号，接收到的图像只用于识别
+// 返回值：
+// - 应用程序执行状态码（0表示正常退出，-1表示错误退出）
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    if(!AttendanceService::initialize()){
+        return -1;
+    }
+
+    AttendanceService service;
+    qDebug()<<"attendance-serverd已启动，工作目录"<<QDir::currentPath();
+    return a.exec();
+}
@@ -3,6 +3,108 @@
 #include <QJsonDocument>
 #include <QJsonParseError>
 #include <QJsonObject>
+#include <QElapsedTimer>
+#include <QFloat16>
+#include <QDateTime>
+
+/**
+ * @brief 是否随图像上传本地检测到的人脸框
+ * @details 服务器需要支持FramePacket包头，连接旧版本服务器时改为false
+ */
+static const bool SEND_FACE_RECT = true;
+
+/**
+ * @brief 上传数据的包头标识、版本号和标志位，与服务器端FramePacket一致
+ * @details 第2版增加了特征、请求ID和二进制应答标志位，只支持第1版的服务器会拒绝这些包
+ */
+static const quint32 FRAME_MAGIC = 0x46414652; // "FAFR"
+static const quint8 FRAME_VERSION = 2;
+static const quint8 FRAME_FLAG_FACE = 0x01;
+static const quint8 FRAME_FLAG_FEATURE = 0x02;
+static const quint8 FRAME_FLAG_FP16 = 0x04;
+static const quint8 FRAME_FLAG_REQUEST_ID = 0x08;
+static const quint8 FRAME_FLAG_BINARY_REPLY = 0x10;
+
+/**
+ * @brief 是否使用分帧应答协议
+ * @details true时每帧带上终端分配的请求ID，服务器的应答带长度前缀和该请求ID，
+ *          多个应答合并在一次readyRead中也能正确拆开，终端可以同时有多帧在途
+ */
+static const bool FRAMED_PROTOCOL = true;
+
+/**
+ * @brief 是否要求服务器发送二进制应答
+ * @details 只在分帧应答协议下生效；二进制应答以类型字节0x01开头，JSON应答以'{'开头，
+ *          服务器不支持二进制应答时仍然可以按JSON显示
+ */
+static const bool BINARY_REPLY = true;
+
+/**
+ * @brief 二进制应答的类型字节，与服务器端AttendanceReply一致
+ */
+static const quint8 REPLY_BINARY_TYPE = 0x01;
+
+/**
+ * @brief 同时在途的最大帧数
+ * @details 达到上限时暂停上传，等待应答或超时
+ */
+static const int MAX_INFLIGHT = 4;
+
+/**
+ * @brief 在途帧的应答超时，单位毫秒
+ * @details 服务器过载时会丢弃过期的帧而不应答，超时的帧不再占用在途名额
+ */
+static const qint64 REPLY_TIMEOUT = 3000;
+
+/**
+ * @brief 是否只上传人脸裁剪图
+ * @details true时只编码以人脸为中心、固定大小的裁剪图，false时上传480x480整帧
+ *          裁剪图的JPEG只有整帧的几分之一，终端编码和服务器解码的耗时也随像素数下降
+ */
+static const bool UPLOAD_CROP = true;
+
+/**
+ * @brief 裁剪图的边长和相对人脸框的扩展倍数
+ * @details 人脸框取1.6倍边长的正方形区域，给关键点定位留出额头、下巴和两侧的余量，
+ *          再缩放到固定的256x256，服务器端每帧的解码耗时稳定
+ */
+static const int CROP_SIZE = 256;
+static const double CROP_PADDING = 1.6;
+
+/**
+ * @brief 是否同时编码整帧用于对比
+ * @details 打开后每次上传还会额外编码一次另一种模式（不发送），统计输出两种模式的字节数和编码耗时
+ */
+static const bool UPLOAD_BENCHMARK = false;
+
+/**
+ * @brief 上传统计窗口：每上传这么多次输出一次平均字节数和编码耗时
+ */
+static const int UPLOAD_STAT_WINDOW = 20;
+
+/**
+ * @brief 边缘特征模式
+ * @details true时终端在本地完成关键点定位和特征提取，只上传特征和一张小缩略图，
+ *          服务器跳过图像解码、检测和特征提取，直接比对；需要在终端部署与服务器相同版本的模型文件
+ */
+static const bool EDGE_EMBEDDING = false;
+
+/**
+ * @brief 特征是否以半精度上传
+ * @details 余弦相似度对半精度的舍入误差不敏感，上传字节数减半
+ */
+static const bool EDGE_FP16 = true;
+
+/**
+ * @brief 边缘特征模式下附带的人脸缩略图边长，0表示不附带
+ */
+static const int THUMB_SIZE = 64;
+
+/**
+ * @brief 边缘特征模式使用的模型文件，与服务器FaceEngineRegistry一致
+ */
+static const char *PD_MODEL = "C:/SeetaFace/bin/model/pd_2_00_pts5.dat";
+static const char *FR_MODEL = "C:/SeetaFace/bin/model/fr_2_10.dat";
 
 /**
  * @brief 构造函数
@@ -61,7 +163,22 @@ FaceAttendannce::FaceAttendannce(QWidget *parent)
     //启动定时器
     mtimer.start(5000);//每5s连接一次，直到连接成功后就不再连接
     flag = 0;
+    uploadcount = 0;
+    uploadbytes = 0;
+    uploadtime = 0;
+    comparebytes = 0;
+    comparetime = 0;
+    nextrequestid = 1;
+    lastshown = 0;
     ui->widgetLb->hide();
+
+    //边缘特征模式：加载关键点定位和特征提取模型，人脸检测仍使用Haar分类器
+    if(EDGE_EMBEDDING){
+        seeta::ModelSetting pdsetting(PD_MODEL,seeta::ModelSetting::CPU,0);
+        landmarker.reset(new seeta::FaceLandmarker(pdsetting));
+        seeta::ModelSetting frsetting(FR_MODEL,seeta::ModelSetting::CPU,0);
+        recognizer.reset(new seeta::FaceRecognizer(frsetting));
+    }
 }
 
 FaceAttendannce::~FaceAttendannce()
@@ -115,29 +232,20 @@ void FaceAttendannce::timerEvent(QTimerEvent *e)
         //移动人脸框（图片--QLabel）
         ui->headpicLb->move(rect.x,rect.y);
 
-        if(flag >2){
-            // 将OpenCV的Mat格式图像数据编码为JPEG压缩格式
-            // 创建向量缓冲区用于存储编码后的JPEG图像数据
-            vector<uchar> buf;  // uchar类型：无符号字符，适合存储字节数据
-
-            // 使用OpenCV的imencode函数将Mat图像压缩为JPEG格式
-            // 参数说明：
-            //  - ".jpg": 输出图像格式为JPEG
-            //  - srcImage: 输入的原始图像数据（检测人脸后的完整图像帧）
-            //  - buf: 输出参数，存储编码后的JPEG字节数据
-            // 作用：大幅减少图像数据大小，提高网络传输效率
-            cv::imencode(".jpg",srcImage,buf);
-
-            // 将OpenCV的字节数据转换为Qt可处理的字节数组
-            // QByteArray是Qt框架中的字节数组类，提供了丰富的操作方法
-            // 构造函数参数详解：
-            //  - (const char*)buf.data(): 将OpenCV向量的数据指针转换为C字符串指针
-            //  - buf.size(): 数据大小（字节数），确保完整传输所有图像数据
-            QByteArray byte((const char*)buf.data(),buf.size());
+        // 分帧协议下清理应答超时的在途帧，在途帧达到上限时暂缓上传
+        if(FRAMED_PROTOCOL){
+            for(auto it = inflight.begin(); it != inflight.end();){
+                if(it.value().elapsed() > REPLY_TIMEOUT) it = inflight.erase(it);
+                else ++it;
+            }
+        }
+        if(flag >2 && (!FRAMED_PROTOCOL || inflight.size() < MAX_INFLIGHT)){
+            // 按上传模式编码整帧或人脸裁剪图，需要时在前面加上人脸框包头
+            QByteArray byte = make_upload(srcImage,rect);
 
             // 准备网络传输数据格式
             // quint64：64位无符号整数，确保在各种平台上图像大小数据一致性
-            // 记录编码后JPEG图像的实际字节数，用于接收端验证数据完整性
+            // 记录编码后数据（包头+JPEG）的实际字节数，用于接收端验证数据完整性
             quint64 backsize = byte.size();
 
             // 创建用于网络传输的字节数组容器
@@ -165,6 +273,10 @@ void FaceAttendannce::timerEvent(QTimerEvent *e)
             // QTcpSocket::write()函数将sendData中的所有字节写入网络缓冲区
             msocket.write(sendData);
             flag = -2;
+            if(FRAMED_PROTOCOL){
+                inflight[nextrequestid].start();
+                nextrequestid++;
+            }
 
             faceMat = srcImage(rect);
             //保存
@@ -214,6 +326,194 @@ void FaceAttendannce::timerEvent(QTimerEvent *e)
     ui->videoLb->setPixmap(mmp);
 }
 
+/**
+ * @brief 编码一张上传图像
+ * @param image 待编码的BGR图像
+ * @param buf 输出JPEG数据
+ * @return 编码耗时，单位微秒
+ */
+static qint64 encode_jpeg(const Mat &image, vector<uchar> &buf)
+{
+    QElapsedTimer timer;
+    timer.start();
+    // 使用OpenCV的imencode函数将Mat图像压缩为JPEG格式
+    // 参数说明：
+    //  - ".jpg": 输出图像格式为JPEG
+    //  - image: 输入的图像数据（整帧或人脸裁剪图）
+    //  - buf: 输出参数，存储编码后的JPEG字节数据
+    // 作用：大幅减少图像数据大小，提高网络传输效率
+    cv::imencode(".jpg",image,buf);
+    return timer.nsecsElapsed() / 1000;
+}
+
+/**
+ * @brief 生成一次上传的数据
+ * @param frame 480x480的整帧图像
+ * @param rect 本地检测到的人脸框
+ * @return 包头（可选）+JPEG数据
+ * @details 0. 边缘特征模式下优先在本地提取特征，见make_feature_upload
+ *          1. 裁剪模式下以人脸框中心取CROP_PADDING倍边长的正方形，超出画面的部分补黑边，
+ *             人脸始终位于裁剪图中央，再缩放为CROP_SIZE x CROP_SIZE
+ *          2. 人脸框换算到上传图像的坐标，随包头一起发送，服务器可以直接跳过检测
+ *          3. 累计字节数和编码耗时，每UPLOAD_STAT_WINDOW次输出一次
+ */
+QByteArray FaceAttendannce::make_upload(const Mat &frame, const Rect &rect)
+{
+    // 边缘特征模式：本地提取成功时只上传特征，失败时退回图像上传
+    QByteArray packet;
+    if(EDGE_EMBEDDING && make_feature_upload(frame,rect,packet)){
+        return packet;
+    }
+
+    Rect face = rect;
+    Mat crop;
+    if(UPLOAD_CROP || UPLOAD_BENCHMARK){
+        int side = (int)(std::max(rect.width,rect.height) * CROP_PADDING);
+        Rect square(rect.x + rect.width / 2 - side / 2, rect.y + rect.height / 2 - side / 2, side, side);
+        Rect inside = square & Rect(0,0,frame.cols,frame.rows);
+        cv::copyMakeBorder(frame(inside),crop,
+                           inside.y - square.y,square.br().y - inside.br().y,
+                           inside.x - square.x,square.br().x - inside.br().x,
+                           BORDER_CONSTANT,Scalar(0,0,0));
+        cv::resize(crop,crop,Size(CROP_SIZE,CROP_SIZE));
+        if(UPLOAD_CROP){
+            double scale = (double)CROP_SIZE / side;
+            face = Rect((int)((rect.x - square.x) * scale),(int)((rect.y - square.y) * scale),
+                        (int)(rect.width * scale),(int)(rect.height * scale));
+        }
+    }
+
+    // 将OpenCV的Mat格式图像数据编码为JPEG压缩格式
+    // 创建向量缓冲区用于存储编码后的JPEG图像数据
+    vector<uchar> buf;  // uchar类型：无符号字符，适合存储字节数据
+    qint64 elapsed = encode_jpeg(UPLOAD_CROP ? crop : frame,buf);
+    if(UPLOAD_BENCHMARK){
+        vector<uchar> other;
+        comparetime += encode_jpeg(UPLOAD_CROP ? frame : crop,other);
+        comparebytes += other.size();
+    }
+    record_upload(UPLOAD_CROP ? "裁剪图" : "整帧",buf.size(),elapsed);
+
+    // 将OpenCV的字节数据转换为Qt可处理的字节数组
+    // QByteArray是Qt框架中的字节数组类，提供了丰富的操作方法
+    // 构造函数参数详解：
+    //  - (const char*)buf.data(): 将OpenCV向量的数据指针转换为C字符串指针
+    //  - buf.size(): 数据大小（字节数），确保完整传输所有图像数据
+    QByteArray byte((const char*)buf.data(),buf.size());
+
+    // 在JPEG数据前加上包头，附带请求ID和本地Haar检测得到的人脸框
+    // 服务器拿到人脸框后可以跳过整帧人脸检测，直接在框内定位关键点
+    // 包头格式与服务器端FramePacket一致："FAFR"标识、版本、标志位、请求ID、人脸框x/y/宽/高
+    if(SEND_FACE_RECT || FRAMED_PROTOCOL){
+        QByteArray header;
+        QDataStream hstream(&header,QIODevice::WriteOnly);
+        hstream.setVersion(QDataStream::Qt_5_15);
+        write_header(hstream,SEND_FACE_RECT ? FRAME_FLAG_FACE : 0);
+        if(SEND_FACE_RECT){
+            hstream<<(qint32)face.x<<(qint32)face.y<<(qint32)face.width<<(qint32)face.height;
+        }
+        byte.prepend(header);
+    }
+    return byte;
+}
+
+/**
+ * @brief 在本地提取特征并生成上传数据
+ * @param frame 480x480的整帧图像
+ * @param rect 本地检测到的人脸框
+ * @param packet 输出：包头+特征+缩略图
+ * @return 特征提取失败时返回false
+ * @details 1. 直接把Haar人脸框交给关键点定位器，再由识别器提取特征，与服务器trust模式的做法相同
+ *          2. 特征按EDGE_FP16选择半精度或单精度，1024维分别为2KB和4KB
+ *          3. 附带一张THUMB_SIZE大小的人脸缩略图，只用于服务器界面显示
+ */
+bool FaceAttendannce::make_feature_upload(const Mat &frame, const Rect &rect, QByteArray &packet)
+{
+    QElapsedTimer timer;
+    timer.start();
+    //把opencv的Mat转为SeetaFace的图像数据，只复制头信息
+    SeetaImageData simage;
+    simage.data = frame.data;
+    simage.width = frame.cols;
+    simage.height = frame.rows;
+    simage.channels = frame.channels();
+    Rect inside = rect & Rect(0,0,frame.cols,frame.rows);
+    SeetaRect face{inside.x,inside.y,inside.width,inside.height};
+    vector<SeetaPointF> points(landmarker->number());
+    landmarker->mark(simage,face,points.data());
+    vector<float> feature(recognizer->GetExtractFeatureSize());
+    if(!recognizer->Extract(simage,points.data(),feature.data())){
+        qDebug()<<"本地特征提取失败，改为上传图像";
+        return false;
+    }
+    qint64 elapsed = timer.nsecsElapsed() / 1000;
+
+    //人脸缩略图
+    vector<uchar> thumb;
+    if(THUMB_SIZE > 0){
+        Mat thumbimage;
+        cv::resize(frame(inside),thumbimage,Size(THUMB_SIZE,THUMB_SIZE));
+        cv::imencode(".jpg",thumbimage,thumb,{IMWRITE_JPEG_QUALITY,70});
+    }
+
+    //包头格式与服务器端FramePacket一致："FAFR"标识、版本、标志位、请求ID、特征维度、特征、缩略图
+    packet.clear();
+    QDataStream stream(&packet,QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_15);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    write_header(stream,FRAME_FLAG_FEATURE | (EDGE_FP16 ? FRAME_FLAG_FP16 : 0));
+    stream<<(quint16)feature.size();
+    for(float value : feature){
+        if(EDGE_FP16){
+            stream<<qfloat16(value);
+        }else{
+            stream<<value;
+        }
+    }
+    stream.writeRawData((const char*)thumb.data(),(int)thumb.size());
+    record_upload("特征",packet.size(),elapsed);
+    return true;
+}
+
+/**
+ * @brief 写入上传数据的包头
+ * @param stream 输出数据流
+ * @param flags 标志位，使用分帧协议时自动加上FRAME_FLAG_REQUEST_ID，要求二进制应答时再加上FRAME_FLAG_BINARY_REPLY
+ * @details 请求ID取nextrequestid，发送成功后由timerEvent登记为在途并递增
+ */
+void FaceAttendannce::write_header(QDataStream &stream, quint8 flags)
+{
+    if(FRAMED_PROTOCOL) flags |= FRAME_FLAG_REQUEST_ID;
+    if(FRAMED_PROTOCOL && BINARY_REPLY) flags |= FRAME_FLAG_BINARY_REPLY;
+    stream<<FRAME_MAGIC<<FRAME_VERSION<<flags;
+    if(FRAMED_PROTOCOL) stream<<nextrequestid;
+}
+
+/**
+ * @brief 记录一次上传
+ * @param mode 上传模式名称，用于日志
+ * @param bytes 上传的字节数
+ * @param elapsed 编码或特征提取耗时，单位微秒
+ * @details 每UPLOAD_STAT_WINDOW次输出一次平均值，打开UPLOAD_BENCHMARK时同时输出另一种图像模式的对比数据
+ */
+void FaceAttendannce::record_upload(const char *mode, qint64 bytes, qint64 elapsed)
+{
+    uploadcount++;
+    uploadbytes += bytes;
+    uploadtime += elapsed;
+    if(uploadcount < UPLOAD_STAT_WINDOW) return;
+    qDebug()<<"上传统计："<<mode<<"平均"<<uploadbytes / uploadcount<<"字节，耗时"<<uploadtime / uploadcount<<"微秒";
+    if(UPLOAD_BENCHMARK && comparebytes > 0){
+        qDebug()<<"对比："<<(UPLOAD_CROP ? "整帧" : "裁剪图")<<"平均"<<comparebytes / uploadcount<<"字节，编码"
+                <<comparetime / uploadcount<<"微秒";
+    }
+    uploadcount = 0;
+    uploadbytes = 0;
+    uploadtime = 0;
+    comparebytes = 0;
+    comparetime = 0;
+}
+
 /**
  * @brief 连接定时器超时处理函数
  * 功能：
@@ -255,28 +555,78 @@ void FaceAttendannce::Start_connect()
 {
     mtimer.start(5000);//启动定时器
     qDebug()<<"断开服务器连接!";
+    //连接断开后在途帧不会再有应答，未拆完的数据也作废
+    inflight.clear();
+    recvbuffer.clear();
 }
 
 /**
  * @brief 接收数据处理函数
  * 功能：
- * - 接收服务器返回的JSON格式考勤结果数据
- * - 解析JSON数据，提取员工ID、姓名、部门和时间信息
- * - 更新UI界面显示考勤结果
- * - 设置员工头像显示
+ * - 分帧协议下把收到的数据追加到接收缓冲区，按"quint32长度 + quint64请求ID + 应答"逐个拆出
+ * - 一次readyRead中可能包含多个应答，也可能只有半个，数据不足时留到下次
+ * - 旧协议下一次读取的全部数据作为一个应答
  * 触发时机：
  * - 当接收到服务器数据时自动调用
  */
 void FaceAttendannce::recv_data()
 {
+    if(!FRAMED_PROTOCOL){
+        // 从TCP套接字读取服务器返回的所有数据
+        // msocket.readAll()会一次性读取socket缓冲区中的所有可用数据
+        show_reply(msocket.readAll());
+        return;
+    }
+
+    recvbuffer.append(msocket.readAll());
+    const int headsize = sizeof(quint32) + sizeof(quint64);
+    while(recvbuffer.size() >= headsize){
+        QDataStream stream(recvbuffer);
+        stream.setVersion(QDataStream::Qt_5_15);
+        quint32 length = 0;
+        quint64 requestid = 0;
+        stream>>length>>requestid;
+        if(length < sizeof(quint64)){
+            qDebug()<<"应答长度错误，丢弃接收缓冲区";
+            recvbuffer.clear();
+            return;
+        }
+        if((quint64)recvbuffer.size() < sizeof(quint32) + (quint64)length) return;
+        QByteArray array = recvbuffer.mid(headsize,(int)(length - sizeof(quint64)));
+        recvbuffer.remove(0,(int)(sizeof(quint32) + length));
+
+        // 按请求ID匹配在途帧，应答可能乱序到达，只显示比已显示结果更新的应答
+        auto it = inflight.find(requestid);
+        if(it != inflight.end()){
+            qDebug()<<"请求"<<requestid<<"往返耗时"<<it.value().elapsed()<<"毫秒，在途"<<inflight.size() - 1;
+            inflight.erase(it);
+        }
+        if(requestid < lastshown){
+            qDebug()<<"请求"<<requestid<<"的应答晚于请求"<<lastshown<<"到达，不再显示";
+            continue;
+        }
+        lastshown = requestid;
+        show_reply(array);
+    }
+}
+
+/**
+ * @brief 显示一个应答
+ * @param array 服务器返回的JSON数据或二进制应答
+ * 功能：
+ * - 按首字节区分应答格式：'{'为JSON，REPLY_BINARY_TYPE为二进制
+ * - 解析出员工ID、姓名、部门和时间信息后交给show_attendance显示
+ */
+void FaceAttendannce::show_reply(const QByteArray &array)
+{
+    if(!array.isEmpty() && (quint8)array.at(0) == REPLY_BINARY_TYPE){
+        show_binary_reply(array);
+        return;
+    }
+
     // 注释：JSON数据格式示例，包含考勤结果所需的字段
     //{employeeID:%1,name:%2,department:软件,time:%3}
-    
-    // 从TCP套接字读取服务器返回的所有数据
-    // QByteArray是Qt中的字节数组类，适合存储二进制数据或文本数据
-    // msocket.readAll()会一次性读取socket缓冲区中的所有可用数据
-    QByteArray array = msocket.readAll();
-    
+
     // 调试输出：打印接收到的原始数据，用于开发调试
     qDebug()<<array;
     
@@ -314,6 +664,60 @@ void FaceAttendannce::recv_data()
     // 提取考勤时间信息
     QString timestr = obj.value("time").toString();
 
+    show_attendance(employeeID,name,department,timestr);
+}
+
+/**
+ * @brief 解析并显示一个二进制应答
+ * @param array 二进制应答，格式见服务器端AttendanceReply
+ * @details 定长部分之后是两个"quint16长度 + UTF-8"字符串，数据不完整时不显示
+ */
+void FaceAttendannce::show_binary_reply(const QByteArray &array)
+{
+    QDataStream stream(array);
+    stream.setVersion(QDataStream::Qt_5_15);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    quint8 type = 0;
+    quint8 status = 0;
+    qint64 employeeid = -1;
+    qint64 faceid = -1;
+    float similarity = 0.0f;
+    qint64 msecs = 0;
+    stream>>type>>status>>employeeid>>faceid>>similarity>>msecs;
+
+    QString texts[2];
+    for(QString &text : texts){
+        quint16 length = 0;
+        stream>>length;
+        QByteArray bytes(length,0);
+        if(stream.readRawData(bytes.data(),length) != length){
+            qDebug()<<"二进制应答不完整！";
+            return;
+        }
+        text = QString::fromUtf8(bytes);
+    }
+    if(stream.status() != QDataStream::Ok){
+        qDebug()<<"二进制应答不完整！";
+        return;
+    }
+    qDebug()<<"二进制应答：员工"<<employeeid<<"人脸"<<faceid<<"相似度"<<similarity<<array.size()<<"字节";
+
+    // 失败时与JSON应答一样显示空白信息
+    QString employeeID = status ? QString::number(employeeid) : QString(" ");
+    QString timestr = status ? QDateTime::fromMSecsSinceEpoch(msecs).toString("yyyy-MM-dd hh:mm:ss") : QString();
+    show_attendance(employeeID,texts[0],texts[1],timestr);
+}
+
+/**
+ * @brief 在界面上显示考勤结果
+ * @param employeeID 员工ID
+ * @param name 员工姓名
+ * @param department 部门
+ * @param timestr 考勤时间
+ */
+void FaceAttendannce::show_attendance(const QString &employeeID, const QString &name,
+                                      const QString &department, const QString &timestr)
+{
     ui->numberEdit->setText(employeeID);
     ui->nameEdit->setText(name);
     ui->departmentEdit->setText(department);
@@ -5,8 +5,13 @@
 #include <opencv.hpp>
 #include <QTcpSocket>
 #include <QTimer>
+#include <QHash>
+#include <QElapsedTimer>
 #include <QDebug>
 #include <iostream>
+#include <memory>
+#include <seeta/FaceLandmarker.h>
+#include <seeta/FaceRecognizer.h>
 
 using namespace cv;
 using namespace std;
@@ -82,6 +87,52 @@ private slots:
     void recv_data();
 
 private:
+    /**
+     * @brief 生成一次上传的数据
+     * @param frame 整帧图像
+     * @param rect 本地检测到的人脸框
+     * @return 可选的人脸框包头加JPEG数据
+     * 功能：按上传模式编码整帧或人脸裁剪图，并统计字节数和编码耗时
+     */
+    QByteArray make_upload(const cv::Mat &frame, const cv::Rect &rect);
+
+    /**
+     * @brief 在本地提取特征并生成上传数据
+     * @param frame 整帧图像
+     * @param rect 本地检测到的人脸框
+     * @param packet 输出：包头、特征和缩略图
+     * @return 特征提取失败时返回false
+     * 功能：边缘特征模式下代替图像上传，服务器收到后直接比对
+     */
+    bool make_feature_upload(const cv::Mat &frame, const cv::Rect &rect, QByteArray &packet);
+
+    /**
+     * @brief 记录一次上传的字节数和耗时，定期输出平均值
+     */
+    void record_upload(const char *mode, qint64 bytes, qint64 elapsed);
+
+    /**
+     * @brief 写入上传数据的包头：标识、版本、标志位和分帧协议下的请求ID
+     */
+    void write_header(QDataStream &stream, quint8 flags);
+
+    /**
+     * @brief 解析并显示一个应答
+     * @param array 服务器返回的JSON数据或二进制应答
+     */
+    void show_reply(const QByteArray &array);
+
+    /**
+     * @brief 解析并显示一个二进制应答
+     */
+    void show_binary_reply(const QByteArray &array);
+
+    /**
+     * @brief 在界面上显示员工信息和考勤时间
+     */
+    void show_attendance(const QString &employeeID, const QString &name,
+                         const QString &department, const QString &timestr);
+
     Ui::FaceAttendannce *ui;                 // UI界面指针
 
     //摄像头 - 用于捕获实时视频流
@@ -102,6 +153,23 @@ private:
     int flag;                                // 人脸检测计数标志
     //保存人脸的数据
     cv::Mat faceMat;                         // 保存检测到的人脸图像
+
+    //上传统计 - 用于比较整帧与裁剪图两种上传模式
+    int uploadcount;                         // 当前统计窗口内的上传次数
+    qint64 uploadbytes;                      // 上传的JPEG字节数
+    qint64 uploadtime;                       // 编码耗时（微秒）
+    qint64 comparebytes;                     // 另一种模式的JPEG字节数，只在对比时统计
+    qint64 comparetime;                      // 另一种模式的编码耗时（微秒）
+
+    //分帧协议 - 请求ID和在途帧
+    quint64 nextrequestid;                   // 下一帧的请求ID
+    quint64 lastshown;                       // 已显示的最新应答的请求ID
+    QHash<quint64, QElapsedTimer> inflight;  // 已发送尚未应答的帧，值为发送时开始的计时器
+    QByteArray recvbuffer;                   // 尚未拆完的应答数据
+
+    //边缘特征模式 - 只在开启时加载
+    std::unique_ptr<seeta::FaceLandmarker> landmarker; // 关键点定位器
+    std::unique_ptr<seeta::FaceRecognizer> recognizer; // 特征提取器
 };
 
 #endif // FACEATTENDANNCE_H